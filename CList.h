@@ -0,0 +1,374 @@
+#ifndef CLIST_H
+#define CLIST_H
+
+#include<stdlib.h>
+#include<stdint.h>
+#include<stdatomic.h>
+
+// Thread safe counterpart to List.h. Nodes come from one shared pool but
+// every thread keeps its own cache of free nodes, so allocating and
+// freeing a node normally touches no shared memory at all; caches trade
+// nodes with the pool a whole batch at a time.
+//
+// CQUEUE is a lock-free Michael-Scott FIFO for the append/trim pattern
+// the ready queues use. Nodes are named by 32-bit index and every shared
+// link carries a 32-bit tag that changes on each update, so one 64-bit
+// compare-and-swap updates a link and a recycled node can't be mistaken
+// for the one a stalled thread read earlier (ABA). Pool memory is only
+// released by CListDeinit, so a stalled thread never reads freed memory.
+
+typedef struct {
+    void* _Atomic data;
+    _Atomic uint64_t next;          // Tagged index of the next node on a queue
+    uint32_t freeNext;              // Next free node in the same batch
+    _Atomic uint32_t nextBatch;     // First node of the next batch in the pool
+} CNODE;
+
+typedef struct {
+    _Atomic uint64_t head;          // Tagged index of the dummy node
+    _Atomic uint64_t tail;          // Tagged index of the last node
+    atomic_int count;
+} CQUEUE;
+
+// Pool sizing. Nodes are carved out of chunks of CLIST_CHUNK_SIZE that
+// are allocated on demand, up to CLIST_MAX_NODES in total. Caches trade
+// CLIST_BATCH nodes with the pool at once.
+#ifndef CLIST_BATCH
+#define CLIST_BATCH 64
+#endif
+#define CLIST_CHUNK_SHIFT 12
+#define CLIST_CHUNK_SIZE (1 << CLIST_CHUNK_SHIFT)
+#ifndef CLIST_MAX_NODES
+#define CLIST_MAX_NODES (1 << 24)
+#endif
+#define CLIST_MAX_CHUNKS (CLIST_MAX_NODES / CLIST_CHUNK_SIZE)
+
+#if CLIST_CHUNK_SIZE % CLIST_BATCH != 0
+#error "CLIST_BATCH must divide the chunk size"
+#endif
+
+// Index 0 is never handed out and stands for NULL
+#define CLIST_NIL 0
+
+#define CREF(index, tag) (((uint64_t)(tag) << 32) | (uint32_t)(index))
+#define CINDEX(ref) ((uint32_t)(ref))
+#define CTAG(ref) ((uint32_t)((ref) >> 32))
+
+
+/*
+ * Set up the shared node pool
+ * Must not race with any other CList call
+ */
+void CListInit(void);
+
+
+/*
+ * Release the shared node pool
+ * Every queue is invalid afterwards, and every thread's cache is
+    dropped the next time that thread allocates
+ */
+void CListDeinit(void);
+
+
+/*
+ * Gives the calling thread's cached nodes back to the shared pool
+ * Call before a thread that used CList exits
+ */
+void CListFlushCache(void);
+
+
+/*
+ * Make an empty queue
+ * returns 0 for success, -1 for failure
+ */
+int CQueueInit(CQUEUE* q);
+
+
+/*
+ * Empty the queue and give its nodes back
+ * Must not race with any other call on q
+ */
+void CQueueFree(CQUEUE* q);
+
+
+/*
+ * adds item to the back of the queue
+ * safe to call from any number of threads at once
+ * return 0 for success, -1 for failure
+ */
+int CQueueEnqueue(CQUEUE* q, void* item);
+
+
+/*
+ * takes the item at the front of the queue out and returns it
+ * returns NULL if the queue is empty
+ * safe to call from any number of threads at once
+ */
+void* CQueueDequeue(CQUEUE* q);
+
+
+/*
+ * return the number of items in the queue
+ * only a snapshot while other threads are using it
+ */
+int CQueueCount(CQUEUE* q);
+
+//------------------------------------------------------------------------------------
+
+CNODE* _Atomic cnodeChunks[CLIST_MAX_CHUNKS];
+_Atomic uint32_t cnodeCarved;       // Indexes carved out of chunks so far
+_Atomic uint64_t cnodeFreeBatches;  // Tagged index of the first free batch
+atomic_int cnodeGeneration;         // Bumped by CListDeinit to drop stale caches
+
+// Per-thread cache of free nodes, chained through freeNext
+_Thread_local struct {
+    uint32_t first;
+    int count;
+    int generation;
+} cnodeCache;
+
+/*
+ * Helper to find a node by index
+ */
+CNODE* cnodeAt(uint32_t index) {
+    CNODE* chunk = atomic_load_explicit(&cnodeChunks[index >> CLIST_CHUNK_SHIFT], memory_order_acquire);
+    return &chunk[index & (CLIST_CHUNK_SIZE - 1)];
+}
+
+/*
+ * Helper to make sure the chunk holding index exists
+ * Returns 0 for success, -1 for failure
+ */
+int cnodeChunkFor(uint32_t index) {
+    CNODE* _Atomic* slot = &cnodeChunks[index >> CLIST_CHUNK_SHIFT];
+    if(atomic_load_explicit(slot, memory_order_acquire) != NULL)
+        return 0;
+
+    CNODE* chunk = calloc(CLIST_CHUNK_SIZE, sizeof(CNODE));
+    if(chunk == NULL)
+        return -1;
+    CNODE* expected = NULL;
+    // Another thread may have added the chunk first
+    if(!atomic_compare_exchange_strong_explicit(slot, &expected, chunk,
+                                                memory_order_acq_rel, memory_order_acquire))
+        free(chunk);
+    return 0;
+}
+
+/*
+ * Helper to push a chain of free nodes onto the pool as one batch
+ */
+void cnodePushBatch(uint32_t first) {
+    CNODE* node = cnodeAt(first);
+    uint64_t top = atomic_load_explicit(&cnodeFreeBatches, memory_order_relaxed);
+    do {
+        atomic_store_explicit(&node->nextBatch, CINDEX(top), memory_order_relaxed);
+    } while(!atomic_compare_exchange_weak_explicit(&cnodeFreeBatches, &top, CREF(first, CTAG(top) + 1),
+                                                   memory_order_release, memory_order_relaxed));
+}
+
+/*
+ * Helper to take one batch of free nodes off the pool
+ * Returns its first node, CLIST_NIL if the pool has none
+ */
+uint32_t cnodePopBatch(void) {
+    uint64_t top = atomic_load_explicit(&cnodeFreeBatches, memory_order_acquire);
+    while(CINDEX(top) != CLIST_NIL) {
+        uint32_t next = atomic_load_explicit(&cnodeAt(CINDEX(top))->nextBatch, memory_order_relaxed);
+        if(atomic_compare_exchange_weak_explicit(&cnodeFreeBatches, &top, CREF(next, CTAG(top) + 1),
+                                                 memory_order_acquire, memory_order_acquire))
+            return CINDEX(top);
+    }
+    return CLIST_NIL;
+}
+
+/*
+ * Helper to refill the calling thread's empty cache, from the pool's
+    free batches first and from fresh chunk space after that
+ * Returns 0 for success, -1 once CLIST_MAX_NODES are in use
+ */
+int cnodeRefill(void) {
+    uint32_t first = cnodePopBatch();
+    if(first != CLIST_NIL) {
+        int count = 0;
+        for(uint32_t i=first; i!=CLIST_NIL; i=cnodeAt(i)->freeNext)
+            count++;
+        cnodeCache.first = first;
+        cnodeCache.count = count;
+        return 0;
+    }
+
+    if(atomic_load_explicit(&cnodeCarved, memory_order_relaxed) > CLIST_MAX_NODES - CLIST_BATCH)
+        return -1;
+    first = atomic_fetch_add_explicit(&cnodeCarved, CLIST_BATCH, memory_order_relaxed);
+    if(first > CLIST_MAX_NODES - CLIST_BATCH || cnodeChunkFor(first) != 0)
+        return -1;
+
+    // Chain the fresh batch, leaving out the NIL index
+    uint32_t start = first == CLIST_NIL ? 1 : first;
+    CNODE* chunk = cnodeAt(first) - (first & (CLIST_CHUNK_SIZE - 1));
+    for(uint32_t i=start; i<first+CLIST_BATCH; i++)
+        chunk[i & (CLIST_CHUNK_SIZE - 1)].freeNext = i+1 < first+CLIST_BATCH ? i+1 : CLIST_NIL;
+    cnodeCache.first = start;
+    cnodeCache.count = (int)(first + CLIST_BATCH - start);
+    return 0;
+}
+
+/*
+ * Helper to take a node from the calling thread's cache
+ * Returns its index, CLIST_NIL on failure
+ */
+uint32_t cnodeAlloc(void) {
+    int generation = atomic_load_explicit(&cnodeGeneration, memory_order_relaxed);
+    if(cnodeCache.generation != generation) {
+        cnodeCache.first = CLIST_NIL;
+        cnodeCache.count = 0;
+        cnodeCache.generation = generation;
+    }
+    if(cnodeCache.count == 0 && cnodeRefill() != 0)
+        return CLIST_NIL;
+
+    uint32_t index = cnodeCache.first;
+    cnodeCache.first = cnodeAt(index)->freeNext;
+    cnodeCache.count--;
+    return index;
+}
+
+/*
+ * Helper to give a node to the calling thread's cache
+ * A cache holding two batches hands one back to the pool
+ */
+void cnodeRelease(uint32_t index) {
+    cnodeAt(index)->freeNext = cnodeCache.first;
+    cnodeCache.first = index;
+    if(++cnodeCache.count < 2 * CLIST_BATCH)
+        return;
+
+    uint32_t last = index;
+    for(int i=1; i<CLIST_BATCH; i++)
+        last = cnodeAt(last)->freeNext;
+    cnodeCache.first = cnodeAt(last)->freeNext;
+    cnodeCache.count -= CLIST_BATCH;
+    cnodeAt(last)->freeNext = CLIST_NIL;
+    cnodePushBatch(index);
+}
+
+void CListInit(void) {
+    for(int i=0; i<CLIST_MAX_CHUNKS; i++)
+        atomic_store_explicit(&cnodeChunks[i], NULL, memory_order_relaxed);
+    atomic_store(&cnodeCarved, 0);
+    atomic_store(&cnodeFreeBatches, CREF(CLIST_NIL, 0));
+}
+
+void CListDeinit(void) {
+    for(int i=0; i<CLIST_MAX_CHUNKS; i++) {
+        free(atomic_load_explicit(&cnodeChunks[i], memory_order_relaxed));
+        atomic_store_explicit(&cnodeChunks[i], NULL, memory_order_relaxed);
+    }
+    atomic_store(&cnodeCarved, 0);
+    atomic_store(&cnodeFreeBatches, CREF(CLIST_NIL, 0));
+    atomic_fetch_add(&cnodeGeneration, 1);
+}
+
+void CListFlushCache(void) {
+    if(cnodeCache.generation == atomic_load(&cnodeGeneration) && cnodeCache.count > 0)
+        cnodePushBatch(cnodeCache.first);
+    cnodeCache.first = CLIST_NIL;
+    cnodeCache.count = 0;
+}
+
+int CQueueInit(CQUEUE* q) {
+    uint32_t dummy = cnodeAlloc();
+    if(dummy == CLIST_NIL)
+        return -1;
+
+    CNODE* node = cnodeAt(dummy);
+    uint64_t next = atomic_load_explicit(&node->next, memory_order_relaxed);
+    atomic_store_explicit(&node->next, CREF(CLIST_NIL, CTAG(next) + 1), memory_order_relaxed);
+    atomic_store_explicit(&q->head, CREF(dummy, 0), memory_order_relaxed);
+    atomic_store_explicit(&q->tail, CREF(dummy, 0), memory_order_relaxed);
+    atomic_store_explicit(&q->count, 0, memory_order_release);
+    return 0;
+}
+
+void CQueueFree(CQUEUE* q) {
+    while(CQueueDequeue(q) != NULL)
+        ;
+    cnodeRelease(CINDEX(atomic_load(&q->head)));
+}
+
+int CQueueEnqueue(CQUEUE* q, void* item) {
+    if(item == NULL)
+        return -1;
+    uint32_t index = cnodeAlloc();
+    if(index == CLIST_NIL)
+        return -1;
+
+    // The link keeps counting up across reuse of the node
+    CNODE* node = cnodeAt(index);
+    atomic_store_explicit(&node->data, item, memory_order_relaxed);
+    uint64_t link = atomic_load_explicit(&node->next, memory_order_relaxed);
+    atomic_store_explicit(&node->next, CREF(CLIST_NIL, CTAG(link) + 1), memory_order_relaxed);
+
+    uint64_t tail;
+    for(;;) {
+        tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+        CNODE* last = cnodeAt(CINDEX(tail));
+        uint64_t next = atomic_load_explicit(&last->next, memory_order_acquire);
+        if(tail != atomic_load_explicit(&q->tail, memory_order_acquire))
+            continue;
+
+        if(CINDEX(next) == CLIST_NIL) {
+            if(atomic_compare_exchange_weak_explicit(&last->next, &next, CREF(index, CTAG(next) + 1),
+                                                     memory_order_release, memory_order_relaxed))
+                break;
+        } else {
+            // Tail fell behind; help the other enqueuer along
+            atomic_compare_exchange_weak_explicit(&q->tail, &tail, CREF(CINDEX(next), CTAG(tail) + 1),
+                                                  memory_order_release, memory_order_relaxed);
+        }
+    }
+
+    atomic_compare_exchange_strong_explicit(&q->tail, &tail, CREF(index, CTAG(tail) + 1),
+                                            memory_order_release, memory_order_relaxed);
+    atomic_fetch_add_explicit(&q->count, 1, memory_order_relaxed);
+    return 0;
+}
+
+void* CQueueDequeue(CQUEUE* q) {
+    uint64_t head;
+    void* item;
+    for(;;) {
+        head = atomic_load_explicit(&q->head, memory_order_acquire);
+        uint64_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+        uint64_t next = atomic_load_explicit(&cnodeAt(CINDEX(head))->next, memory_order_acquire);
+        if(head != atomic_load_explicit(&q->head, memory_order_acquire))
+            continue;
+
+        if(CINDEX(head) == CINDEX(tail)) {
+            if(CINDEX(next) == CLIST_NIL)
+                return NULL;
+            atomic_compare_exchange_weak_explicit(&q->tail, &tail, CREF(CINDEX(next), CTAG(tail) + 1),
+                                                  memory_order_release, memory_order_relaxed);
+            continue;
+        }
+
+        // Read before the swap: once head moves, next may be dequeued and reused
+        item = atomic_load_explicit(&cnodeAt(CINDEX(next))->data, memory_order_relaxed);
+        if(atomic_compare_exchange_weak_explicit(&q->head, &head, CREF(CINDEX(next), CTAG(head) + 1),
+                                                 memory_order_acq_rel, memory_order_relaxed))
+            break;
+    }
+
+    // The old dummy is ours now; next took its place
+    cnodeRelease(CINDEX(head));
+    atomic_fetch_sub_explicit(&q->count, 1, memory_order_relaxed);
+    return item;
+}
+
+int CQueueCount(CQUEUE* q) {
+    int count = atomic_load_explicit(&q->count, memory_order_relaxed);
+    return count < 0 ? 0 : count;
+}
+
+#endif
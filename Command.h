@@ -0,0 +1,420 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include<limits.h>
+#include "PCB.h"
+
+// One simulator command, e.g. "C 2", "K 17" or "S 4 hello"
+typedef struct {
+    char op;        // Command letter, upper case
+    int arg;        // Priority, pid, semaphore id, initial value or ticks
+    char* msg;      // Message for S and Y, burst profile for J, NUL terminated
+    int msgLen;     // Length of msg
+} COMMAND;
+
+
+/*
+ * returns 1 if the command letter takes a numeric argument
+ */
+int commandHasArg(char op);
+
+
+/*
+ * returns 1 if the command letter takes a message after its argument
+ */
+int commandHasMsg(char op);
+
+
+/*
+ * Parses the next command of a script starting at *cursor
+ * One command per line: a letter, then the argument and message if the
+    command takes them. Blank lines and lines starting with '#' are skipped.
+ * The message is terminated in place, so cmd->msg points into the script
+    and nothing is allocated
+ * *cursor is moved past the parsed line
+ * returns 1 if a command was parsed, 0 at the end of the script,
+    -1 for a malformed line (which is skipped), including an argument
+    that does not fit in an int
+ */
+int parseCommand(char** cursor, char* end, COMMAND* cmd);
+
+
+/*
+ * Executes one command against the simulator
+ * returns false once the command asks to break the simulation
+ */
+bool runCommand(COMMAND* cmd);
+
+
+/*
+ * Reads the whole of f into one NUL terminated buffer
+ * returns NULL for failure, the caller frees the buffer
+ */
+char* readScript(FILE* f, size_t* length);
+
+
+/*
+ * Parses and executes every command of a script held in buffer
+ * buffer[length] must be writable (readScript leaves a NUL there)
+ * returns the number of commands executed
+ */
+long runScript(char* buffer, size_t length);
+
+//------------------------------------------------------------------------------------
+
+int commandHasArg(char op) {
+    return op == 'C' || op == 'K' || op == 'X' || op == 'S' || op == 'Y' ||
+           op == 'N' || op == 'P' || op == 'V' || op == 'I' || op == 'L' || op == 'U' ||
+           op == 'J' || op == 'A' || op == 'Z' || op == 'O' || op == 'M';
+}
+
+int commandHasMsg(char op) {
+    return op == 'S' || op == 'Y' || op == 'J';
+}
+
+int parseCommand(char** cursor, char* end, COMMAND* cmd) {
+    char* p = *cursor;
+
+    // Skip blank lines and comments
+    while(p < end) {
+        while(p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+            p++;
+        if(p < end && *p == '#') {
+            while(p < end && *p != '\n')
+                p++;
+            continue;
+        }
+        break;
+    }
+    if(p >= end) {
+        *cursor = end;
+        return 0;
+    }
+
+    char* eol = memchr(p, '\n', end - p);
+    if(eol == NULL)
+        eol = end;
+    *cursor = eol < end ? eol + 1 : end;
+
+    cmd->op = toupper((unsigned char) *p++);
+    cmd->arg = 0;
+    cmd->msg = NULL;
+    cmd->msgLen = 0;
+
+    if(commandHasArg(cmd->op)) {
+        while(p < eol && (*p == ' ' || *p == '\t'))
+            p++;
+
+        int sign = 1;
+        if(p < eol && *p == '-') {
+            sign = -1;
+            p++;
+        }
+        if(p >= eol || !isdigit((unsigned char) *p))
+            return -1;
+
+        int value = 0;
+        while(p < eol && isdigit((unsigned char) *p)) {
+            int digit = *p++ - '0';
+            if(value > (INT_MAX - digit) / 10)
+                return -1;
+            value = value * 10 + digit;
+        }
+        cmd->arg = sign * value;
+    }
+
+    if(commandHasMsg(cmd->op)) {
+        if(p < eol && (*p == ' ' || *p == '\t'))
+            p++;
+        char* msgEnd = eol;
+        if(msgEnd > p && msgEnd[-1] == '\r')
+            msgEnd--;
+        *msgEnd = '\0';     // eol is the '\n' or the buffer's NUL
+        cmd->msg = p;
+        cmd->msgLen = msgEnd - p;
+    }
+
+    return 1;
+}
+
+bool runCommand(COMMAND* cmd) {
+    switch (cmd->op) {
+        case 'C':
+            // CREATE
+            if(cmd->arg < 0 || cmd->arg >= numPriorities) {
+                PCB_print("Invalid entry! Please enter a valid priority next time.\n\n");
+                break;
+            }
+
+            {
+                int pid = create(cmd->arg);
+                if(pid > 0)
+                    PCB_print("New process with pid: %d created\n\n", pid);
+            }
+            break;
+
+        case 'F':
+            // FORK
+
+            // Exception: When no processes in allJobs
+            if(IListCount(&allJobs) == 0) {
+                PCB_print("No jobs present to fork.\n\n");
+                break;
+            }
+
+            PCB_fork();
+            break;
+
+        case 'K':
+            // Kill
+            if(IListCount(&allJobs) == 0) {
+                PCB_print("No jobs present to kill.\n\n");
+                break;
+            }
+
+            PCB_kill(cmd->arg);
+            break;
+
+        case 'X':
+            // KILL A PROCESS AND ALL ITS DESCENDANTS
+            if(IListCount(&allJobs) == 0) {
+                PCB_print("No jobs present to kill.\n\n");
+                break;
+            }
+
+            PCB_killTree(cmd->arg);
+            PCB_print("\n");
+            break;
+
+        case 'W':
+            // WAIT FOR A CHILD
+            PCB_wait();
+            PCB_print("\n");
+            break;
+
+        case 'E':
+            // EXIT
+            if (runningPCB() == NULL) {
+                PCB_print("No running jobs to kill.\n\n");
+                break;
+            }
+
+            PCB_exit();
+            break;
+
+        case 'Q':
+            // QUANTUM
+            if (IListCount(&allJobs) == 0) {
+                PCB_print("No processes present for quantum to work.\n\n");
+                break;
+            }
+
+            PCB_quantum();
+            break;
+
+        case 'S':
+            // SEND
+            if (IListCount(&allJobs) <= 1) {
+                PCB_print("Not enough processes present to send to.\n\n");
+                break;
+            }
+
+            // The text is copied once into a pooled message, which
+            // is then passed along by pointer
+            PCBsend(cmd->arg, MsgCreate(cmd->msg, cmd->msgLen));
+            PCB_print("\n\n");
+            break;
+
+        case 'R':
+            // RECEIVE
+            if(IListCount(&allJobs) <= 1) {
+                PCB_print("Not enough processes present to receive a reply.\n\n");
+                break;
+            }
+
+            PCB_receive();
+            break;
+
+        case 'Y':
+            // REPLY
+            if (IListCount(&allJobs) <= 0) {
+                PCB_print("A reply cannot be made.\n\n");
+                break;
+            }
+
+            PCB_reply(cmd->arg, MsgCreate(cmd->msg, cmd->msgLen));
+            PCB_print("\n\n");
+            break;
+
+        case 'N':
+            // NEW SEMAPHORE
+            PCB_newSemaphore(nextSemaphoreID(), cmd->arg);
+            PCB_print("\n\n");
+            break;
+
+        case 'P':
+            // SEMAPHORE P
+            if(semaphoreCount == 0) {
+                PCB_print("No semaphores present.\n\n");
+                break;
+            }
+
+            PCB_semaphoreP(cmd->arg);
+            PCB_print("\n\n");
+            break;
+
+        case 'V':
+            // SEMAPHORE V
+            if(semaphoreCount == 0) {
+                PCB_print("No semaphores present.\n\n");
+                break;
+            }
+
+            PCB_semaphoreV(cmd->arg);
+            PCB_print("\n\n");
+            break;
+
+        case 'I':
+            // PROCINFO
+            if(IListCount(&allJobs) == 0) {
+                PCB_print("No processes to display.\n\n");
+                break;
+            }
+
+            PCB_procInfo(cmd->arg);
+            PCB_print("\n\n");
+            break;
+
+        case 'L':
+            // LIST BY STATE
+            PCB_listState(cmd->arg);
+            PCB_print("\n");
+            break;
+
+        case 'U':
+            // USE CPU
+            PCB_useCPU(cmd->arg);
+            PCB_print("\n");
+            break;
+
+        case 'J':
+            // CREATE JOB WITH A BURST PROFILE, e.g. "J 1 5 20 100"
+            {
+                int cpuBurst;
+                int ioBurst;
+                long work;
+                if(cmd->arg < 0 || cmd->arg >= numPriorities ||
+                   sscanf(cmd->msg, "%d %d %ld", &cpuBurst, &ioBurst, &work) != 3) {
+                    PCB_print("Invalid entry! Give a priority, CPU burst, IO burst and work.\n\n");
+                    break;
+                }
+
+                int pid = PCB_createJob(cmd->arg, cpuBurst, ioBurst, work);
+                if(pid > 0)
+                    PCB_print("New job with pid: %d created\n\n", pid);
+            }
+            break;
+
+        case 'A':
+            // ADVANCE THE CLOCK
+            if(cmd->arg < 0) {
+                PCB_print("Time cannot run backwards.\n\n");
+                break;
+            }
+
+            PCB_advance(cmd->arg);
+            PCB_print("\n");
+            break;
+
+        case 'Z':
+            // SLEEP
+            PCB_sleep(cmd->arg);
+            PCB_print("\n");
+            break;
+
+        case 'O':
+            // TIMEOUT FOR BLOCKING OPERATIONS
+            PCB_setTimeout(cmd->arg);
+            PCB_print("\n");
+            break;
+
+        case 'M':
+            // METRICS, 0 = JSON, 1 = CSV
+            PCB_writeMetrics(stdout, cmd->arg == 1);
+            break;
+
+        case 'T':
+            // TOTALINFO
+            if(IListCount(&allJobs) == 0) {
+                PCB_print("No processes to display.\n\n");
+                break;
+            }
+
+            PCB_totalInfo();
+            break;
+
+        case 'B':
+            PCB_print("Breaking simulation...\n");
+            return false;
+
+        default:
+            PCB_print("Invalid Command. Please try again\n");
+            break;
+    }
+
+    if(PCB_checkMode && PCB_checkInvariants() > 0) {
+        fprintf(stderr, "invariant check failed after command %c\n", cmd->op);
+    }
+
+    return true;
+}
+
+char* readScript(FILE* f, size_t* length) {
+    size_t capacity = 1 << 16;
+    size_t used = 0;
+    char* buffer = malloc(capacity + 1);
+    if(buffer == NULL)
+        return NULL;
+
+    size_t got;
+    while((got = fread(buffer + used, 1, capacity - used, f)) > 0) {
+        used += got;
+        if(used == capacity) {
+            capacity *= 2;
+            char* grown = realloc(buffer, capacity + 1);
+            if(grown == NULL) {
+                free(buffer);
+                return NULL;
+            }
+            buffer = grown;
+        }
+    }
+
+    buffer[used] = '\0';
+    *length = used;
+    return buffer;
+}
+
+long runScript(char* buffer, size_t length) {
+    char* cursor = buffer;
+    char* end = buffer + length;
+    long executed = 0;
+    long line = 0;
+    COMMAND cmd;
+    int result;
+
+    while((result = parseCommand(&cursor, end, &cmd)) != 0) {
+        line++;
+        if(result < 0) {
+            fprintf(stderr, "Skipping malformed command %ld\n", line);
+            continue;
+        }
+        executed++;
+        if(!runCommand(&cmd))
+            break;
+    }
+
+    return executed;
+}
+
+#endif
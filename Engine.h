@@ -0,0 +1,224 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include<pthread.h>
+#include<sched.h>
+#include "Command.h"
+#include "MPSC.h"
+
+// Simulator engine thread. The simulator itself stays single threaded:
+// one engine thread owns every PCB.h structure and runs the commands
+// that any number of client threads submit through a lock-free MPSC
+// queue. Build with -pthread.
+//
+// Each client owns a window of request slots and numbers its requests
+// 1, 2, 3, ... Submitting does not wait for the command to run. The
+// engine runs commands in batches and then completes each client's
+// share of the batch with a single release store of the last sequence
+// number it ran, so a client learns about many results at once.
+
+// Requests the engine runs before publishing their completions
+#ifndef ENGINE_BATCH
+#define ENGINE_BATCH 64
+#endif
+
+// Empty polls before the engine thread starts yielding the CPU
+#define ENGINE_SPIN 256
+
+struct engineclient;
+
+typedef struct {
+    MPSC_NODE node;         // Link on the engine queue
+    COMMAND cmd;            // cmd.msg must stay valid until completion
+    int result;             // 1 once run, 0 for the break command
+    long seq;               // Client's number for this request
+    struct engineclient* client;
+} ENGINE_REQUEST;
+
+typedef struct engineclient {
+    _Atomic long completed; // Highest sequence number the engine has run
+    long submitted;         // Highest sequence number submitted
+    ENGINE_REQUEST* slots;  // Request seq lives in slots[seq % window]
+    int window;
+} ENGINE_CLIENT;
+
+typedef struct {
+    MPSC queue;
+    pthread_t thread;
+    atomic_int stop;        // Set by EngineStop; the queue is drained first
+    long executed;          // Commands run, engine thread only
+    long batches;           // Batches completed, engine thread only
+} ENGINE;
+
+
+/*
+ * Starts the engine thread on the already initialized simulator
+ * returns 0 for success, -1 for failure
+ */
+int EngineStart(ENGINE* engine);
+
+
+/*
+ * Runs every request already submitted, then stops the engine thread
+ */
+void EngineStop(ENGINE* engine);
+
+
+/*
+ * Sets up a client with room for window requests in flight
+ * returns 0 for success, -1 for failure
+ */
+int EngineClientInit(ENGINE_CLIENT* client, int window);
+
+
+/*
+ * Releases the client's request slots
+ * Every request it submitted must have completed
+ */
+void EngineClientFree(ENGINE_CLIENT* client);
+
+
+/*
+ * Queues a copy of cmd for the engine, waiting first if the client's
+    window is full
+ * returns the request's sequence number
+ */
+long EngineSubmit(ENGINE* engine, ENGINE_CLIENT* client, COMMAND* cmd);
+
+
+/*
+ * Waits until request seq of the client has run
+ * returns its result, 1 or 0 for the break command
+ */
+int EngineWait(ENGINE_CLIENT* client, long seq);
+
+
+/*
+ * Parses a script and runs it through the engine as one client,
+    stopping after a break command
+ * returns the number of commands executed
+ */
+long EngineRunScript(ENGINE* engine, char* buffer, size_t length);
+
+//------------------------------------------------------------------------------------
+
+/*
+ * Engine thread: runs queued requests in batches until stopped
+ */
+void* engineMain(void* arg) {
+    ENGINE* engine = arg;
+    ENGINE_REQUEST* batch[ENGINE_BATCH];
+    int idle = 0;
+
+    for(;;) {
+        int count = 0;
+        MPSC_NODE* node;
+        while(count < ENGINE_BATCH && (node = MPSCPop(&engine->queue)) != NULL) {
+            ENGINE_REQUEST* req = MPSC_ITEM(node, ENGINE_REQUEST, node);
+            req->result = runCommand(&req->cmd) ? 1 : 0;
+            batch[count++] = req;
+        }
+
+        if(count == 0) {
+            if(atomic_load_explicit(&engine->stop, memory_order_acquire) &&
+               atomic_load_explicit(&engine->queue.head, memory_order_acquire) == engine->queue.tail) {
+                TraceFlushThread();     // Its events go out before the trace is closed
+                return NULL;
+            }
+            if(++idle > ENGINE_SPIN)
+                sched_yield();
+            continue;
+        }
+        idle = 0;
+
+        // Complete each run of requests from one client with one store
+        for(int i=0; i<count; i++) {
+            if(i+1 == count || batch[i+1]->client != batch[i]->client)
+                atomic_store_explicit(&batch[i]->client->completed, batch[i]->seq, memory_order_release);
+        }
+        engine->executed += count;
+        engine->batches++;
+    }
+}
+
+int EngineStart(ENGINE* engine) {
+    MPSCInit(&engine->queue);
+    atomic_store(&engine->stop, 0);
+    engine->executed = 0;
+    engine->batches = 0;
+    return pthread_create(&engine->thread, NULL, engineMain, engine) == 0 ? 0 : -1;
+}
+
+void EngineStop(ENGINE* engine) {
+    atomic_store_explicit(&engine->stop, 1, memory_order_release);
+    pthread_join(engine->thread, NULL);
+}
+
+int EngineClientInit(ENGINE_CLIENT* client, int window) {
+    client->slots = malloc(window * sizeof(ENGINE_REQUEST));
+    if(client->slots == NULL)
+        return -1;
+    client->window = window;
+    client->submitted = 0;
+    atomic_store(&client->completed, 0);
+    return 0;
+}
+
+void EngineClientFree(ENGINE_CLIENT* client) {
+    free(client->slots);
+    client->slots = NULL;
+}
+
+long EngineSubmit(ENGINE* engine, ENGINE_CLIENT* client, COMMAND* cmd) {
+    long seq = client->submitted + 1;
+
+    // The slot is free once the request window places back has run
+    if(seq > client->window)
+        EngineWait(client, seq - client->window);
+
+    ENGINE_REQUEST* req = &client->slots[seq % client->window];
+    req->cmd = *cmd;
+    req->seq = seq;
+    req->client = client;
+    client->submitted = seq;
+    MPSCPush(&engine->queue, &req->node);
+    return seq;
+}
+
+int EngineWait(ENGINE_CLIENT* client, long seq) {
+    int spins = 0;
+    while(atomic_load_explicit(&client->completed, memory_order_acquire) < seq) {
+        if(++spins > ENGINE_SPIN)
+            sched_yield();
+    }
+    return client->slots[seq % client->window].result;
+}
+
+long EngineRunScript(ENGINE* engine, char* buffer, size_t length) {
+    ENGINE_CLIENT client;
+    if(EngineClientInit(&client, ENGINE_BATCH * 4) != 0)
+        return 0;
+
+    char* cursor = buffer;
+    char* end = buffer + length;
+    long line = 0;
+    COMMAND cmd;
+    int result;
+
+    while((result = parseCommand(&cursor, end, &cmd)) != 0) {
+        line++;
+        if(result < 0) {
+            fprintf(stderr, "Skipping malformed command %ld\n", line);
+            continue;
+        }
+        EngineSubmit(engine, &client, &cmd);
+        if(cmd.op == 'B')
+            break;
+    }
+
+    EngineWait(&client, client.submitted);
+    EngineClientFree(&client);
+    return client.submitted;
+}
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef ILIST_H
+#define ILIST_H
+
+#include<stddef.h>
+
+// Intrusive doubly linked list. An ILINK is embedded in the item being
+// listed and ILIST_ITEM gets the item back from its link, so adding and
+// removing items never allocates. An item can be on as many lists at
+// once as it has links.
+typedef struct ilink {
+    struct ilink* next;
+    struct ilink* prev;
+} ILINK;
+
+typedef struct {
+    ILINK* first;
+    ILINK* last;
+    int count;
+} ILIST;
+
+// Returns the item of type containing member as its ILINK
+#define ILIST_ITEM(link, type, member) ((type*)((char*)(link) - offsetof(type, member)))
+
+
+/*
+ * Make the list empty
+ */
+void IListInit(ILIST* list);
+
+
+/*
+ * return the number of items in list
+ */
+int IListCount(ILIST* list);
+
+
+/*
+ * return the first link in list, NULL if the list is empty
+ */
+ILINK* IListFirst(ILIST* list);
+
+
+/*
+ * adds link to the end of list
+ * link must not be on a list already
+ */
+void IListAppend(ILIST* list, ILINK* link);
+
+
+/*
+ * adds link to the front of list
+ * link must not be on a list already
+ */
+void IListPrepend(ILIST* list, ILINK* link);
+
+
+/*
+ * takes link out of list, which must hold it
+ * runs in O(1) time
+ */
+void IListRemove(ILIST* list, ILINK* link);
+
+
+/*
+ * takes the first link out of list and returns it
+ * returns NULL if the list is empty
+ */
+ILINK* IListPop(ILIST* list);
+
+//------------------------------------------------------------------------------------
+
+void IListInit(ILIST* list) {
+    list->first = NULL;
+    list->last = NULL;
+    list->count = 0;
+}
+
+int IListCount(ILIST* list) {
+    return list->count;
+}
+
+ILINK* IListFirst(ILIST* list) {
+    return list->first;
+}
+
+void IListAppend(ILIST* list, ILINK* link) {
+    link->next = NULL;
+    link->prev = list->last;
+    if(list->last == NULL)
+        list->first = link;
+    else
+        list->last->next = link;
+    list->last = link;
+    list->count++;
+}
+
+void IListPrepend(ILIST* list, ILINK* link) {
+    link->prev = NULL;
+    link->next = list->first;
+    if(list->first == NULL)
+        list->last = link;
+    else
+        list->first->prev = link;
+    list->first = link;
+    list->count++;
+}
+
+void IListRemove(ILIST* list, ILINK* link) {
+    if(link->prev == NULL)
+        list->first = link->next;
+    else
+        link->prev->next = link->next;
+
+    if(link->next == NULL)
+        list->last = link->prev;
+    else
+        link->next->prev = link->prev;
+
+    link->next = link->prev = NULL;
+    list->count--;
+}
+
+ILINK* IListPop(ILIST* list) {
+    ILINK* link = list->first;
+    if(link != NULL)
+        IListRemove(list, link);
+    return link;
+}
+
+#endif
@@ -1,3 +1,6 @@
+#ifndef LIST_H
+#define LIST_H
+
 #include<stdlib.h>
 #include<stdio.h>
 #include<string.h>
@@ -10,16 +13,16 @@ typedef struct node{
     struct node* next;  // link to next
     struct node* prev;  // link to prev
     short isFree;
-    int count;
 } Node;
 
 // LIST type definition
-typedef struct {
+typedef struct list {
     int count;      // Current number of elements
     Node* curr;     // Current element (head)
     Node* first;    // First element on the list
     Node* last;     // Last elemenet on the list
     short isFree;
+    struct list* nextFree;  // link on the free list of heads
 } LIST;
 
 
@@ -155,11 +158,40 @@ void *ListSearch(LIST* list, int (*comparator)(void*, void*), void* comparisonAr
 
 //------------------------------------------------------------------------------------
 
-#define MAX_HEADS 10
-#define MAX_NODES 200
-
-LIST heads[MAX_HEADS];  // LIST static array
-Node nodes[MAX_NODES];  // Node static array
+// Pool sizing. Heads and nodes are carved out of slabs that are never
+// moved or freed until deinit(), so LIST* and Node* pointers stay valid.
+// Defaults can be overridden at compile time with -D or at run time
+// with initPools().
+#ifndef HEAD_SLAB_SIZE
+#define HEAD_SLAB_SIZE 64
+#endif
+#ifndef NODE_SLAB_SIZE
+#define NODE_SLAB_SIZE 4096
+#endif
+#ifndef INITIAL_HEADS
+#define INITIAL_HEADS 16
+#endif
+#ifndef INITIAL_NODES
+#define INITIAL_NODES 256
+#endif
+#ifndef MAX_HEADS
+#define MAX_HEADS (1 << 16)
+#endif
+#ifndef MAX_NODES
+#define MAX_NODES (1 << 24)
+#endif
+
+LIST* freeHeads;        // Unused heads, chained through nextFree
+Node* freeNodes;        // Unused nodes, chained through their next links
+int usedNodes;          // Number of nodes currently on a list
+int totalHeads;         // Heads carved out of slabs so far
+int totalNodes;         // Nodes carved out of slabs so far
+int headLimit = MAX_HEADS;  // Hard ceiling on totalHeads
+int nodeLimit = MAX_NODES;  // Hard ceiling on totalNodes
+
+void** slabs;           // Every slab allocated, released by deinit()
+int slabCount;
+int slabCapacity;
 
 /*
  * Helper function to print
@@ -198,43 +230,171 @@ int printList(LIST *list) {
 }
 
 /*
- *Helper functin to find empty spaces on nodes array
- *Finds empty nodes in O(n) time
+ * Helper function to remember a slab so deinit() can free it
+ * Returns 0 for success, -1 for failure
+ */
+int trackSlab(void* slab) {
+    if(slabCount == slabCapacity) {
+        int capacity = slabCapacity == 0 ? 16 : slabCapacity * 2;
+        void** grown = realloc(slabs, capacity * sizeof(void*));
+        if(grown == NULL)
+            return -1;
+        slabs = grown;
+        slabCapacity = capacity;
+    }
+    slabs[slabCount++] = slab;
+    return 0;
+}
+
+/*
+ * Helper function to add a slab of n nodes to the free list
+ * Never grows past nodeLimit
+ * Returns 0 for success, -1 for failure
  */
-int findEmptyIndex(Node *collection) {
-    if(nodes->count == MAX_NODES)
+int growNodes(int n) {
+    if(n > nodeLimit - totalNodes)
+        n = nodeLimit - totalNodes;
+    if(n <= 0)
         return -1;
-    for(int i=0; i<MAX_NODES; i++)
-    {
-        if(collection[i].isFree == 1)
-        {
-            return i;
-        }
+
+    Node* slab = malloc(n * sizeof(Node));
+    if(slab == NULL)
+        return -1;
+    if(trackSlab(slab) != 0) {
+        free(slab);
+        return -1;
+    }
+
+    for(int i=n-1; i>=0; i--) {
+        slab[i].data = NULL;
+        slab[i].isFree = 1;
+        slab[i].prev = NULL;
+        slab[i].next = freeNodes;
+        freeNodes = &slab[i];
     }
-    return -1;
+    totalNodes += n;
+    return 0;
 }
 
 /*
- Function to initialize all the heads and nodes
+ * Helper function to add a slab of n heads to the free list
+ * Never grows past headLimit
+ * Returns 0 for success, -1 for failure
  */
-void init(void) {
+int growHeads(int n) {
+    if(n > headLimit - totalHeads)
+        n = headLimit - totalHeads;
+    if(n <= 0)
+        return -1;
 
-    for(int i=0; i<MAX_HEADS; i++) {
-        heads[i].count=0;
-        heads[i].curr = NULL;
-        heads[i].first = NULL;
-        heads[i].last = NULL;
-        heads[i].isFree = 1;
+    LIST* slab = malloc(n * sizeof(LIST));
+    if(slab == NULL)
+        return -1;
+    if(trackSlab(slab) != 0) {
+        free(slab);
+        return -1;
     }
 
-    for(int i=0; i<MAX_NODES; i++) {
-        nodes[i].count = 0;
-        nodes[i].data = 0;
-        nodes[i].isFree = 1;
-        nodes[i].next = NULL;
-        nodes[i].prev = NULL;
+    for(int i=n-1; i>=0; i--) {
+        slab[i].count = 0;
+        slab[i].curr = slab[i].first = slab[i].last = NULL;
+        slab[i].isFree = 1;
+        slab[i].nextFree = freeHeads;
+        freeHeads = &slab[i];
     }
+    totalHeads += n;
+    return 0;
+}
+
+/*
+ * Helper function to take a node off the free list
+ * Grows the pool by one slab when the free list is empty
+ * Returns NULL once the node ceiling is reached
+ * Runs in O(1) amortized time
+ */
+Node* allocNode(void) {
+    if(freeNodes == NULL && growNodes(NODE_SLAB_SIZE) != 0)
+        return NULL;
+
+    Node* node = freeNodes;
+    freeNodes = node->next;
+    node->next = NULL;
+    node->prev = NULL;
+    node->isFree = 0;
+    usedNodes++;
+    return node;
+}
 
+/*
+ * Helper function to give a node back to the free list
+ * Runs in O(1) time
+ */
+void releaseNode(Node* node) {
+    node->data = NULL;
+    node->prev = NULL;
+    node->isFree = 1;
+    node->next = freeNodes;
+    freeNodes = node;
+    usedNodes--;
+}
+
+/*
+ * Helper function to give a head back to the free list
+ */
+void releaseHead(LIST* list) {
+    list->count = 0;
+    list->curr = list->first = list->last = NULL;
+    list->isFree = 1;
+    list->nextFree = freeHeads;
+    freeHeads = list;
+}
+
+/*
+ * Function to set up the head and node pools
+ * initialHeads/initialNodes are allocated up front,
+    the pools then grow slab by slab up to maxHeads/maxNodes
+ * Returns 0 for success, -1 for failure
+ */
+int initPools(int initialHeads, int maxHeads, int initialNodes, int maxNodes) {
+    freeHeads = NULL;
+    freeNodes = NULL;
+    usedNodes = 0;
+    totalHeads = 0;
+    totalNodes = 0;
+    headLimit = maxHeads;
+    nodeLimit = maxNodes;
+
+    if(initialHeads > 0 && growHeads(initialHeads) != 0)
+        return -1;
+    if(initialNodes > 0 && growNodes(initialNodes) != 0)
+        return -1;
+    return 0;
+}
+
+/*
+ Function to initialize all the heads and nodes
+ */
+void init(void) {
+    initPools(INITIAL_HEADS, MAX_HEADS, INITIAL_NODES, MAX_NODES);
+    return;
+}
+
+/*
+ * Function to release every slab
+ * All LIST and Node pointers are invalid afterwards
+ */
+void deinit(void) {
+    for(int i=0; i<slabCount; i++)
+        free(slabs[i]);
+    free(slabs);
+    slabs = NULL;
+    slabCount = 0;
+    slabCapacity = 0;
+    freeHeads = NULL;
+    freeNodes = NULL;
+    usedNodes = 0;
+    totalHeads = 0;
+    totalNodes = 0;
     return;
 }
 
@@ -243,17 +403,14 @@ void init(void) {
  * Return NULL if failed
  */
 LIST* ListCreate(void) {
-    LIST* newList = NULL; // initialization
-
-    for(int i=0; i<MAX_HEADS; i++) {
-        if(heads[i].isFree == 1) {
-            newList = &heads[i];
-            heads[i].isFree = 0;    // no more free
-            return newList;         // return the new list if empty space allocated to it
-        }
-    }
-
-    return NULL; // returns NULL if no available space
+    if(freeHeads == NULL && growHeads(HEAD_SLAB_SIZE) != 0)
+        return NULL; // returns NULL if no available space
+
+    LIST* newList = freeHeads;
+    freeHeads = newList->nextFree;
+    newList->nextFree = NULL;
+    newList->isFree = 0;    // no more free
+    return newList;
 }
 
 
@@ -352,37 +509,27 @@ int ListAppend(LIST* list,void* item) {
     if(item == NULL || list == NULL || list->isFree==1)
         return -1;
 
-    int index = nodes->count;
-    list->curr = list->last;
-    if(nodes[index].isFree == 0)
-        index = findEmptyIndex(nodes);
-
-    if(nodes[index].isFree == 1) {
-        nodes[index].data = item;
-        nodes[index].isFree = 0;
-        nodes[index].next = NULL;
-        nodes[index].prev = list->curr;
-
-        //empty list
-        if(list->curr == NULL) {
-            list->first = &nodes[index];
-            list->last = list->first;
-            list->first->prev = NULL;
-        }
-
-        //current element == last element
-        else if(list->curr == list->last) {
-            list->last = &nodes[index];
-            list->curr->next = &nodes[index];
-        }
+    Node* node = allocNode();
+    if(node == NULL)
+        return -1;
 
-        list->curr = &nodes[index];
-        list->count++;
-        nodes->count++;
+    node->data = item;
+    node->next = NULL;
+    node->prev = list->last;
 
-        return 0;
+    //empty list
+    if(list->last == NULL) {
+        list->first = node;
+    }
+    else {
+        list->last->next = node;
     }
-    return -1;
+
+    list->last = node;
+    list->curr = node;
+    list->count++;
+
+    return 0;
 }
 
 
@@ -395,37 +542,27 @@ int ListPrepend(LIST* list,void* item) {
     if(item == NULL || list == NULL || list->isFree==1)
         return -1;
 
-    int index = nodes->count;
-    list->curr = list->first;
-
-    if(nodes[index].isFree == 0)
-        index = findEmptyIndex(nodes);
-
-    if(nodes[index].isFree == 1) {
-        nodes[index].data = item;
-        nodes[index].isFree = 0;
-        nodes[index].next = list->curr;
-        nodes[index].prev = NULL;
-
-        if(list->curr == NULL) {
-            //empty list
-            list->first = &nodes[index];
-            list->last = list->first;
-        }
-        else if(list->curr == list->first) {
-            //current element == first element
-            list->curr->prev = &nodes[index];
-            list->first = &nodes[index];
-        }
+    Node* node = allocNode();
+    if(node == NULL)
+        return -1;
 
-        list->curr = &nodes[index];
-        list->count++;
-        nodes->count++;
+    node->data = item;
+    node->next = list->first;
+    node->prev = NULL;
 
-        return 0;
+    //empty list
+    if(list->first == NULL) {
+        list->last = node;
     }
+    else {
+        list->first->prev = node;
+    }
+
+    list->first = node;
+    list->curr = node;
+    list->count++;
 
-    return -1;
+    return 0;
 }
 
 
@@ -441,31 +578,23 @@ int ListAdd(LIST* list,void* item) {
     if(item == NULL || list == NULL || list->isFree==1)
         return -1;
 
-    int index = nodes->count;
-    if(nodes[index].isFree == 0)
-        index = findEmptyIndex(nodes);
-
-    if(nodes[index].isFree == 1) {
-        // current element is last or list is empty
-        if(list->curr == list->last || list->curr == NULL) {
-            int result = ListAppend(list, item);
-            return result;
-        }
-        else
-        {
-            nodes[index].data = item;
-            nodes[index].isFree = 0;
-            nodes[index].next = list->curr->next;
-            nodes[index].prev = list->curr;
-            list->curr->next = &nodes[index];
-            list->curr = &nodes[index];
-            (list->curr->next)->prev = &nodes[index];
-            list->count++;
-            nodes->count++;
-            return 0;
-        }
+    // current element is last or list is empty
+    if(list->curr == list->last || list->curr == NULL) {
+        return ListAppend(list, item);
     }
-    return -1;
+
+    Node* node = allocNode();
+    if(node == NULL)
+        return -1;
+
+    node->data = item;
+    node->next = list->curr->next;
+    node->prev = list->curr;
+    (list->curr->next)->prev = node;
+    list->curr->next = node;
+    list->curr = node;
+    list->count++;
+    return 0;
 }
 
 
@@ -480,36 +609,29 @@ int ListInsert(LIST* list,void* item) {
     if(item == NULL || list == NULL || list->isFree==1)
         return -1;
 
-    int index = nodes->count;
-    if(nodes[index].isFree == 0)
-        index = findEmptyIndex(nodes);
-
-    if(nodes[index].isFree == 1) {
-
-        //empty list or current element == first element
-        if(list->curr == NULL || list->curr == list->first) {
-            return ListPrepend(list, item);
-        }
-        else {
-            nodes[index].data = item;
-            nodes[index].isFree = 0;
-            nodes[index].next = list->curr;
-            nodes[index].prev = list->curr->prev;
-            (list->curr->prev)->next = &nodes[index];
-            list->curr->prev = &nodes[index];
-            list->curr = &nodes[index];
-            list->count++;
-            nodes->count++;
-            return 0;
-        }
+    //empty list or current element == first element
+    if(list->curr == NULL || list->curr == list->first) {
+        return ListPrepend(list, item);
     }
 
-    return -1;
+    Node* node = allocNode();
+    if(node == NULL)
+        return -1;
+
+    node->data = item;
+    node->next = list->curr;
+    node->prev = list->curr->prev;
+    (list->curr->prev)->next = node;
+    list->curr->prev = node;
+    list->curr = node;
+    list->count++;
+    return 0;
 }
 
 /*
  * returns the curr item and take it out of the list
  * next item becomes the curr item
+ * the node goes back to the free list
  */
 void *ListRemove(LIST* list) {
     if(list==NULL || list->isFree==1) {
@@ -521,42 +643,26 @@ void *ListRemove(LIST* list) {
     if(list->curr == NULL)
         return NULL;
 
-    void* returnVal = list->curr->data;
-    list->count--;
-    nodes->count--;
-
-    // list has single element
-    if(list->first == list->last) {
-        list->first->next = NULL;
-        list->last->prev = NULL;
-        list->curr = list->first = list->last = NULL;
-
-        return returnVal;
-    }
+    Node* temp = list->curr;
+    void* returnVal = temp->data;
 
-    // current is first
-    if(list->curr == list->first) {
-        list->curr = list->curr->next;
-        list->first = list->curr->next;
-        list->first->prev = NULL;
+    if(temp->prev != NULL)
+        (temp->prev)->next = temp->next;
+    else
+        list->first = temp->next;
 
-        return returnVal;
+    if(temp->next != NULL) {
+        (temp->next)->prev = temp->prev;
+        list->curr = temp->next;
     }
-
-    //current is last
-    if(list->curr == list->last) {
-        list->curr = list->last->prev;
-        list->last = list->curr;
-        list->curr->next = NULL;
-
-        return returnVal;
+    else {
+        // current was last, so the new last becomes current
+        list->last = temp->prev;
+        list->curr = temp->prev;
     }
 
-    //else
-    Node* temp = list->curr;
-    (temp->prev)->next = list->curr->next;
-    (temp->next)->prev = list->curr->prev;
-    list->curr = temp->next;
+    list->count--;
+    releaseNode(temp);
 
     return returnVal;
 }
@@ -584,7 +690,7 @@ void ListConcat(LIST* list1,LIST* list2) {
     }
         // list 2 empty
     else if(list2->curr == NULL) {
-        list2->isFree = 1;
+        releaseHead(list2);
         return;
     }
     else {
@@ -598,9 +704,7 @@ void ListConcat(LIST* list1,LIST* list2) {
     list1->curr = list1->first;
 
     // remove list2
-    list2->isFree = 1;
-    list2->count = 0;
-    list2->curr = list2->first = list2->last = NULL;
+    releaseHead(list2);
 
     return;
 }
@@ -615,29 +719,11 @@ void *ListTrim(LIST* list) {
         return NULL;
 
     // Empty list
-    if(list->first == NULL)
+    if(list->last == NULL)
         return NULL;
 
-    list->count--;
-    nodes->count--;
-
-    // Single Item list
-    if(list->first == list->last) {
-        return ListRemove(list);
-    }
-
-    // else
-    void* returnVal = list->last->data;
-
-    Node* temp = list->last;
-    temp = temp->prev;
-    list->curr = temp;
-    list->curr->next = NULL;
-    list->last->isFree = 1;
-    list->last->prev = NULL;
-    list->last = list->curr;
-
-    return returnVal;
+    list->curr = list->last;
+    return ListRemove(list);
 }
 
 
@@ -645,26 +731,26 @@ void *ListTrim(LIST* list) {
  * delete list. itemFree is a pointer to a routine that frees
     an item.
  * invoked as (*itemFree)(itemToBeFreed);
+ * every node of the list goes back to the free list
  */
 void ListFree(LIST* list, void (*itemFree)(Node*)) {
-    if(list == NULL || list->isFree==1) {
-        list->isFree = 1;
+    if(list == NULL)
         return;
-    }
 
-    //empty list
-    if(list->curr == NULL) {
-        list->isFree = 1;
+    if(list->isFree==1)
         return;
-    }
 
     Node* top = list->first;
 
     while(top != NULL) {
-        (*itemFree)(top);
-        top = top->next;
+        Node* next = top->next;
+        if(itemFree != NULL)
+            (*itemFree)(top);
+        releaseNode(top);
+        top = next;
     }
-    list->isFree = 1;
+
+    releaseHead(list);
     return;
 }
 
@@ -702,3 +788,5 @@ void *ListSearch(LIST* list, int (*comparator)(void*, void*), void* comparisonAr
     list->curr = list->last;
     return NULL;
 }
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef MPSC_H
+#define MPSC_H
+
+#include<stdatomic.h>
+#include<stddef.h>
+
+// Lock-free multi-producer single-consumer queue. Nodes are embedded in
+// the items queued (MPSC_ITEM gets the item back), so pushing never
+// allocates. Producers push with one atomic exchange; only the consumer
+// touches tail. Items pushed by one producer come out in the order that
+// producer pushed them.
+typedef struct mpscnode {
+    struct mpscnode* _Atomic next;
+} MPSC_NODE;
+
+typedef struct {
+    MPSC_NODE* _Atomic head;    // Last node pushed, shared by producers
+    MPSC_NODE* tail;            // Next node to pop, consumer only
+    MPSC_NODE stub;             // Keeps the queue non-empty between pops
+} MPSC;
+
+// Returns the item of type containing member as its MPSC_NODE
+#define MPSC_ITEM(node, type, member) ((type*)((char*)(node) - offsetof(type, member)))
+
+
+/*
+ * Make the queue empty
+ * Must not race with any push or pop
+ */
+void MPSCInit(MPSC* q);
+
+
+/*
+ * adds node at the back of the queue
+ * safe to call from any number of threads at once
+ */
+void MPSCPush(MPSC* q, MPSC_NODE* node);
+
+
+/*
+ * takes the node at the front of the queue
+ * returns NULL if the queue is empty, or if the next push has not
+    finished linking its node yet
+ * only one thread may pop
+ */
+MPSC_NODE* MPSCPop(MPSC* q);
+
+//------------------------------------------------------------------------------------
+
+void MPSCInit(MPSC* q) {
+    atomic_store_explicit(&q->stub.next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&q->head, &q->stub, memory_order_relaxed);
+    q->tail = &q->stub;
+}
+
+void MPSCPush(MPSC* q, MPSC_NODE* node) {
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    MPSC_NODE* prev = atomic_exchange_explicit(&q->head, node, memory_order_acq_rel);
+    // Between the exchange and this store the consumer sees a gap and
+    // MPSCPop returns NULL until the link lands
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+MPSC_NODE* MPSCPop(MPSC* q) {
+    MPSC_NODE* tail = q->tail;
+    MPSC_NODE* next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    // Step over the stub
+    if(tail == &q->stub) {
+        if(next == NULL)
+            return NULL;
+        q->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+
+    if(next != NULL) {
+        q->tail = next;
+        return tail;
+    }
+
+    // tail is the last node; a push may be half done
+    if(tail != atomic_load_explicit(&q->head, memory_order_acquire))
+        return NULL;
+
+    // Put the stub back behind tail so tail can be handed out
+    MPSCPush(q, &q->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if(next != NULL) {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,279 @@
+#ifndef MESSAGE_H
+#define MESSAGE_H
+
+#include<stdlib.h>
+#include<string.h>
+
+// Message buffers for send/reply. A message is written once when it is
+// created and then handed from process to process by pointer; whoever
+// holds the last reference releases it back to the pool.
+//
+// Buffers are carved out of large arena chunks and recycled through one
+// free list per power-of-two size class, so steady-state IPC never
+// touches malloc.
+typedef struct message {
+    int refs;               // References held, back to the pool at 0
+    int length;             // Bytes of text, not counting the NUL
+    int sizeClass;          // Free list the buffer returns to
+    struct message* nextFree;   // Link on that free list
+    char text[];            // NUL terminated message text
+} MESSAGE;
+
+// Longest message accepted, override at compile time with -D
+#ifndef MSG_MAX_LEN
+#define MSG_MAX_LEN 4096
+#endif
+
+#define MSG_MIN_SIZE 64         // Smallest buffer, header included
+#define MSG_CLASSES 24          // Size classes 64 bytes .. 512 MB
+#ifndef MSG_ARENA_SIZE
+#define MSG_ARENA_SIZE (1 << 16)
+#endif
+
+// Messages a mailbox holds before senders block, a power of two
+#ifndef MAILBOX_SIZE
+#define MAILBOX_SIZE 8
+#endif
+#if MAILBOX_SIZE & (MAILBOX_SIZE - 1)
+#error MAILBOX_SIZE must be a power of two
+#endif
+
+// Bounded mailbox of one process. A ring buffer with a single producer
+// and a single consumer: only MboxPut moves tail and only MboxTake moves
+// head, both free running and masked on access, so every operation is
+// O(1) and the two ends never write the same field.
+typedef struct {
+    MESSAGE* slots[MAILBOX_SIZE];
+    unsigned int head;      // Next message to take
+    unsigned int tail;      // Next free slot
+} MAILBOX;
+
+
+/*
+ * Set up the message pool
+ */
+void MsgInit(void);
+
+
+/*
+ * Release every arena chunk
+ * All MESSAGE pointers are invalid afterwards
+ */
+void MsgDeinit(void);
+
+
+/*
+ * Takes a buffer for a message of length bytes off the pool
+ * The caller writes length bytes of text; the NUL is already in place
+ * returns NULL if length is over MSG_MAX_LEN or memory ran out
+ */
+MESSAGE* MsgAlloc(int length);
+
+
+/*
+ * Makes a message holding a copy of text
+ * returns NULL if length is over MSG_MAX_LEN or memory ran out
+ */
+MESSAGE* MsgCreate(const char* text, int length);
+
+
+/*
+ * Adds a reference to msg and returns it
+ */
+MESSAGE* MsgRetain(MESSAGE* msg);
+
+
+/*
+ * Drops a reference to msg, returning it to the pool at the last one
+ * NULL is ignored
+ */
+void MsgRelease(MESSAGE* msg);
+
+
+/*
+ * Make the mailbox empty
+ */
+void MboxInit(MAILBOX* box);
+
+
+/*
+ * returns the number of messages waiting in the mailbox
+ */
+int MboxCount(MAILBOX* box);
+
+
+/*
+ * returns 1 if the mailbox cannot take another message
+ */
+int MboxFull(MAILBOX* box);
+
+
+/*
+ * Adds msg at the back of the mailbox, which then owns it
+ * returns 0 for success, -1 if the mailbox is full
+ */
+int MboxPut(MAILBOX* box, MESSAGE* msg);
+
+
+/*
+ * Takes the oldest message out of the mailbox, the caller then owns it
+ * returns NULL if the mailbox is empty
+ */
+MESSAGE* MboxTake(MAILBOX* box);
+
+
+/*
+ * Releases every message left in the mailbox
+ */
+void MboxClear(MAILBOX* box);
+
+//------------------------------------------------------------------------------------
+
+MESSAGE* msgFree[MSG_CLASSES];  // Free buffers of each size class
+void** msgChunks;               // Arena chunks, released by MsgDeinit
+int msgChunkCount;
+int msgChunkCapacity;
+size_t msgArenaBytes;           // Bytes of all the chunks
+char* msgArena;                 // Unused space in the current chunk
+size_t msgArenaLeft;
+long messagesInUse;             // Messages handed out and not yet released
+
+void MsgInit(void) {
+    for(int i=0; i<MSG_CLASSES; i++)
+        msgFree[i] = NULL;
+    msgChunks = NULL;
+    msgChunkCount = 0;
+    msgChunkCapacity = 0;
+    msgArenaBytes = 0;
+    msgArena = NULL;
+    msgArenaLeft = 0;
+    messagesInUse = 0;
+}
+
+void MsgDeinit(void) {
+    for(int i=0; i<msgChunkCount; i++)
+        free(msgChunks[i]);
+    free(msgChunks);
+    MsgInit();
+}
+
+/*
+ * Helper to carve size bytes out of the arena, adding a chunk if needed
+ * Returns NULL if memory ran out
+ */
+void* msgCarve(size_t size) {
+    if(size > msgArenaLeft) {
+        size_t chunkSize = size > MSG_ARENA_SIZE ? size : MSG_ARENA_SIZE;
+
+        if(msgChunkCount == msgChunkCapacity) {
+            int capacity = msgChunkCapacity == 0 ? 16 : msgChunkCapacity * 2;
+            void** grown = realloc(msgChunks, capacity * sizeof(void*));
+            if(grown == NULL)
+                return NULL;
+            msgChunks = grown;
+            msgChunkCapacity = capacity;
+        }
+
+        char* chunk = malloc(chunkSize);
+        if(chunk == NULL)
+            return NULL;
+        msgChunks[msgChunkCount++] = chunk;
+        msgArenaBytes += chunkSize;
+        msgArena = chunk;
+        msgArenaLeft = chunkSize;
+    }
+
+    void* block = msgArena;
+    msgArena += size;
+    msgArenaLeft -= size;
+    return block;
+}
+
+MESSAGE* MsgAlloc(int length) {
+    if(length < 0 || length > MSG_MAX_LEN)
+        return NULL;
+
+    // Smallest class that fits the header, the text and the NUL
+    size_t need = sizeof(MESSAGE) + length + 1;
+    int sizeClass = 0;
+    while(((size_t) MSG_MIN_SIZE << sizeClass) < need)
+        sizeClass++;
+
+    MESSAGE* msg = msgFree[sizeClass];
+    if(msg != NULL) {
+        msgFree[sizeClass] = msg->nextFree;
+    } else {
+        msg = msgCarve((size_t) MSG_MIN_SIZE << sizeClass);
+        if(msg == NULL)
+            return NULL;
+        msg->sizeClass = sizeClass;
+    }
+
+    msg->refs = 1;
+    msg->length = length;
+    msg->nextFree = NULL;
+    msg->text[length] = '\0';
+    messagesInUse++;
+    return msg;
+}
+
+MESSAGE* MsgCreate(const char* text, int length) {
+    MESSAGE* msg = MsgAlloc(length);
+    if(msg != NULL)
+        memcpy(msg->text, text, length);
+    return msg;
+}
+
+MESSAGE* MsgRetain(MESSAGE* msg) {
+    msg->refs++;
+    return msg;
+}
+
+void MsgRelease(MESSAGE* msg) {
+    if(msg == NULL)
+        return;
+
+    if(--msg->refs > 0)
+        return;
+
+    msg->nextFree = msgFree[msg->sizeClass];
+    msgFree[msg->sizeClass] = msg;
+    messagesInUse--;
+}
+
+void MboxInit(MAILBOX* box) {
+    box->head = 0;
+    box->tail = 0;
+}
+
+int MboxCount(MAILBOX* box) {
+    return (int)(box->tail - box->head);
+}
+
+int MboxFull(MAILBOX* box) {
+    return box->tail - box->head == MAILBOX_SIZE;
+}
+
+int MboxPut(MAILBOX* box, MESSAGE* msg) {
+    if(MboxFull(box))
+        return -1;
+    box->slots[box->tail & (MAILBOX_SIZE - 1)] = msg;
+    box->tail++;
+    return 0;
+}
+
+MESSAGE* MboxTake(MAILBOX* box) {
+    if(box->head == box->tail)
+        return NULL;
+    MESSAGE* msg = box->slots[box->head & (MAILBOX_SIZE - 1)];
+    box->head++;
+    return msg;
+}
+
+void MboxClear(MAILBOX* box) {
+    MESSAGE* msg;
+    while((msg = MboxTake(box)) != NULL)
+        MsgRelease(msg);
+}
+
+#endif
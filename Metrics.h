@@ -0,0 +1,143 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include<stdio.h>
+#include<stdbool.h>
+#include<string.h>
+
+// Scheduling metrics. Each process carries a PROC_METRICS that is
+// updated on every state change with a handful of adds, and exits are
+// summarised into log2 histograms, so collecting costs no allocation
+// and no output until the metrics are dumped. Times are in ticks of
+// the simulated clock.
+
+// Reasons a process is BLOCKED, for splitting its blocked time
+enum { WAIT_OTHER, WAIT_IPC, WAIT_SEMAPHORE, WAIT_TIMER, NUM_WAITS };
+
+// Bucket 0 counts zeros, bucket b counts values in [2^(b-1), 2^b)
+#define HIST_BUCKETS 65
+
+typedef struct {
+    long count;
+    unsigned long long sum;
+    unsigned long long min;
+    unsigned long long max;
+    long buckets[HIST_BUCKETS];
+} HIST;
+
+typedef struct {
+    unsigned long long created;     // Clock time it was created
+    unsigned long long since;       // Clock time it entered its current state
+    unsigned long long stateTime[4];    // Ticks per state, indexed by state + 1
+    unsigned long long waitTime[NUM_WAITS]; // Blocked ticks by reason
+    long long response;             // Ticks from creation to first dispatch, -1 before
+    long dispatches;                // Times put on a CPU
+    long switches;                  // Times taken off a CPU before exiting
+    int waitReason;                 // Why it is blocked, while it is
+} PROC_METRICS;
+
+
+/*
+ * Make the histogram empty
+ */
+void HistInit(HIST* h);
+
+
+/*
+ * Counts value in the histogram
+ * Runs in O(1) time
+ */
+void HistAdd(HIST* h, unsigned long long value);
+
+
+/*
+ * returns an upper bound on the given fraction (0 to 1) of the values,
+    from the bucket holding it
+ */
+unsigned long long HistPercentile(HIST* h, double fraction);
+
+
+/*
+ * Writes the histogram as a JSON object
+ */
+void HistWriteJSON(HIST* h, FILE* f);
+
+
+/*
+ * Starts the metrics of a process created at time now
+ */
+void MetricsInit(PROC_METRICS* m, unsigned long long now);
+
+
+/*
+ * Charges the time since the last change to oldState, and to the wait
+    reason too if the process was blocked, then starts timing the new
+    state at now
+ * returns the ticks charged
+ */
+unsigned long long MetricsState(PROC_METRICS* m, int oldState, bool wasBlocked, unsigned long long now);
+
+//------------------------------------------------------------------------------------
+
+void HistInit(HIST* h) {
+    memset(h, 0, sizeof(HIST));
+    h->min = ~0ULL;
+}
+
+void HistAdd(HIST* h, unsigned long long value) {
+    int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+    h->buckets[bucket]++;
+    h->count++;
+    h->sum += value;
+    if(value < h->min)
+        h->min = value;
+    if(value > h->max)
+        h->max = value;
+}
+
+unsigned long long HistPercentile(HIST* h, double fraction) {
+    long target = (long)(fraction * h->count);
+    long seen = 0;
+    for(int b=0; b<HIST_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if(seen > target) {
+            unsigned long long bound = b == 0 ? 0 : b == 64 ? ~0ULL : (1ULL << b) - 1;
+            return bound < h->max ? bound : h->max;
+        }
+    }
+    return h->max;
+}
+
+void HistWriteJSON(HIST* h, FILE* f) {
+    fprintf(f, "{\"count\": %ld, \"mean\": %.2f, \"min\": %llu, \"p50\": %llu, \"p90\": %llu, "
+               "\"p99\": %llu, \"max\": %llu, \"buckets\": [",
+            h->count, h->count == 0 ? 0.0 : (double) h->sum / h->count,
+            h->count == 0 ? 0ULL : h->min, HistPercentile(h, 0.50), HistPercentile(h, 0.90),
+            HistPercentile(h, 0.99), h->max);
+
+    // Trailing empty buckets are left out
+    int last = HIST_BUCKETS - 1;
+    while(last >= 0 && h->buckets[last] == 0)
+        last--;
+    for(int b=0; b<=last; b++)
+        fprintf(f, "%s%ld", b == 0 ? "" : ", ", h->buckets[b]);
+    fprintf(f, "]}");
+}
+
+void MetricsInit(PROC_METRICS* m, unsigned long long now) {
+    memset(m, 0, sizeof(PROC_METRICS));
+    m->created = now;
+    m->since = now;
+    m->response = -1;
+}
+
+unsigned long long MetricsState(PROC_METRICS* m, int oldState, bool wasBlocked, unsigned long long now) {
+    unsigned long long elapsed = now - m->since;
+    m->since = now;
+    m->stateTime[oldState + 1] += elapsed;
+    if(wasBlocked)
+        m->waitTime[m->waitReason] += elapsed;
+    return elapsed;
+}
+
+#endif
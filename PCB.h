@@ -1,325 +1,1286 @@
+#ifndef PCB_H
+#define PCB_H
+
 #include<stdbool.h>
 #include "List.h"
+#include "IList.h"
+#include "Sched.h"
+#include "Message.h"
+#include "ProcQuery.h"
+#include "Timer.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Slab.h"
+#include "PidMap.h"
 
 #define RUNNING 2
 #define READY 1
 #define BLOCKED 0
 #define DEADLOCKED -1
+#define ZOMBIE -2
+#define EXITED -3     // Only in metrics dumps, for a reaped process
 
 //PCB structure definition
-typedef struct {
+typedef struct pcb {
     int pid;        // Process ID
-    int priority;   // 0 = low, 1 = Normal, 2 = High
-    int state;      // -1 = deadlocked, 0 = Blocked, 1 = Ready, 2 = Running
-    char *proc_message;   // Allow a message to be sent or received
+    int priority;   // 0 = lowest ... numPriorities-1 = highest
+    int state;      // -2 = zombie, -1 = deadlocked, 0 = Blocked, 1 = Ready, 2 = Running
+    MAILBOX mailbox;        // Messages waiting to be received, owned by this process
+    bool receiving;         // Blocked in PCB_receive until a message arrives
+    MESSAGE* outgoing;      // Message held while blocked on a full mailbox
+    struct pcb* sendTarget; // Process whose mailbox this one waits on, or NULL
+    ILIST senders;          // Processes blocked sending to this one, FIFO
+    int deadlockedSenders;  // Senders that are DEADLOCKED
+    int waitingOn;          // Semaphore this process is blocked on, -1 if none
+    ILIST holds;            // Semaphores it passed P on and has not done V on since
+    unsigned long long deadlockMark;    // Last deadlock search that reached it
+    struct pcb* deadlockParent;         // Process that search reached it from
+    SLAB_HANDLE deadlockEscape;         // Next process on the last path found to one that can run
+    unsigned long long deadlockWalk;    // Last search that followed deadlockEscape from it
+    ILINK jobLink;          // Link on allJobs
+    ILINK priorityLink;     // Link on priorityJobs[priority]
+    ILINK waitLink;         // Link on the senders or semaphore queue it waits on
+    struct pcb* parent;     // Process that forked it, NULL if created directly or orphaned
+    ILIST children;         // Processes it forked: zombies first, then live ones oldest first
+    ILINK siblingLink;      // Link on its parent's children
+    int zombieChildren;     // Children that exited and wait to be reaped
+    bool waitingChild;      // Blocked in PCB_wait until a child exits
+    int cpu;        // CPU this process is running on, -1 if not running
+    int homeCPU;    // CPU whose run queue holds it while READY
+    int slot;       // This process's slot in procTable
+    SCHED_ENTITY sched; // Scheduling state, owned by schedPolicy
+    TIMER timer;            // Burst end, IO, sleep or timeout; one at a time
+    unsigned long long dispatched;  // Clock time it last started running
+    unsigned long long cpuTime;     // Ticks spent running
+    int cpuBurst;           // Ticks of CPU per burst, 0 if it has no profile
+    int ioBurst;            // Ticks of IO after each burst
+    long burstLeft;         // Ticks left in the current CPU burst
+    long workLeft;          // CPU ticks left before it exits
+    PROC_METRICS metrics;   // Time per state, dispatches and switches
 } PCB;
 
+// Number of priority levels, 0 = lowest
+#ifndef NUM_PRIORITIES
+#define NUM_PRIORITIES 3
+#endif
+
+// Most CPUs numCPUs may be set to, at most 64 (one bit each in idleCPUs)
+#ifndef MAX_CPUS
+#define MAX_CPUS 64
+#endif
+
+// Simulated CPU
+typedef struct {
+    PCB* running;   // Process running on this CPU, NULL when idle
+    void* runQueue; // READY jobs homed on this CPU, ordered by schedPolicy
+    long ticks;     // Quanta elapsed
+    long busyTicks; // Quanta that found a process running
+    long migrations;    // Processes this CPU stole from other run queues
+    TIMER quantumTimer; // Armed while a process runs here
+    unsigned long long busyTime;    // Clock ticks spent running processes
+    long dispatches;    // Processes put on this CPU
+    long switches;      // Dispatches of a process other than the last one
+    SLAB_HANDLE lastRan;    // Last process dispatched here, 0 if none
+} CPU;
+
+// Highest number of semaphores, override at compile time with -D
+#ifndef MAX_SEMAPHORES
+#define MAX_SEMAPHORES (1 << 20)
+#endif
+
 // Semaphores Data structure
+// A negative value counts the processes waiting, which queue up in
+// FIFO order through their waitLink
 typedef struct {
     int value;
-    LIST* waiting;
+    bool inUse;
+    ILIST waiters;
+    ILIST holders;  // HOLDs of the processes a waiter waits for
+    int deadlockedWaiters;  // Waiters that are DEADLOCKED
+    unsigned long long deadlockMark;    // Last deadlock search that queued its waiters
+    unsigned long long deadlockSearch;  // Last deadlock search that went through its holders
 } SEMAPHORE;
 
-//Lists
-LIST* lowP;
-LIST* normalP;
-LIST* highP;
-LIST* sending; // contains items that are blocked because of sending and waiting to receive
-LIST* receiving;
-LIST* allJobs;
-LIST* readyJobs;
-LIST semaphores[5]; // MAX 5
+// A process's claim on a semaphore: P operations it got through on the
+// semaphore that it has not matched with V. One per process and
+// semaphore, on both of their lists.
+typedef struct {
+    ILINK semLink;      // Link on the semaphore's holders, or on freeHolds
+    ILINK procLink;     // Link on the process's holds
+    PCB* block;
+    int semaphoreID;
+    int count;
+} HOLD;
+
+// Lists. PCBs carry their own links, so moving them between queues
+// never allocates. The PCBs themselves come from pcbSlab and go back to
+// it when they exit, so what outlives a process (a CPU's lastRan, an
+// escape path) refers to it by SLAB_HANDLE and sees when it is gone.
+SLAB pcbSlab;
+ILIST* priorityJobs;    // All jobs of each priority, indexed by priority
+ILIST allJobs;
+PROCTABLE procTable;    // Columns of every live process, for full-table scans
+SCHED_POLICY* schedPolicy = &priorityPolicy; // Set before init_PCB to change the policy
+int numPriorities = NUM_PRIORITIES; // Set before init_PCB to change the levels
+
+// Semaphore table, indexed by semaphore id and grown on demand
+SEMAPHORE* semaphores;
+int semaphoreTableSize;
+int semaphoreCount;     // Semaphores created
+
+// Process tree. PCB_fork makes the new process a child of the running
+// one. A process that exits while its parent lives becomes a ZOMBIE:
+// it is off every queue, table and index and has released everything
+// but its PCB and its pid, which its parent's PCB_wait gives back. The
+// simulator plays init: orphans become top-level processes, and their
+// zombies are reaped at once.
+int zombieCount;        // Zombies not yet reaped
+
+// Wait-for graph. A process blocked sending to a full mailbox waits for
+// its receiver, and one blocked in P waits for the holders of the
+// semaphore, any of which could do the V. The edges are the sendTarget,
+// waitingOn and holds the operations keep anyway, so the graph is always
+// current. A process is deadlocked when it can never run again: it is
+// blocked with no timeout, and everything it waits for is deadlocked.
+// Only a process blocking can make that true, so each block searches
+// just the processes reachable from it, stopping at the first that can
+// still run, and each process keeps the path found from it so the next
+// search tries that first. Waking or killing a process clears the marks
+// of the ones that waited on it, and those are searched again.
+bool PCB_detectDeadlocks = true;    // Clear to turn detection off
+int deadlockedCount;    // Processes DEADLOCKED
+long deadlocksFound;    // Deadlocks detected so far
+unsigned long long deadlockEpoch;   // Numbers each search, for deadlockMark
+PCB** deadlockNodes;    // Processes found by the current search
+int deadlockNodeCount;
+int deadlockNodeCapacity;
+PCB** deadlockRecheck;  // Processes to search again
+int deadlockRecheckCount;
+int deadlockRecheckCapacity;
+int deadlockDefer;      // Rechecks wait until it is back to 0
+ILIST freeHolds;        // Released HOLDs, for reuse
+
+// CPUs. Commands act on cpus[currentCPU]; every transition into or out
+// of RUNNING goes through setState so cpus[].running is always current.
+// Each CPU schedules from its own run queue; a CPU that runs dry steals
+// from the longest other queue, so no CPU idles while work is queued.
+CPU cpus[MAX_CPUS];
+int numCPUs = 1;        // Set before init_PCB to simulate more CPUs
+int currentCPU = 0;
+unsigned long long idleCPUs;    // Bit i set while cpus[i] runs nothing
+
+// Simulated clock. Quantum expiry, CPU bursts, IO, sleeps and timeouts
+// are all timers on one wheel, and PCB_advance moves the clock forward
+// running them in time order. Processes created with a burst profile
+// alternate CPU and IO bursts on their own until their work is done.
+TIMERWHEEL simClock;
+int quantumTicks = 10;  // Ticks in a quantum, set before init_PCB to change it
+int blockTimeout = 0;   // Ticks a blocked send, receive or P waits, 0 = forever
+int profiledJobs;       // Live processes with a burst profile
+int readyProfiled;      // Profiled processes that are READY
+int armedProcessTimers; // Process timers armed, not counting quantum timers
+
+// Metrics of the processes that have exited. Their PCB_METRICS are
+// summarised in the histograms and, while PCB_keepExits is set, kept
+// whole for PCB_writeMetrics.
+typedef struct {
+    int pid;
+    int priority;
+    unsigned long long exited;  // Clock time it exited
+    PROC_METRICS metrics;
+} EXIT_RECORD;
+
+HIST turnaroundHist;    // Creation to exit
+HIST waitingHist;       // Time READY
+HIST responseHist;      // Creation to first dispatch, for every process
+HIST blockedHist;       // Time BLOCKED
+long exitedJobs;
+EXIT_RECORD* exitRecords;
+int exitRecordCount;
+int exitRecordCapacity;
+bool PCB_keepExits = true;
+
+// When set, main checks the CPU invariants after every command
+bool PCB_checkMode = false;
+
+// Pids come from pidMap, so no two live processes share one and a pid
+// is only reused once the allocator's cursor wraps round to it
+PIDMAP pidMap;
+int pidMax = PID_MAX;   // Set before init_PCB to change the pid range
+
+// pid -> PCB index. Slot pid holds the live process with that pid,
+// or NULL. Grown on demand so lookups by pid are O(1).
+PCB** pidIndex;
+int pidIndexSize;
+
+// Progress messages from the operations below can be switched off
+// (e.g. for benchmarks) by clearing PCB_verbose
+bool PCB_verbose = true;
+#define PCB_print(...) do { if(PCB_verbose) printf(__VA_ARGS__); } while(0)
 
 // Required functions
 int create(int priority);
+void initPCB(PCB* block, int pid, int priority);
 int PCB_fork(void);
 int PCB_kill(int pid);
+void killPCB(PCB* killBlock);
 void PCB_exit(void);
+int PCB_wait(void);
+int PCB_killTree(int pid);
 void PCB_quantum(void);
-int PCBsend(int pid, char* msg);
+int PCBsend(int pid, MESSAGE* msg);
 void PCB_receive(void);
-int PCB_reply(int pid, char* msg);
+int PCB_reply(int pid, MESSAGE* msg);
 
 int PCB_newSemaphore(int semaphoreID, int initialValue);
 int PCB_semaphoreP(int semaphoreID);
 int PCB_semaphoreV(int semaphoreID);
+SEMAPHORE* findSemaphore(int semaphoreID);
+int nextSemaphoreID(void);
+int growSemaphores(int semaphoreID);
+void initSemaphore(SEMAPHORE* sem, int initialValue);
+void unlinkWaiter(PCB* block);
+
+// Deadlock detection
+void addHold(PCB* block, int semaphoreID);
+void dropHold(PCB* block, int semaphoreID);
+void dropAllHolds(PCB* block);
+int detectDeadlock(PCB* start);
+void releaseDeadlocked(PCB* block, bool recheck);
+void deadlockDeferBegin(void);
+void deadlockDeferEnd(void);
 
 void PCB_procInfo(int pid);
 void PCB_totalInfo(void);
+void PCB_writeMetrics(FILE* f, bool csv);
+
+// Simulated clock
+int PCB_createJob(int priority, int cpuBurst, int ioBurst, long work);
+int PCB_sleep(int ticks);
+void PCB_setTimeout(int ticks);
+long PCB_advance(long ticks);
+void PCB_listState(int state);
+
+// Process tree, used by kill and wait
+void orphanChildren(PCB* block);
+void releasePCB(PCB* block);
+
+// pid index maintenance, used by create and PCB_kill
+PCB* findPCB(int pid);
+PCB* findHandle(SLAB_HANDLE handle);
+int growPidIndex(int pid);
+int indexPCB(PCB* block);
+void unindexPCB(PCB* block);
+
+// Processes blocked sending to a full mailbox
+void queueSender(PCB* rBlock, PCB* sBlock);
+PCB* dequeueSender(PCB* rBlock);
+void unlinkSender(PCB* sBlock);
+
+// Keeps procTable's mail column in step with a process's mailbox
+void syncMail(PCB* block);
+
+// State transitions and the running process
+void setStateOn(PCB* block, int state, int cpu);
+void setState(PCB* block, int state);
+PCB* runningPCB(void);
+void* runQueueOf(PCB* block);
+void makeReady(PCB* block);
+void blockRunning(PCB* block, int reason);
+void wakeUp(PCB* block);
+PCB* takeReady(int cpu);
+PCB* getNextReady(void);
+void wakeIdleCPUs(void);
+void runNext(void);
+
+// Metrics
+void recordExit(PCB* block);
+
+// Timer events
+void chargeCPU(PCB* block);
+void startBurst(PCB* block);
+void armProcessTimer(PCB* block, void (*fire)(TIMER* timer), long delay);
+void cancelProcessTimer(PCB* block);
+void armTimeout(PCB* block);
+void quantumExpired(TIMER* timer);
+void burstDone(TIMER* timer);
+void waitDone(TIMER* timer);
+void waitTimedOut(TIMER* timer);
+
+// Multiple CPUs
+int PCB_useCPU(int cpu);
+void PCB_cpuInfo(void);
+int PCB_checkInvariants(void);
 
 // Function for initialization of all the LISTS
 void init_PCB(void);
 
+// Function to free every PCB and LIST created since init_PCB
+void deinit_PCB(void);
+
 
 //------------------------------------------------------------------------
 
 void init_PCB(void) {
-    lowP = ListCreate();
-    normalP = ListCreate();
-    highP = ListCreate();
-    sending = ListCreate();
-    receiving = ListCreate();
-    allJobs = ListCreate();
-    readyJobs = ListCreate();
-    for(int i=0; i<5; i++) {
-        semaphores[i].count=0;
-        semaphores[i].curr = NULL;
-        semaphores[i].first = NULL;
-        semaphores[i].last = NULL;
-        semaphores[i].isFree = 1;
+    priorityJobs = malloc(numPriorities * sizeof(ILIST));
+    for(int i=0; i<numPriorities; i++) {
+        IListInit(&priorityJobs[i]);
+    }
+    IListInit(&allJobs);
+    SlabInit(&pcbSlab, sizeof(PCB));
+    PTInit(&procTable);
+    MsgInit();
+    semaphores = NULL;
+    semaphoreTableSize = 0;
+    semaphoreCount = 0;
+    pidIndex = NULL;
+    pidIndexSize = 0;
+    PidMapInit(&pidMap, pidMax);
+    if(numCPUs < 1 || numCPUs > MAX_CPUS)
+        numCPUs = numCPUs < 1 ? 1 : MAX_CPUS;
+    for(int i=0; i<MAX_CPUS; i++) {
+        cpus[i].running = NULL;
+        cpus[i].runQueue = i < numCPUs ? schedPolicy->create(numPriorities) : NULL;
+        cpus[i].ticks = 0;
+        cpus[i].busyTicks = 0;
+        cpus[i].migrations = 0;
+        cpus[i].busyTime = 0;
+        cpus[i].dispatches = 0;
+        cpus[i].switches = 0;
+        cpus[i].lastRan = 0;
+        TimerInit(&cpus[i].quantumTimer, quantumExpired);
+    }
+    idleCPUs = numCPUs == 64 ? ~0ULL : (1ULL << numCPUs) - 1;
+    currentCPU = 0;
+    TWInit(&simClock);
+    if(quantumTicks < 1)
+        quantumTicks = 1;
+    profiledJobs = 0;
+    readyProfiled = 0;
+    armedProcessTimers = 0;
+    zombieCount = 0;
+    HistInit(&turnaroundHist);
+    HistInit(&waitingHist);
+    HistInit(&responseHist);
+    HistInit(&blockedHist);
+    exitedJobs = 0;
+    exitRecords = NULL;
+    exitRecordCount = 0;
+    exitRecordCapacity = 0;
+    deadlockedCount = 0;
+    deadlocksFound = 0;
+    deadlockNodes = NULL;
+    deadlockNodeCount = 0;
+    deadlockNodeCapacity = 0;
+    deadlockRecheck = NULL;
+    deadlockRecheckCount = 0;
+    deadlockRecheckCapacity = 0;
+    deadlockDefer = 0;
+    IListInit(&freeHolds);
+}
+
+/*
+ * Moves a process to a new state
+ * A process entering RUNNING takes over cpu and starts its quantum,
+    a process leaving RUNNING is charged for its CPU time and frees its CPU
+ */
+void setStateOn(PCB* block, int state, int cpu) {
+    TRACE(TRACE_STATE, block->pid, block->state, state, state == RUNNING ? cpu : block->cpu, 0, simClock.now);
+    MetricsState(&block->metrics, block->state, block->state == BLOCKED, simClock.now);
+    
+    if(block->state == RUNNING && block->cpu >= 0) {
+        chargeCPU(block);
+        cancelProcessTimer(block);  // Its burst is cut short
+        if(cpus[block->cpu].running == block) {
+            cpus[block->cpu].running = NULL;
+            idleCPUs |= 1ULL << block->cpu;
+            TWCancel(&simClock, &cpus[block->cpu].quantumTimer);
+        }
+        block->cpu = -1;
+    }
+    
+    if(block->cpuBurst > 0)
+        readyProfiled += (state == READY) - (block->state == READY);
+    int deadlocked = (state == DEADLOCKED) - (block->state == DEADLOCKED);
+    if(deadlocked != 0) {
+        deadlockedCount += deadlocked;
+        if(block->sendTarget != NULL)
+            block->sendTarget->deadlockedSenders += deadlocked;
+        if(block->waitingOn >= 0)
+            semaphores[block->waitingOn].deadlockedWaiters += deadlocked;
+    }
+    block->state = state;
+    procTable.state[block->slot] = (signed char) state;
+    
+    if(state == RUNNING) {
+        block->cpu = cpu;
+        block->homeCPU = cpu;
+        cpus[cpu].running = block;
+        idleCPUs &= ~(1ULL << cpu);
+        
+        block->metrics.dispatches++;
+        if(block->metrics.response < 0) {
+            block->metrics.response = (long long)(simClock.now - block->metrics.created);
+            HistAdd(&responseHist, block->metrics.response);
+        }
+        cpus[cpu].dispatches++;
+        if(cpus[cpu].lastRan != SlabHandle(block)) {
+            cpus[cpu].switches++;
+            cpus[cpu].lastRan = SlabHandle(block);
+        }
+        
+        block->dispatched = simClock.now;
+        TWCancel(&simClock, &cpus[cpu].quantumTimer);
+        TWAdd(&simClock, &cpus[cpu].quantumTimer, simClock.now + quantumTicks);
+        startBurst(block);
+    }
+}
+
+/*
+ * Moves a process to a new state, running it on the current CPU
+    if the new state is RUNNING
+ */
+void setState(PCB* block, int state) {
+    setStateOn(block, state, currentCPU);
+}
+
+void syncMail(PCB* block) {
+    procTable.mail[block->slot] = MboxCount(&block->mailbox);
+}
+
+/*
+ * Returns the process running on the current CPU, NULL if it is idle
+ * Runs in O(1) time
+ */
+PCB* runningPCB(void) {
+    return cpus[currentCPU].running;
+}
+
+/*
+ * Returns the run queue a process is queued on while READY
+ */
+void* runQueueOf(PCB* block) {
+    return cpus[block->homeCPU].runQueue;
+}
+
+/*
+ * Dispatches the next ready process if the current CPU is idle,
+    then lets the other idle CPUs pick up what is left
+ */
+void runNext(void) {
+    if(runningPCB() == NULL) {
+        PCB* nextJob = getNextReady();
+        
+        if(nextJob != NULL) {
+            setState(nextJob, RUNNING);
+            PCB_print("Next ready job is running.\n");
+        } else {
+            PCB_print("No more ready jobs available.\n");
+        }
+    }
+    
+    wakeIdleCPUs();
+}
+
+/*
+ * Dispatches a ready process on every idle CPU other than the current
+    one, until they are all busy or nothing is left to steal
+ * The current CPU is left to the command acting on it
+ */
+void wakeIdleCPUs(void) {
+    unsigned long long idle = idleCPUs & ~(1ULL << currentCPU);
+    
+    while(idle != 0) {
+        int cpu = __builtin_ctzll(idle);
+        idle &= idle - 1;
+        
+        PCB* next = takeReady(cpu);
+        if(next == NULL)
+            return;     // Every run queue is empty
+        setStateOn(next, RUNNING, cpu);
     }
 }
 
+/*
+ * Verifies that every CPU runs exactly one RUNNING process, or is idle
+    with nothing ready, and that cpus[] agrees with the PCB states
+ * Also checks the process tree: children link back to their parent,
+    zombies first, and the zombie counts add up; and that
+    armedProcessTimers matches the timers on the wheel
+ * Prints each violation to stderr
+ * Returns the number of violations found
+ */
+int PCB_checkInvariants(void) {
+    int violations = 0;
+    int runningCount[MAX_CPUS] = { 0 };
+    int totalReady = 0;
+    int processTimers = simClock.count;
+    
+    // With work stealing no CPU may idle while any run queue holds work
+    for(int i=0; i<numCPUs; i++)
+        totalReady += schedPolicy->count(cpus[i].runQueue);
+    
+    for(int slot=0; slot<procTable.used; slot++) {
+        if(procTable.state[slot] != RUNNING)
+            continue;
+        
+        PCB* block = procTable.item[slot];
+        if(block->cpu < 0 || block->cpu >= numCPUs || cpus[block->cpu].running != block) {
+            fprintf(stderr, "invariant: pid %d is RUNNING but not on a CPU\n", block->pid);
+            violations++;
+            continue;
+        }
+        runningCount[block->cpu]++;
+    }
+    
+    // Every child links back to its parent, and zombies come first
+    int zombies = 0;
+    for(int slot=0; slot<procTable.used; slot++) {
+        if(procTable.state[slot] == PT_FREE)
+            continue;
+        
+        PCB* block = procTable.item[slot];
+        int seen = 0;
+        bool live = false;
+        for(ILINK* link = block->children.first; link != NULL; link = link->next) {
+            PCB* child = ILIST_ITEM(link, PCB, siblingLink);
+            if(child->parent != block || (live && child->state == ZOMBIE)) {
+                fprintf(stderr, "invariant: children of pid %d are out of order or not linked back\n", block->pid);
+                violations++;
+                break;
+            }
+            live = child->state != ZOMBIE;
+            seen += child->state == ZOMBIE;
+        }
+        if(seen != block->zombieChildren) {
+            fprintf(stderr, "invariant: pid %d has %d zombies, counts %d\n", block->pid, seen, block->zombieChildren);
+            violations++;
+        }
+        zombies += seen;
+    }
+    if(zombies != zombieCount) {
+        fprintf(stderr, "invariant: %d zombies, counted %d\n", zombies, zombieCount);
+        violations++;
+    }
+    
+    for(int i=0; i<numCPUs; i++) {
+        PCB* block = cpus[i].running;
+        if(runningCount[i] > 1) {
+            fprintf(stderr, "invariant: CPU %d has %d RUNNING processes\n", i, runningCount[i]);
+            violations++;
+        }
+        if(block != NULL && block->state != RUNNING) {
+            fprintf(stderr, "invariant: CPU %d holds pid %d in state %d\n", i, block->pid, block->state);
+            violations++;
+        }
+        if(block == NULL && totalReady > 0) {
+            fprintf(stderr, "invariant: CPU %d is idle with %d ready processes\n", i, totalReady);
+            violations++;
+        }
+        if((block == NULL) != ((idleCPUs >> i) & 1)) {
+            fprintf(stderr, "invariant: CPU %d idle bit is wrong\n", i);
+            violations++;
+        }
+        if((block != NULL) != TimerArmed(&cpus[i].quantumTimer)) {
+            fprintf(stderr, "invariant: CPU %d quantum timer is wrong\n", i);
+            violations++;
+        }
+        processTimers -= TimerArmed(&cpus[i].quantumTimer);
+    }
+    if(processTimers != armedProcessTimers) {
+        fprintf(stderr, "invariant: %d process timers armed, counted %d\n", processTimers, armedProcessTimers);
+        violations++;
+    }
+    
+    return violations;
+}
+
+/*
+ * Returns the live process with the given pid, NULL if there is none
+ * Runs in O(1) time
+ */
+PCB* findPCB(int pid) {
+    if(pid <= 0 || pid >= pidIndexSize)
+        return NULL;
+    return pidIndex[pid];
+}
+
+/*
+ * Returns the live process a handle names, NULL if it has exited since
+ * Runs in O(1) time
+ */
+PCB* findHandle(SLAB_HANDLE handle) {
+    return SlabLookup(&pcbSlab, handle);
+}
+
+/*
+ * Makes the pid index cover pid, doubling it as needed
+ * Returns 0 for success, -1 for failure
+ */
+int growPidIndex(int pid) {
+    if(pid < pidIndexSize)
+        return 0;
+
+    int size = pidIndexSize == 0 ? 64 : pidIndexSize;
+    while(size <= pid)
+        size *= 2;
+
+    PCB** grown = realloc(pidIndex, size * sizeof(PCB*));
+    if(grown == NULL)
+        return -1;
+    memset(grown + pidIndexSize, 0, (size - pidIndexSize) * sizeof(PCB*));
+    pidIndex = grown;
+    pidIndexSize = size;
+    return 0;
+}
+
+/*
+ * Adds a process to the pid index, doubling the index if needed
+ * Returns 0 for success, -1 for failure
+ */
+int indexPCB(PCB* block) {
+    if(growPidIndex(block->pid) != 0)
+        return -1;
+    pidIndex[block->pid] = block;
+    return 0;
+}
+
+/*
+ * Removes a process from the pid index
+ */
+void unindexPCB(PCB* block) {
+    if(findPCB(block->pid) == block)
+        pidIndex[block->pid] = NULL;
+}
+
+void deinit_PCB(void) {
+    // Every PCB lives in pcbSlab; the lists only link them
+    IListInit(&allJobs);
+    SlabDeinit(&pcbSlab);
+    free(priorityJobs);
+    PTFree(&procTable);
+    for(int i=0; i<numCPUs; i++) {
+        schedPolicy->destroy(cpus[i].runQueue);
+        cpus[i].runQueue = NULL;
+        cpus[i].running = NULL;
+    }
+    ILINK* holdLink;
+    for(int i=0; i<semaphoreTableSize; i++) {
+        while(semaphores[i].inUse && (holdLink = IListPop(&semaphores[i].holders)) != NULL)
+            free(ILIST_ITEM(holdLink, HOLD, semLink));
+    }
+    while((holdLink = IListPop(&freeHolds)) != NULL)
+        free(ILIST_ITEM(holdLink, HOLD, semLink));
+    free(semaphores);
+    semaphores = NULL;
+    semaphoreTableSize = 0;
+    semaphoreCount = 0;
+    free(pidIndex);
+    pidIndex = NULL;
+    pidIndexSize = 0;
+    PidMapFree(&pidMap);
+    MsgDeinit();
+    free(exitRecords);
+    exitRecords = NULL;
+    exitRecordCount = 0;
+    exitRecordCapacity = 0;
+    TWInit(&simClock);  // Its timers lived in the PCBs and CPUs
+    profiledJobs = 0;
+    readyProfiled = 0;
+    armedProcessTimers = 0;
+    free(deadlockNodes);
+    deadlockNodes = NULL;
+    deadlockNodeCapacity = 0;
+    free(deadlockRecheck);
+    deadlockRecheck = NULL;
+    deadlockRecheckCount = 0;
+    deadlockRecheckCapacity = 0;
+    deadlockedCount = 0;
+    zombieCount = 0;
+}
+
+/*
+ * Sets up a new process with nothing queued, linked or armed yet
+ */
+void initPCB(PCB* block, int pid, int priority) {
+    block->pid = pid;
+    block->priority = priority;
+    MboxInit(&block->mailbox);
+    block->receiving = false;
+    block->outgoing = NULL;
+    block->sendTarget = NULL;
+    IListInit(&block->senders);
+    block->deadlockedSenders = 0;
+    block->waitingOn = -1;
+    block->parent = NULL;
+    IListInit(&block->children);
+    block->zombieChildren = 0;
+    block->waitingChild = false;
+    IListInit(&block->holds);
+    block->deadlockMark = 0;
+    block->deadlockEscape = 0;
+    block->deadlockWalk = 0;
+    block->state = BLOCKED;
+    block->cpu = -1;
+    block->homeCPU = currentCPU;
+    SchedInitEntity(&block->sched, block, priority);
+    TimerInit(&block->timer, NULL);
+    MetricsInit(&block->metrics, simClock.now);
+    block->dispatched = simClock.now;
+    block->cpuTime = 0;
+    block->cpuBurst = 0;
+    block->ioBurst = 0;
+    block->burstLeft = 0;
+    block->workLeft = 0;
+}
+
 int create(int priority) {
-    PCB* block = (PCB*)malloc(sizeof(PCB)); //Use malloc since size of processes is uncertain
+    PCB* block = SlabAlloc(&pcbSlab);
+    if(block == NULL) {
+        PCB_print("Out of memory. Process not created.\n");
+        return 0; // FAIL
+    }
     
     // Assign pid
-    block->pid = ListCount(allJobs) + 1;
-    block->priority = priority;
+    int pid = PidAlloc(&pidMap);
+    if(pid == 0) {
+        PCB_print("No process ID free. Process not created.\n");
+        SlabFree(&pcbSlab, block);
+        return 0; // FAIL
+    }
+    initPCB(block, pid, priority);
     
-    ListAppend(allJobs, block);
+    block->slot = PTAdd(&procTable, block, block->pid, priority, BLOCKED);
+    if(block->slot < 0 || indexPCB(block) != 0) {
+        PCB_print("Process table is full. Process not created.\n");
+        if(block->slot >= 0)
+            PTRemove(&procTable, block->slot);
+        releasePCB(block);
+        return 0; // FAIL
+    }
+    IListAppend(&allJobs, &block->jobLink);
+    TRACE(TRACE_CREATE, block->pid, BLOCKED, BLOCKED, currentCPU, priority, simClock.now);
     
     // Decide state (Ready, Running, Deadlocked or Blocked)
-    if(ListCount(allJobs) == 1) {
-        block->state = RUNNING;
+    if(runningPCB() == NULL) {
+        setState(block, RUNNING);
     }
     else {
-        block->state = READY;
-        ListPrepend(readyJobs, block);
+        makeReady(block);
     }
     
     // Place in priority queue
-    if(priority == 0) {
-        ListAppend(lowP, block);
-    }
-    else if(priority == 1) {
-        ListAppend(normalP, block);
-    }
-    else {
-        ListAppend(highP, block);
-    }
+    IListAppend(&priorityJobs[priority], &block->priorityLink);
     
-    int count = ListCount(allJobs);
-    printf("Number of jobs in Queue: %d\n", count);
+    int count = IListCount(&allJobs);
+    PCB_print("Number of jobs in Queue: %d\n", count);
     
     return block->pid;
 }
 
 int PCB_fork(void) {
-    Node* currentProcess = ListFirst(allJobs);  // Start with the first process on the List of all Jobs
-    PCB* newBlock = (PCB*)currentProcess->data; // New process (pid to be returned)
-    
     // Get the process which is running
-    while(newBlock->state != RUNNING) {
-        currentProcess = currentProcess->next;
-        newBlock = (PCB*) currentProcess->data;
+    PCB* parent = runningPCB();
+    
+    if(parent == NULL) {
+        PCB_print("No process running to fork.\n");
+        return 0; // FAIL
     }
     
     // create() returns the pid of the new process
-    int newPid = create(newBlock->priority);
+    int newPid = create(parent->priority);
+    if(newPid == 0)
+        return 0; // FAIL
     
-    printf("Fork Created with id = %d.\n", newPid);
+    PCB* child = findPCB(newPid);
+    child->parent = parent;
+    IListAppend(&parent->children, &child->siblingLink);
+    
+    PCB_print("Fork Created with id = %d.\n", newPid);
     return newPid;
 }
 
-PCB* getNextReady(void) {
-    PCB* retBlock = (PCB*)malloc(sizeof(PCB));
-    Node* head = (Node*)malloc(sizeof(Node));
-    
-    if(highP!=NULL) {
-        head = readyJobs->first;
-        retBlock = (PCB*) head->data;
-        while (head->next!=NULL) {
-            if(retBlock->state == READY && retBlock->priority == 2) {
-                readyJobs->curr = head;
-                ListRemove(readyJobs);
-                return retBlock;
-            }
-            head = head->next;
-            retBlock = (PCB*) head->data;
-        }
-    } else if (normalP != NULL) {
-        head = readyJobs->first;
-        retBlock = (PCB*) head->data;
-        while (head->next!=NULL) {
-            if(retBlock->state == READY && retBlock->priority == 1) {
-                readyJobs->curr = head;
-                ListRemove(readyJobs);
-                return retBlock;
+/*
+ * Makes a process READY and hands it to the scheduling policy of its
+    home CPU; an idle CPU elsewhere picks it up straight away
+ */
+void makeReady(PCB* block) {
+    setState(block, READY);
+    schedPolicy->enqueue(runQueueOf(block), &block->sched);
+    
+    if(idleCPUs & ~(1ULL << currentCPU))
+        wakeIdleCPUs();
+}
+
+/*
+ * Takes the running process off the CPU to wait for an event
+ * reason (WAIT_IPC, WAIT_SEMAPHORE, ...) says where its blocked time goes
+ */
+void blockRunning(PCB* block, int reason) {
+    schedPolicy->on_block(runQueueOf(block), &block->sched);
+    block->metrics.waitReason = reason;
+    block->metrics.switches++;
+    setState(block, BLOCKED);
+}
+
+/*
+ * Makes a waiting process READY again, calling off its timeout
+ */
+void wakeUp(PCB* block) {
+    deadlockDeferBegin();
+    releaseDeadlocked(block, false);    // It can run, so what waits on it can too
+    cancelProcessTimer(block);
+    schedPolicy->on_wake(runQueueOf(block), &block->sched);
+    makeReady(block);
+    deadlockDeferEnd();
+}
+
+/*
+ * Takes the process to run next on cpu off its run queue
+ * A CPU whose own queue is empty steals from the longest other queue,
+    and the stolen process moves home to cpu
+ * Returns NULL if no process is ready anywhere
+ */
+PCB* takeReady(int cpu) {
+    SCHED_ENTITY* next = schedPolicy->pick_next(cpus[cpu].runQueue);
+    
+    if(next == NULL && numCPUs > 1) {
+        int victim = -1;
+        int longest = 0;
+        for(int i=0; i<numCPUs; i++) {
+            int count = i == cpu ? 0 : schedPolicy->count(cpus[i].runQueue);
+            if(count > longest) {
+                longest = count;
+                victim = i;
             }
-            head = head->next;
-            retBlock = (PCB*) head->data;
         }
-    } else if(lowP != NULL) {
-        head = readyJobs->first;
-        retBlock = (PCB*) head->data;
-        while (head->next!=NULL) {
-            if(retBlock->state == READY && retBlock->priority == 0) {
-                readyJobs->curr = head;
-                ListRemove(readyJobs);
-                return retBlock;
-            }
-            head = head->next;
-            retBlock = (PCB*) head->data;
+        
+        if(victim >= 0) {
+            next = schedPolicy->pick_next(cpus[victim].runQueue);
+            ((PCB*) next->item)->homeCPU = cpu;
+            cpus[cpu].migrations++;
         }
-    } else {
-        // No process available
+    }
+    
+    if(next == NULL) {
         return NULL;
     }
     
-    return NULL;
+    return (PCB*) next->item;
+}
+
+/*
+ * Takes the process to run next on the current CPU off the run queues
+ * Returns NULL if no process is ready
+ */
+PCB* getNextReady(void) {
+    return takeReady(currentCPU);
 }
 
 int PCB_kill(int pid) {
-    Node* process = ListFirst(allJobs);
-    PCB* killBlock = (PCB*) process->data;
-    int killID = killBlock->pid;
+    PCB* killBlock = findPCB(pid);
     
     // Check if the named process exists
-    while(killID != pid && process->next != NULL) {
-        if(killID != pid && process == allJobs->last) {
-            printf("The entered process ID does not exist.\n");
-            return 0; // FAIL
-        }
-        process = process->next;
-        killBlock = (PCB*) process->data;
-        killID = killBlock->pid;
+    if(killBlock == NULL) {
+        PCB_print("The entered process ID does not exist.\n");
+        return 0; // FAIL
     }
     
-    if(killID != pid) {
-        printf("The entered process ID does not exist.\n");
-        return 0; // FAIL
-    } else {
-        allJobs->curr = process;
-        
-        // Make the next ready process run if the one to be killed is RUNNING
-        if(readyJobs->count > 0) {
-            PCB* tempBlock = getNextReady();
-        
-            if(tempBlock != NULL) {
-                if(killBlock->state == RUNNING) {
-                    tempBlock->state = RUNNING;
-                }
-            }
+    killPCB(killBlock);
+    return 1;
+}
+
+/*
+ * Kills a process: takes it off every queue, drops its mail and fails
+    the sends waiting on it, then runs the next process if it was running
+ * Its children are orphaned. It is reaped at once if its parent waits
+    in PCB_wait or it has none, and otherwise stays a ZOMBIE; once
+    reaped its PCB goes back to pcbSlab, so killBlock may be invalid
+    afterwards
+ */
+void killPCB(PCB* killBlock) {
+    bool wasRunning = killBlock->state == RUNNING;
+    TRACE(TRACE_KILL, killBlock->pid, killBlock->state, killBlock->state, killBlock->cpu, 0, simClock.now);
+    deadlockDeferBegin();
+    releaseDeadlocked(killBlock, true);
+    
+    // A ready process must not be dispatched after it dies
+    if(killBlock->state == READY) {
+        schedPolicy->remove(runQueueOf(killBlock), &killBlock->sched);
+    }
+    setState(killBlock, BLOCKED);
+    recordExit(killBlock);
+    cancelProcessTimer(killBlock);
+    if(killBlock->cpuBurst > 0)
+        profiledJobs--;
+    
+    // Drop its mail, and fail the sends still waiting on either side
+    MboxClear(&killBlock->mailbox);
+    killBlock->receiving = false;
+    killBlock->waitingChild = false;
+    unlinkSender(killBlock);
+    unlinkWaiter(killBlock);
+    dropAllHolds(killBlock);
+    
+    bool woke = false;
+    PCB* sender;
+    while((sender = dequeueSender(killBlock)) != NULL) {
+        MsgRelease(sender->outgoing);
+        sender->outgoing = NULL;
+        wakeUp(sender);
+        woke = true;
+    }
+    
+    IListRemove(&allJobs, &killBlock->jobLink);
+    IListRemove(&priorityJobs[killBlock->priority], &killBlock->priorityLink);
+    unindexPCB(killBlock);
+    PTRemove(&procTable, killBlock->slot);
+    
+    // A parent waiting in PCB_wait reaps it now; any other keeps it as
+    // a zombie, ahead of its live children
+    orphanChildren(killBlock);
+    PCB* parent = killBlock->parent;
+    bool zombie = false;
+    if(parent != NULL) {
+        IListRemove(&parent->children, &killBlock->siblingLink);
+        if(parent->waitingChild) {
+            parent->waitingChild = false;
+            PCB_print("Process %d reaped child %d.\n", parent->pid, killBlock->pid);
+            wakeUp(parent);
+            woke = true;
+        } else {
+            IListPrepend(&parent->children, &killBlock->siblingLink);
+            parent->zombieChildren++;
+            zombieCount++;
+            
+            // Its slot is gone, so setState would write a freed one
+            TRACE(TRACE_STATE, killBlock->pid, killBlock->state, ZOMBIE, killBlock->cpu, 0, simClock.now);
+            MetricsState(&killBlock->metrics, killBlock->state, killBlock->state == BLOCKED, simClock.now);
+            killBlock->state = ZOMBIE;
+            zombie = true;
         }
-        ListRemove(allJobs); // Remove current
     }
     
-    return 1;
+    // Make the next ready process run if the one killed was RUNNING,
+    // or if a woken sender or parent can use the idle CPU
+    if(wasRunning || woke) {
+        runNext();
+    }
+    deadlockDeferEnd();
+    
+    // Nothing links it now, and kills are never deferred inside another
+    // operation, so the recheck queue has been searched and emptied
+    if(!zombie)
+        releasePCB(killBlock);
+    return;
 }
 
 void PCB_exit(void)
 {
     // find the currently running process and kill it.
-    Node* process = ListFirst(allJobs);
-    PCB* exitBlock = (PCB*) process->data;
-    int state = exitBlock->state;
-    
-    while(state != RUNNING) {
-        if(exitBlock->pid == ListCount(allJobs)) {
-            printf("No processes running currently.");
-            return;
-        }
-        
-        process = process->next;
-        exitBlock = (PCB*) process->data;
-        state = exitBlock->state;
+    PCB* exitBlock = runningPCB();
+    
+    if(exitBlock == NULL) {
+        PCB_print("No processes running currently.\n");
+        return;
     }
     
-    PCB_kill(exitBlock->pid);
+    killPCB(exitBlock);
     
     return;
 }
 
-void PCB_quantum(void) {
+/*
+ * Gives back the pid and the PCB of a process that has exited
+ */
+void releasePCB(PCB* block) {
+    PidFree(&pidMap, block->pid);
+    SlabFree(&pcbSlab, block);
+}
+
+/*
+ * Hands the children of an exiting process to the simulator: the live
+    ones become top-level processes and the zombies are reaped
+ */
+void orphanChildren(PCB* block) {
+    ILINK* link;
+    while((link = IListPop(&block->children)) != NULL) {
+        PCB* child = ILIST_ITEM(link, PCB, siblingLink);
+        child->parent = NULL;
+        if(child->state == ZOMBIE) {
+            zombieCount--;
+            releasePCB(child);
+        }
+    }
+    block->zombieChildren = 0;
+}
+
+/*
+ * Reaps a zombie child of the running process, or blocks it until one
+    of its children exits
+ * Returns the pid reaped, 0 if it blocked or has no children
+ */
+int PCB_wait(void) {
+    PCB* block = runningPCB();
+    
+    if(block == NULL) {
+        PCB_print("No process running. Nothing can wait.\n");
+        return 0; // FAIL
+    }
+    if(IListCount(&block->children) == 0) {
+        PCB_print("Process %d has no children to wait for.\n", block->pid);
+        return 0; // FAIL
+    }
+    
+    // Zombies come first, so the first child is one if there are any
+    if(block->zombieChildren > 0) {
+        PCB* child = ILIST_ITEM(IListPop(&block->children), PCB, siblingLink);
+        int pid = child->pid;
+        block->zombieChildren--;
+        zombieCount--;
+        releasePCB(child);
+        PCB_print("Process %d reaped child %d.\n", block->pid, pid);
+        return pid;
+    }
+    
+    block->waitingChild = true;
+    blockRunning(block, WAIT_OTHER);
+    armTimeout(block);
+    PCB_print("Process %d waits for a child to exit.\n", block->pid);
+    runNext();
+    return 0;
+}
+
+/*
+ * Kills a process and everything descended from it, each child before
+    its parent, in one walk down the tree
+ * Live children always follow the zombies, so the last child says if
+    there is a live one to go down to; a child killed waits as a zombie
+    until its parent dies just after and reaps it. The walk is linear
+    in the size of the subtree
+ * Returns the number of processes killed, 0 if pid does not exist
+ */
+int PCB_killTree(int pid) {
+    PCB* root = findPCB(pid);
+    
+    if(root == NULL) {
+        PCB_print("The entered process ID does not exist.\n");
+        return 0; // FAIL
+    }
+    
+    int killed = 0;
+    PCB* block = root;
+    for(;;) {
+        ILINK* last = block->children.last;
+        if(last != NULL && ILIST_ITEM(last, PCB, siblingLink)->state != ZOMBIE) {
+            block = ILIST_ITEM(last, PCB, siblingLink);
+            continue;
+        }
+        
+        PCB* parent = block->parent;
+        bool isRoot = block == root;
+        killPCB(block);
+        killed++;
+        if(isRoot)
+            break;
+        block = parent;
+    }
+    
+    PCB_print("Killed %d processes in the tree of %d.\n", killed, pid);
+    return killed;
+}
+
+/*
+ * Ends the quantum of the current CPU
+ */
+void cpuQuantum(void) {
     // Currently running process runs out of time
     // change the state to "READY"
     
-    Node* currentRunning = ListFirst(allJobs);
-    PCB* readyBlock = (PCB*) currentRunning->data;
-    int state = readyBlock->state;
+    PCB* readyBlock = runningPCB();
+    TRACE(TRACE_QUANTUM, readyBlock == NULL ? 0 : readyBlock->pid, RUNNING, RUNNING, currentCPU, 0, simClock.now);
     
-    while(state != RUNNING && currentRunning->next != NULL) {
-        currentRunning = currentRunning->next;
-        readyBlock = (PCB*) currentRunning->data;
-        state = readyBlock->state;
+    if(readyBlock != NULL) {
+        PCB_print("Process currently running:\n");
+        PCB_procInfo(readyBlock->pid);
+        
+        schedPolicy->on_tick(runQueueOf(readyBlock), &readyBlock->sched);
+        makeReady(readyBlock);
+        
+        PCB_print("This process has been removed from CPU. \nThe next process now running:\n");
     }
-    printf("Process currently running:\n");
-    PCB_procInfo(readyBlock->pid);
     
-    readyBlock->state = READY;
-    ListPrepend(readyJobs, readyBlock);
-    
-    printf("This process has been removed from CPU. \nThe next process now running:\n");
+    PCB* tmp = getNextReady();
+    if(readyBlock != NULL && tmp != readyBlock)
+        readyBlock->metrics.switches++;
+    if(tmp == NULL) {
+        PCB_print("No more ready jobs available.\n");
+        return;
+    }
     
-    // There will always be atleast one ready job (most recent one)
-    PCB* tmp = ListTrim(readyJobs);
-    tmp->state = RUNNING;
+    setState(tmp, RUNNING);
     PCB_procInfo(tmp->pid);
     
     return;
 }
 
-int PCBsend(int pid, char* msg) {
+void PCB_quantum(void) {
+    // The quantum ends on every CPU at once
+    for(int cpu=0; cpu<numCPUs; cpu++) {
+        cpus[cpu].ticks++;
+        if(cpus[cpu].running != NULL)
+            cpus[cpu].busyTicks++;
+    }
+    
+    int selected = currentCPU;
+    for(int cpu=0; cpu<numCPUs; cpu++) {
+        currentCPU = cpu;
+        if(numCPUs > 1)
+            PCB_print("CPU %d:\n", cpu);
+        cpuQuantum();
+    }
+    currentCPU = selected;
+    
+    return;
+}
+
+/*
+ * Makes later commands act on cpu
+ * Returns 1 for success, 0 if there is no such CPU
+ */
+int PCB_useCPU(int cpu) {
+    if(cpu < 0 || cpu >= numCPUs) {
+        PCB_print("There is no CPU %d. CPUs are numbered 0 to %d.\n", cpu, numCPUs - 1);
+        return 0; // FAIL
+    }
+    
+    currentCPU = cpu;
+    PCB_print("Commands now act on CPU %d.\n", cpu);
+    return 1;
+}
+
+/*
+ * Prints what each CPU runs, its queue length, utilisation and
+    migrations
+ */
+void PCB_cpuInfo(void) {
+    for(int i=0; i<numCPUs; i++) {
+        PCB_print("CPU %d%s: ", i, i == currentCPU ? " (current)" : "");
+        if(cpus[i].running != NULL)
+            PCB_print("running pid %d", cpus[i].running->pid);
+        else
+            PCB_print("idle");
+        PCB_print(", %d ready, %.1f%% busy over %ld quanta, %ld migrations",
+                  schedPolicy->count(cpus[i].runQueue),
+                  cpus[i].ticks == 0 ? 0.0 : 100.0 * cpus[i].busyTicks / cpus[i].ticks,
+                  cpus[i].ticks, cpus[i].migrations);
+        if(simClock.now > 0)
+            PCB_print(", %.1f%% busy over %llu ticks", 100.0 * cpus[i].busyTime / simClock.now, simClock.now);
+        PCB_print("\n");
+    }
+}
+
+/*
+ * Appends sBlock to the processes waiting for room in rBlock's mailbox
+ */
+void queueSender(PCB* rBlock, PCB* sBlock) {
+    sBlock->sendTarget = rBlock;
+    IListAppend(&rBlock->senders, &sBlock->waitLink);
+}
+
+/*
+ * Takes the longest waiting sender off rBlock's mailbox
+ * Returns NULL if no process is waiting
+ */
+PCB* dequeueSender(PCB* rBlock) {
+    ILINK* link = IListPop(&rBlock->senders);
+    if(link == NULL)
+        return NULL;
+    
+    PCB* sBlock = ILIST_ITEM(link, PCB, waitLink);
+    sBlock->sendTarget = NULL;
+    return sBlock;
+}
+
+/*
+ * Takes sBlock off the mailbox it is waiting on, if any
+ * Runs in O(1) time
+ */
+void unlinkSender(PCB* sBlock) {
+    PCB* rBlock = sBlock->sendTarget;
+    if(rBlock == NULL)
+        return;
+    
+    IListRemove(&rBlock->senders, &sBlock->waitLink);
+    sBlock->sendTarget = NULL;
+    MsgRelease(sBlock->outgoing);
+    sBlock->outgoing = NULL;
+}
+
+/*
+ * Puts msg in pid's mailbox on behalf of the running process
+ * The running process only blocks if the mailbox is full; it is woken
+    once the receiver has made room and the message is delivered
+ * Ownership of msg passes to PCBsend: it ends up with the receiver,
+    or is released if the send fails
+ */
+int PCBsend(int pid, MESSAGE* msg) {
     // pid is the id of receiving process
     
-    Node* receivingProc = ListFirst(allJobs);
-    PCB* rBlock = (PCB*) receivingProc->data;
-    int rid = rBlock->pid;
+    if(msg == NULL) {
+        PCB_print("Message too long or out of memory. Nothing sent.\n");
+        return 0; // FAIL
+    }
     
-    while(rid != pid) {
-        if(ListLast(allJobs) == receivingProc && rid != pid) {
-            printf("Cannot find receiving item.\n");
-            return 0;
-        }
-        receivingProc = receivingProc->next;
-        rBlock = (PCB*) receivingProc->data;
-        rid = rBlock->pid;
+    PCB* rBlock = findPCB(pid);
+    
+    if(rBlock == NULL) {
+        PCB_print("The entered process ID does not exist.\n");
+        MsgRelease(msg);
+        return 0; // FAIL
     }
     
     // find the sending process;
     // sending process should be the one "RUNNING"
-    Node* sendingProc = ListFirst(allJobs);
-    PCB* sBlock = (PCB*) sendingProc->data;
-    int state = sBlock->state;
-    
-    while(state != RUNNING) {
-        if(sBlock->pid == ListCount(allJobs) && state != RUNNING) {
-            printf("Cannot find sending item.\n");
-            return 0;
-        }
-        
-        sendingProc = sendingProc->next;
-        sBlock = (PCB*) sendingProc->data;
-        state = sBlock->state;
-    }
+    PCB* sBlock = runningPCB();
     
-    ListPrepend(receiving, sBlock);
-    if(rBlock->state != BLOCKED) {
-        rBlock->proc_message = msg;
-        printf("Message received: %s", msg);
+    if(sBlock == NULL) {
+        PCB_print("No process running. No send possible.\n");
+        MsgRelease(msg);
+        return 0; // FAIL
     }
-    else {
-        if(rBlock->proc_message == NULL) {
-            rBlock->state = READY;
-            ListPrepend(readyJobs, rBlock);
-            printf("Receiuving job was blocked without a message.\nIt is now on ready queue.\n");
-            return 1;
+    TRACE(TRACE_SEND, sBlock->pid, RUNNING, RUNNING, sBlock->cpu, pid, simClock.now);
+    
+    if(MboxFull(&rBlock->mailbox)) {
+        // Nobody would ever make room in our own mailbox
+        if(rBlock == sBlock) {
+            PCB_print("Own mailbox is full. Nothing sent.\n");
+            MsgRelease(msg);
+            return 0; // FAIL
         }
+        
+        // Sender process is BLOCKED until the receiver makes room
+        sBlock->outgoing = msg;
+        queueSender(rBlock, sBlock);
+        blockRunning(sBlock, WAIT_IPC);
+        armTimeout(sBlock);
+        PCB_print("Mailbox of process %d is full.\nSending process is now blocked until there is room.\n", pid);
+        PCB_procInfo(sBlock->pid);
+        detectDeadlock(sBlock);
+        
+        runNext();
+        return 1;
     }
     
-    // Sender process is BLOCKED
-    sBlock->state = BLOCKED;
-    printf("Sending process is now blocked until it gets a reply.\n");
-    PCB_procInfo(sBlock->pid);
-    ListAppend(sending, sBlock);
+    // Hand the message over without copying it
+    MboxPut(&rBlock->mailbox, msg);
+    syncMail(rBlock);
+    PCB_print("Message sent: %s", msg->text);
     
-    if(ListCount(readyJobs) > 0) {
-        PCB* nextJob = getNextReady();
-        nextJob->state = RUNNING;
-        printf("Next ready job is running.\n");
-    } else {
-        printf("No more ready jobs available.\n");
+    if(rBlock->receiving) {
+        rBlock->receiving = false;
+        wakeUp(rBlock);
+        PCB_print("\nReceiving job was blocked without a message.\nIt is now on ready queue.\n");
     }
     
     return 1;
@@ -327,179 +1288,1011 @@ int PCBsend(int pid, char* msg) {
 
 void PCB_receive(void) {
     // find the currently executing process
-    Node* process = ListFirst(allJobs);
-    PCB* rBlock = (PCB*) process->data;
-    int state = rBlock->state;
-    
-    while(state != RUNNING) {
-        if(rBlock->pid == ListCount(allJobs)) {
-            printf("No process running. No receive possible.\n");
-            return;
-        }
-        
-        process = process->next;
-        rBlock = (PCB*) process->data;
-        state = rBlock->state;
+    PCB* rBlock = runningPCB();
+    
+    if(rBlock == NULL) {
+        PCB_print("No process running. No receive possible.\n");
+        return;
     }
+    TRACE(TRACE_RECEIVE, rBlock->pid, RUNNING, RUNNING, rBlock->cpu, 0, simClock.now);
     
-    if(rBlock->proc_message == NULL) {
-        rBlock->state = BLOCKED;
-        if(process->next != NULL) {
-            rBlock = (PCB*) process->next->data;
-            rBlock->state = RUNNING;
-            return;
-        }
+    MESSAGE* msg = MboxTake(&rBlock->mailbox);
+    
+    if(msg == NULL) {
+        rBlock->receiving = true;
+        blockRunning(rBlock, WAIT_IPC);
+        armTimeout(rBlock);
+        runNext();
+        return;
     }
-    else {
-        printf("Message received\n");
+    
+    // The message is consumed and goes back to the pool
+    PCB_print("Message received: %s\n", msg->text);
+    MsgRelease(msg);
+    syncMail(rBlock);
+    
+    // The freed slot goes to the longest waiting sender
+    PCB* sBlock = dequeueSender(rBlock);
+    if(sBlock != NULL) {
+        MboxPut(&rBlock->mailbox, sBlock->outgoing);
+        sBlock->outgoing = NULL;
+        syncMail(rBlock);
+        wakeUp(sBlock);
     }
     
     return;
 }
 
-int PCB_reply(int pid, char* msg) {
+/*
+ * Puts msg in pid's mailbox, unblocking pid if it waits in receive
+ * Unlike PCBsend this never blocks: with a full mailbox the reply fails
+ * Ownership of msg passes to PCB_reply like it does for PCBsend
+ */
+int PCB_reply(int pid, MESSAGE* msg) {
+    if(msg == NULL) {
+        PCB_print("Message too long or out of memory. No reply sent.\n");
+        return 0; // FAIL
+    }
+    
     // find process with pid (sender)
-    Node* sendingProc = ListFirst(allJobs);
-    PCB* sBlock = (PCB*) sendingProc->data;
-    int sid = sBlock->pid;
+    PCB* sBlock = findPCB(pid);
     
-    while(sid != pid) {
-        if(ListLast(allJobs) == sendingProc && sid != pid) {
-            return 0;
-        }
-        sendingProc = sendingProc->next;
-        sBlock = (PCB*) sendingProc->data;
-        sid = sBlock->pid;
+    if(sBlock == NULL) {
+        PCB_print("The entered process ID does not exist.\n");
+        MsgRelease(msg);
+        return 0; // FAIL
+    }
+    if(traceEnabled) {
+        PCB* replier = runningPCB();
+        TraceEmit(TRACE_REPLY, replier == NULL ? 0 : replier->pid, sBlock->state, sBlock->state,
+                  currentCPU, pid, simClock.now);
     }
     
-    sBlock->state = READY;
-    sBlock->proc_message = msg;
+    if(MboxPut(&sBlock->mailbox, msg) != 0) {
+        PCB_print("Mailbox of process %d is full. No reply sent.\n", pid);
+        MsgRelease(msg);
+        return 0; // FAIL
+    }
+    syncMail(sBlock);
+    
+    // Unblock a process waiting for the reply; others find it in their mailbox
+    if(sBlock->receiving) {
+        sBlock->receiving = false;
+        wakeUp(sBlock);
+        runNext();
+    }
     
     return 1;
 }
 
-int PCB_newSemaphore(int semaphoreID, int initialValue) {
-    SEMAPHORE* sem = (SEMAPHORE*)malloc(sizeof(SEMAPHORE));
-    // No processes waiting initially
-    sem->waiting = NULL;
+/*
+ * Returns the semaphore with the given id, NULL if there is none
+ * Runs in O(1) time
+ */
+SEMAPHORE* findSemaphore(int semaphoreID) {
+    if(semaphoreID < 0 || semaphoreID >= semaphoreTableSize || !semaphores[semaphoreID].inUse)
+        return NULL;
+    return &semaphores[semaphoreID];
+}
+
+/*
+ * Returns the lowest id no semaphore uses yet
+ */
+int nextSemaphoreID(void) {
+    int id = 0;
+    while(id < semaphoreTableSize && semaphores[id].inUse)
+        id++;
+    return id;
+}
+
+/*
+ * Takes a process off the wait queue of the semaphore it is blocked on,
+    giving its claim on the semaphore back
+ * Runs in O(1) time
+ */
+void unlinkWaiter(PCB* block) {
+    if(block->waitingOn < 0)
+        return;
+    
+    SEMAPHORE* sem = &semaphores[block->waitingOn];
+    IListRemove(&sem->waiters, &block->waitLink);
+    sem->value++;
+    block->waitingOn = -1;
+}
+
+/*
+ * Grows the semaphore table to hold semaphoreID, doubling it like the
+    pid index
+ * returns 0 for success, -1 for failure
+ */
+int growSemaphores(int semaphoreID) {
+    if(semaphoreID < semaphoreTableSize)
+        return 0;
+    
+    int size = semaphoreTableSize == 0 ? 16 : semaphoreTableSize;
+    while(size <= semaphoreID)
+        size *= 2;
+    
+    SEMAPHORE* grown = realloc(semaphores, size * sizeof(SEMAPHORE));
+    if(grown == NULL)
+        return -1;
+    memset(grown + semaphoreTableSize, 0, (size - semaphoreTableSize) * sizeof(SEMAPHORE));
+    semaphores = grown;
+    semaphoreTableSize = size;
+    return 0;
+}
+
+/*
+ * Puts a semaphore in use with no processes waiting or holding it
+ */
+void initSemaphore(SEMAPHORE* sem, int initialValue) {
     sem->value = initialValue;
-    LIST* newSemaphore = NULL;
+    sem->inUse = true;
+    IListInit(&sem->waiters);
+    IListInit(&sem->holders);
+    sem->deadlockedWaiters = 0;
+    sem->deadlockMark = 0;
+    sem->deadlockSearch = 0;
+    semaphoreCount++;
+}
+
+int PCB_newSemaphore(int semaphoreID, int initialValue) {
+    if(semaphoreID < 0 || semaphoreID >= MAX_SEMAPHORES) {
+        PCB_print("Semaphore id out of bounds\n");
+        return 0; // FAIL
+    }
+    
+    if(growSemaphores(semaphoreID) != 0) {
+        PCB_print("Out of memory. Semaphore not created.\n");
+        return 0; // FAIL
+    }
     
-    if(!semaphores[semaphoreID].isFree) {
+    SEMAPHORE* sem = &semaphores[semaphoreID];
+    if(sem->inUse) {
         // Fail case
-        printf("Failed to create a new semaphore. One already exists at position: %d\n", semaphoreID);
+        PCB_print("Failed to create a new semaphore. One already exists at position: %d\n", semaphoreID);
         return 0;
-    } else {
-        newSemaphore = &semaphores[semaphoreID];
-        semaphores[semaphoreID].isFree = 0;
-        ListAppend(newSemaphore, sem);
-        printf("Semaphore ID: %d\n", semaphoreID);
-        printf("Semaphore initial value: %d\n", initialValue);
     }
     
+    // No processes waiting initially
+    initSemaphore(sem, initialValue);
+    
+    PCB_print("Semaphore ID: %d\n", semaphoreID);
+    PCB_print("Semaphore initial value: %d\n", initialValue);
+    
     return 1;
 }
 
 int PCB_semaphoreP(int semaphoreID) {
-    if(semaphoreID>4) {
-        printf("Semaphore id out of bounds\n");
-        // Fail
-        return 0;
-    } else if(semaphores[semaphoreID].isFree) {
+    SEMAPHORE* sem = findSemaphore(semaphoreID);
+    
+    if(sem == NULL) {
+        PCB_print("Semaphore id out of bounds\n");
         // Fail
         return 0;
     }
     
-    Node* head = semaphores[semaphoreID].first;
-    SEMAPHORE* sem = (SEMAPHORE*) head->data;
-    
     // Find the currently RUNNING process
-    Node* currentRunning = ListFirst(allJobs);
-    PCB* readyBlock = (PCB*) currentRunning->data;
-    int state = readyBlock->state;
+    PCB* readyBlock = runningPCB();
     
-    while(state != RUNNING) {
-        currentRunning = currentRunning->next;
-        readyBlock = (PCB*) currentRunning->data;
-        state = readyBlock->state;
+    if(readyBlock == NULL) {
+        PCB_print("No process running. No P operation possible.\n");
+        return 0; // FAIL
     }
+    TRACE(TRACE_SEM_P, readyBlock->pid, RUNNING, RUNNING, readyBlock->cpu, semaphoreID, simClock.now);
     
-    if(sem->value > 0) {
-        sem->value -= 1;
+    sem->value -= 1;
+    if(sem->value >= 0) {
+        addHold(readyBlock, semaphoreID);
         return 1;
-    } else {
-        // Add process to waiting queue
-        ListPrepend(sem->waiting, readyBlock);
-        readyBlock->state = BLOCKED;
     }
     
+    // Add process to the back of the waiting queue
+    readyBlock->waitingOn = semaphoreID;
+    IListAppend(&sem->waiters, &readyBlock->waitLink);
+    
+    blockRunning(readyBlock, WAIT_SEMAPHORE);
+    armTimeout(readyBlock);
+    PCB_print("Process %d is blocked on semaphore %d.\n", readyBlock->pid, semaphoreID);
+    detectDeadlock(readyBlock);
+    runNext();
+    
     return 2;
 }
 
 int PCB_semaphoreV(int semaphoreID) {
-    if(semaphoreID>4) {
-        printf("Semaphore id out of bounds\n");
-        // Fail
-        return 0;
-    } else if(semaphores[semaphoreID].isFree) {
+    SEMAPHORE* sem = findSemaphore(semaphoreID);
+    
+    if(sem == NULL) {
+        PCB_print("Semaphore id out of bounds\n");
         // Fail
         return 0;
     }
     
-    Node* head = semaphores[semaphoreID].first;
-    SEMAPHORE* sem = (SEMAPHORE*) head->data;
+    PCB* running = runningPCB();
+    TRACE(TRACE_SEM_V, running == NULL ? 0 : running->pid, RUNNING, RUNNING, currentCPU, semaphoreID, simClock.now);
+    if(running != NULL)
+        dropHold(running, semaphoreID);
     
     sem->value += 1;
-    if(sem->value <= 0) {
-        if(sem->waiting != NULL) {
-            PCB* receiveBlock = ListTrim(sem->waiting);
-            receiveBlock->state = READY;
-            ListPrepend(readyJobs, receiveBlock);
-        }
-    } else {
+    if(sem->value > 0) {
         return 1;
     }
     
+    // Wake the process that has waited longest; it got through its P.
+    // It stays counted on the semaphore until it is awake
+    PCB* receiveBlock = ILIST_ITEM(IListPop(&sem->waiters), PCB, waitLink);
+    addHold(receiveBlock, semaphoreID);
+    
+    wakeUp(receiveBlock);
+    receiveBlock->waitingOn = -1;
+    PCB_print("Process %d is woken up from semaphore %d.\n", receiveBlock->pid, semaphoreID);
+    runNext();
+    
     return 2;
 }
 
-void PCB_procInfo(int pid) {
-    Node* process = ListFirst(allJobs);
-    PCB* infoBlock = (PCB*) process->data;
-    int infoID = infoBlock->pid;
+/*
+ * Helper to return the hold of block on a semaphore, NULL if it has none
+ * Runs in time proportional to the semaphores block holds
+ */
+HOLD* findHold(PCB* block, int semaphoreID) {
+    for(ILINK* link = block->holds.first; link != NULL; link = link->next) {
+        HOLD* hold = ILIST_ITEM(link, HOLD, procLink);
+        if(hold->semaphoreID == semaphoreID)
+            return hold;
+    }
+    return NULL;
+}
+
+/*
+ * Counts a P that block got through on semaphoreID
+ */
+void addHold(PCB* block, int semaphoreID) {
+    HOLD* hold = findHold(block, semaphoreID);
+    if(hold == NULL) {
+        ILINK* link = IListPop(&freeHolds);
+        hold = link != NULL ? ILIST_ITEM(link, HOLD, semLink) : malloc(sizeof(HOLD));
+        if(hold == NULL)
+            return;     // Only the wait-for graph misses it
+        hold->block = block;
+        hold->semaphoreID = semaphoreID;
+        hold->count = 0;
+        IListAppend(&semaphores[semaphoreID].holders, &hold->semLink);
+        IListAppend(&block->holds, &hold->procLink);
+    }
+    hold->count++;
+}
+
+/*
+ * Helper to take a hold off both of its lists and keep it for reuse
+ */
+void freeHold(HOLD* hold) {
+    IListRemove(&semaphores[hold->semaphoreID].holders, &hold->semLink);
+    IListRemove(&hold->block->holds, &hold->procLink);
+    IListAppend(&freeHolds, &hold->semLink);
+}
+
+/*
+ * Matches a V by block on semaphoreID with one of its P operations,
+    if it has any left
+ */
+void dropHold(PCB* block, int semaphoreID) {
+    HOLD* hold = findHold(block, semaphoreID);
+    if(hold != NULL && --hold->count == 0)
+        freeHold(hold);
+}
+
+/*
+ * Helper to queue a process to be searched again
+ */
+void deadlockQueue(PCB* block) {
+    if(deadlockRecheckCount == deadlockRecheckCapacity) {
+        int size = deadlockRecheckCapacity == 0 ? 64 : deadlockRecheckCapacity * 2;
+        PCB** grown = realloc(deadlockRecheck, size * sizeof(PCB*));
+        if(grown == NULL)
+            return;     // It stays BLOCKED, the safe answer
+        deadlockRecheck = grown;
+        deadlockRecheckCapacity = size;
+    }
+    deadlockRecheck[deadlockRecheckCount++] = block;
+}
+
+/*
+ * Drops every hold of a process being killed. A process waiting on one
+    of those semaphores now waits on fewer holders, which may all be
+    stuck, so it is searched again
+ */
+void dropAllHolds(PCB* block) {
+    ILINK* link;
+    while((link = IListFirst(&block->holds)) != NULL) {
+        HOLD* hold = ILIST_ITEM(link, HOLD, procLink);
+        if(PCB_detectDeadlocks) {
+            ILIST* waiters = &semaphores[hold->semaphoreID].waiters;
+            for(ILINK* w = waiters->first; w != NULL; w = w->next)
+                deadlockQueue(ILIST_ITEM(w, PCB, waitLink));
+        }
+        freeHold(hold);
+    }
+}
+
+/*
+ * Helper that says whether a process could be deadlocked: it is
+    blocked waiting for other processes, with no timeout to end the wait
+ */
+bool deadlockCandidate(PCB* block) {
+    if(block->state != BLOCKED && block->state != DEADLOCKED)
+        return false;
+    if(TimerArmed(&block->timer))
+        return false;
+    return block->sendTarget != NULL ||
+           (block->waitingOn >= 0 && IListCount(&semaphores[block->waitingOn].holders) > 0);
+}
+
+/*
+ * Helper to add a process to the current search, reached from parent
+ * returns 0 for success, -1 for failure
+ */
+int deadlockPush(PCB* block, PCB* parent) {
+    if(deadlockNodeCount == deadlockNodeCapacity) {
+        int size = deadlockNodeCapacity == 0 ? 64 : deadlockNodeCapacity * 2;
+        PCB** grown = realloc(deadlockNodes, size * sizeof(PCB*));
+        if(grown == NULL)
+            return -1;
+        deadlockNodes = grown;
+        deadlockNodeCapacity = size;
+    }
+    block->deadlockMark = deadlockEpoch;
+    block->deadlockParent = parent;
+    deadlockNodes[deadlockNodeCount++] = block;
+    return 0;
+}
+
+/*
+ * Helper that follows the path an earlier search found from block to a
+    process that can run, as long as every step of it is still a wait;
+    each process is followed from once per search
+ * returns true if it still gets there
+ */
+bool deadlockEscapes(PCB* block) {
+    while(deadlockCandidate(block)) {
+        PCB* next = findHandle(block->deadlockEscape);
+        if(block->deadlockWalk == deadlockEpoch || next == NULL || next->state == DEADLOCKED)
+            return false;
+        if(block->sendTarget != NULL ? next != block->sendTarget : findHold(next, block->waitingOn) == NULL)
+            return false;
+        block->deadlockWalk = deadlockEpoch;
+        block = next;
+    }
+    return true;
+}
+
+/*
+ * Helper for a process the search reached from parent: a DEADLOCKED one
+    needs no search, and any other must be a candidate, with no path left
+    from an earlier search, to be searched in turn
+ * returns false if the process can still run, which ends the search;
+    the path to it is kept in deadlockEscape for the next search
+ */
+bool deadlockVisit(PCB* block, PCB* parent) {
+    if(block->deadlockMark == deadlockEpoch || block->state == DEADLOCKED)
+        return true;
+    if(deadlockCandidate(block) && !deadlockEscapes(block) && deadlockPush(block, parent) == 0)
+        return true;
     
-    // Check if pid is valid
-    while(infoID != pid && process->next != NULL) {
-        infoBlock = (PCB*) process->data;
-        infoID = infoBlock->pid;
+    for(PCB* next = block; parent != NULL; next = parent, parent = parent->deadlockParent)
+        parent->deadlockEscape = SlabHandle(next);
+    return false;
+}
+
+
+/*
+ * Helper to return the first process block waits for
+ */
+PCB* firstWaitedOn(PCB* block) {
+    if(block->sendTarget != NULL)
+        return block->sendTarget;
+    return ILIST_ITEM(IListFirst(&semaphores[block->waitingOn].holders), HOLD, semLink)->block;
+}
+
+/*
+ * Helper to print a cycle of the wait-for graph reached from start,
+    following the first process each one waits for, and whether start
+    is on it or only waits on it
+ */
+void printDeadlockCycle(PCB* start) {
+    deadlockEpoch++;
+    PCB* block = start;
+    while(block->deadlockMark != deadlockEpoch) {
+        block->deadlockMark = deadlockEpoch;
+        block = firstWaitedOn(block);
+    }
+    
+    PCB* first = block;
+    if(first == start)
+        PCB_print("Deadlock detected: %d", first->pid);
+    else
+        PCB_print("Process %d is deadlocked, waiting on the cycle %d", start->pid, first->pid);
+    do {
+        block = firstWaitedOn(block);
+        PCB_print(" -> %d", block->pid);
+    } while(block != first);
+    PCB_print("\n");
+}
+
+/*
+ * Helper that marks the processes found by the search DEADLOCKED and
+    queues the blocked processes waiting on them, which may now be
+    deadlocked too
+ */
+void markDeadlocked(void) {
+    for(int i=0; i<deadlockNodeCount; i++) {
+        PCB* block = deadlockNodes[i];
+        setState(block, DEADLOCKED);
+        
+        for(ILINK* link = block->senders.first; link != NULL; link = link->next) {
+            PCB* sender = ILIST_ITEM(link, PCB, waitLink);
+            if(sender->state == BLOCKED)
+                deadlockQueue(sender);
+        }
+        
+        for(ILINK* link = block->holds.first; link != NULL; link = link->next) {
+            SEMAPHORE* sem = &semaphores[ILIST_ITEM(link, HOLD, procLink)->semaphoreID];
+            if(sem->deadlockMark == deadlockEpoch)
+                continue;   // Another holder queued its waiters already
+            sem->deadlockMark = deadlockEpoch;
+            for(ILINK* w = sem->waiters.first; w != NULL; w = w->next) {
+                PCB* waiter = ILIST_ITEM(w, PCB, waitLink);
+                if(waiter->state == BLOCKED)
+                    deadlockQueue(waiter);
+            }
+        }
+    }
+}
+
+/*
+ * Helper for detectDeadlock: searches from one process and marks what
+    it finds if nothing found can run
+ */
+void searchDeadlock(PCB* start) {
+    if(start->state != BLOCKED || !deadlockCandidate(start))
+        return;
+    
+    deadlockEpoch++;
+    deadlockNodeCount = 0;
+    if(deadlockEscapes(start) || deadlockPush(start, NULL) != 0)
+        return;
+    
+    for(int i=0; i<deadlockNodeCount; i++) {
+        PCB* block = deadlockNodes[i];
+        if(block->sendTarget != NULL) {
+            if(!deadlockVisit(block->sendTarget, block))
+                return;
+            continue;
+        }
         
-        if(infoID != pid && process == allJobs->last) {
-            printf("Invalid pid entered!\n");
-            return; // FAIL
+        // Waiters on the same semaphore wait for the same holders
+        SEMAPHORE* sem = &semaphores[block->waitingOn];
+        if(sem->deadlockSearch == deadlockEpoch)
+            continue;
+        sem->deadlockSearch = deadlockEpoch;
+        for(ILINK* link = sem->holders.first; link != NULL; link = link->next) {
+            if(!deadlockVisit(ILIST_ITEM(link, HOLD, semLink)->block, block))
+                return;
+        }
+    }
+    
+    printDeadlockCycle(start);
+    markDeadlocked();
+}
+
+/*
+ * Searches the processes start waits for, directly or not. If none of
+    them can ever run again they are deadlocked, along with start: marks
+    them DEADLOCKED and reports the cycle. The processes waiting on them
+    are searched in turn
+ * Each search covers only processes reachable from where it starts, and
+    ends at the first one that can still run
+ * returns the number of processes marked
+ */
+int detectDeadlock(PCB* start) {
+    if(!PCB_detectDeadlocks)
+        return 0;
+    
+    int before = deadlockedCount;
+    deadlockDeferBegin();
+    deadlockQueue(start);
+    deadlockDeferEnd();
+    
+    if(deadlockedCount > before) {
+        deadlocksFound++;
+        PCB_print("Processes deadlocked now: %d\n", deadlockedCount);
+    }
+    return deadlockedCount - before;
+}
+
+/*
+ * Makes the DEADLOCKED processes that wait on block, directly or not,
+    BLOCKED again, since block is about to run or go away; block itself
+    is left to the caller
+ * If block runs they can reach it and are not deadlocked. If it goes
+    away they may still be, through other processes, so recheck queues
+    them to be searched again
+ */
+void releaseDeadlocked(PCB* block, bool recheck) {
+    if(deadlockedCount == 0)
+        return;
+    
+    // The processes released are the queue for walking on, and are taken
+    // off it again unless they are to be searched
+    int first = deadlockRecheckCount;
+    PCB* next = block;
+    for(int i=first; next != NULL; next = i < deadlockRecheckCount ? deadlockRecheck[i++] : NULL) {
+        for(ILINK* link = next->senders.first; link != NULL && next->deadlockedSenders > 0; link = link->next) {
+            PCB* sender = ILIST_ITEM(link, PCB, waitLink);
+            if(sender->state == DEADLOCKED && sender != block) {
+                setState(sender, BLOCKED);
+                deadlockQueue(sender);
+            }
         }
         
-        process = process->next;
+        for(ILINK* link = next->holds.first; link != NULL; link = link->next) {
+            SEMAPHORE* sem = &semaphores[ILIST_ITEM(link, HOLD, procLink)->semaphoreID];
+            for(ILINK* w = sem->waiters.first; w != NULL && sem->deadlockedWaiters > 0; w = w->next) {
+                PCB* waiter = ILIST_ITEM(w, PCB, waitLink);
+                if(waiter->state == DEADLOCKED && waiter != block) {
+                    setState(waiter, BLOCKED);
+                    deadlockQueue(waiter);
+                }
+            }
+        }
+    }
+    if(!recheck)
+        deadlockRecheckCount = first;
+}
+
+void deadlockDeferBegin(void) {
+    deadlockDefer++;
+}
+
+/*
+ * Searches the queued processes again once the outermost operation
+    that queued them is done
+ */
+void deadlockDeferEnd(void) {
+    if(--deadlockDefer > 0)
+        return;
+    
+    deadlockDefer++;    // Searching only marks, but keep it from nesting
+    while(deadlockRecheckCount > 0) {
+        PCB* block = deadlockRecheck[--deadlockRecheckCount];
+        if(PCB_detectDeadlocks)
+            searchDeadlock(block);
+    }
+    deadlockDefer--;
+}
+
+/*
+ * Charges a running process for the ticks since it was dispatched or
+    last charged, against its burst, its work and its CPU
+ */
+void chargeCPU(PCB* block) {
+    unsigned long long elapsed = simClock.now - block->dispatched;
+    block->dispatched = simClock.now;
+    block->cpuTime += elapsed;
+    if(block->cpu >= 0)
+        cpus[block->cpu].busyTime += elapsed;
+    if(block->cpuBurst > 0) {
+        block->burstLeft -= (long) elapsed;
+        block->workLeft -= (long) elapsed;
+    }
+}
+
+/*
+ * Arms the timer ending the CPU burst of a running profiled process
+ */
+void startBurst(PCB* block) {
+    if(block->cpuBurst <= 0 || block->state != RUNNING)
+        return;
+    
+    long delay = block->burstLeft < block->workLeft ? block->burstLeft : block->workLeft;
+    armProcessTimer(block, burstDone, delay < 0 ? 0 : delay);
+}
+
+/*
+ * Arms the process's timer to call fire delay ticks from now,
+    replacing whatever it was armed for
+ */
+void armProcessTimer(PCB* block, void (*fire)(TIMER* timer), long delay) {
+    cancelProcessTimer(block);
+    block->timer.fire = fire;
+    TWAdd(&simClock, &block->timer, simClock.now + delay);
+    armedProcessTimers++;
+}
+
+void cancelProcessTimer(PCB* block) {
+    if(TWCancel(&simClock, &block->timer))
+        armedProcessTimers--;
+}
+
+/*
+ * Bounds the wait of a process that just blocked in a send, receive
+    or P by blockTimeout, if one is set
+ */
+void armTimeout(PCB* block) {
+    if(blockTimeout > 0)
+        armProcessTimer(block, waitTimedOut, blockTimeout);
+}
+
+/*
+ * Helper to get the process a fired timer belongs to, which also
+    counts the timer as no longer armed
+ */
+PCB* timerOwner(TIMER* timer) {
+    armedProcessTimers--;
+    return TIMER_ITEM(timer, PCB, timer);
+}
+
+/*
+ * Timer event: the quantum of a CPU ran out
+ */
+void quantumExpired(TIMER* timer) {
+    CPU* cpu = TIMER_ITEM(timer, CPU, quantumTimer);
+    int selected = currentCPU;
+    
+    currentCPU = (int)(cpu - cpus);
+    cpu->ticks++;
+    cpu->busyTicks++;
+    PCB_print("Time %llu: quantum of CPU %d expired.\n", simClock.now, currentCPU);
+    cpuQuantum();
+    currentCPU = selected;
+}
+
+/*
+ * Timer event: a profiled process finished its CPU burst, and goes on
+    to IO or exits once its work is done
+ */
+void burstDone(TIMER* timer) {
+    PCB* block = timerOwner(timer);
+    int selected = currentCPU;
+    
+    currentCPU = block->cpu;
+    chargeCPU(block);
+    block->burstLeft = block->cpuBurst;
+    
+    if(block->workLeft <= 0) {
+        PCB_print("Time %llu: process %d finished its work.\n", simClock.now, block->pid);
+        killPCB(block);
+    } else if(block->ioBurst > 0) {
+        PCB_print("Time %llu: process %d starts %d ticks of IO.\n", simClock.now, block->pid, block->ioBurst);
+        blockRunning(block, WAIT_TIMER);
+        armProcessTimer(block, waitDone, block->ioBurst);
+        runNext();
+    } else {
+        startBurst(block);
+    }
+    currentCPU = selected;
+}
+
+/*
+ * Timer event: the IO or sleep of a process is over
+ */
+void waitDone(TIMER* timer) {
+    PCB* block = timerOwner(timer);
+    int selected = currentCPU;
+    
+    currentCPU = block->homeCPU;
+    PCB_print("Time %llu: process %d is done waiting.\n", simClock.now, block->pid);
+    wakeUp(block);
+    runNext();
+    currentCPU = selected;
+}
+
+/*
+ * Timer event: a blocked send, receive, P or wait waited blockTimeout ticks
+ * The wait is called off, so the message is dropped or the claim on
+    the semaphore given back
+ */
+void waitTimedOut(TIMER* timer) {
+    PCB* block = timerOwner(timer);
+    int selected = currentCPU;
+    
+    unlinkSender(block);
+    block->receiving = false;
+    block->waitingChild = false;
+    unlinkWaiter(block);
+    
+    currentCPU = block->homeCPU;
+    PCB_print("Time %llu: process %d timed out waiting.\n", simClock.now, block->pid);
+    wakeUp(block);
+    runNext();
+    currentCPU = selected;
+}
+
+/*
+ * Creates a process that runs on its own: it alternates bursts of
+    cpuBurst ticks of CPU and ioBurst ticks of IO, and exits once it
+    has had work ticks of CPU
+ * Returns its pid, 0 for failure
+ */
+int PCB_createJob(int priority, int cpuBurst, int ioBurst, long work) {
+    if(cpuBurst <= 0 || ioBurst < 0 || work <= 0) {
+        PCB_print("Bursts and work must be positive. Process not created.\n");
+        return 0; // FAIL
     }
     
-    printf("Selected process:\n");
-    printf("PID: %d, Priority: %d, State: %d \n", infoBlock->pid, infoBlock->priority, infoBlock->state);
+    int pid = create(priority);
+    PCB* block = findPCB(pid);
+    if(block == NULL)
+        return 0; // FAIL
+    
+    // create may have made it RUNNING already; charge from here
+    block->dispatched = simClock.now;
+    block->cpuBurst = cpuBurst;
+    block->ioBurst = ioBurst;
+    block->burstLeft = cpuBurst;
+    block->workLeft = work;
+    profiledJobs++;
+    if(block->state == READY)
+        readyProfiled++;
+    startBurst(block);
+    
+    return pid;
+}
+
+/*
+ * Blocks the running process for ticks of simulated time
+ * Returns 1 for success, 0 for failure
+ */
+int PCB_sleep(int ticks) {
+    PCB* block = runningPCB();
+    
+    if(block == NULL) {
+        PCB_print("No process running. Nothing to put to sleep.\n");
+        return 0; // FAIL
+    }
+    if(ticks <= 0) {
+        PCB_print("Sleep time must be positive.\n");
+        return 0; // FAIL
+    }
+    
+    blockRunning(block, WAIT_TIMER);
+    armProcessTimer(block, waitDone, ticks);
+    PCB_print("Process %d sleeps until time %llu.\n", block->pid, simClock.now + ticks);
+    runNext();
+    
+    return 1;
+}
+
+/*
+ * Sets how many ticks later blocking sends, receives and Ps give up,
+    0 to wait forever
+ * Applies to waits that start afterwards
+ */
+void PCB_setTimeout(int ticks) {
+    blockTimeout = ticks < 0 ? 0 : ticks;
+    if(blockTimeout > 0)
+        PCB_print("Blocking operations now time out after %d ticks.\n", blockTimeout);
+    else
+        PCB_print("Blocking operations now wait forever.\n");
+}
+
+/*
+ * Moves the simulated clock ticks forward, running every event due
+ * With ticks 0 the clock runs until every profiled process has exited,
+    or until none can get anywhere without another command
+ * Returns the number of events run
+ */
+long PCB_advance(long ticks) {
+    long fired = simClock.fired;
+    
+    if(ticks > 0) {
+        TWAdvance(&simClock, simClock.now + ticks);
+    } else {
+        // With no profiled process running or waiting on a timer, only
+        // quantum expiries move the clock; give up once every process
+        // could have had a quantum, since a strict policy may starve
+        // them for good
+        int turns = IListCount(&allJobs) / numCPUs + 1;
+        int waited = 0;
+        while(profiledJobs > 0 && (armedProcessTimers > 0 || readyProfiled > 0) &&
+              waited <= turns && TWStep(&simClock, ~0ULL)) {
+            waited = armedProcessTimers > 0 ? 0 : waited + 1;
+        }
+    }
+    
+    fired = simClock.fired - fired;
+    PCB_print("Time is now %llu, %ld events ran.\n", simClock.now, fired);
+    return fired;
+}
+
+void PCB_procInfo(int pid) {
+    PCB* infoBlock = findPCB(pid);
+    
+    // Check if pid is valid
+    if(infoBlock == NULL) {
+        PCB_print("The entered process ID does not exist.\n");
+        return; // FAIL
+    }
+    
+    PCB_print("Selected process:\n");
+    PCB_print("PID: %d, Priority: %d, State: %d \n", infoBlock->pid, infoBlock->priority, infoBlock->state);
+    if(infoBlock->cpuBurst > 0)
+        PCB_print("CPU burst: %d, IO burst: %d, CPU time: %llu, Work left: %ld\n",
+                  infoBlock->cpuBurst, infoBlock->ioBurst, infoBlock->cpuTime, infoBlock->workLeft);
+    if(infoBlock->parent != NULL || IListCount(&infoBlock->children) > 0)
+        PCB_print("Parent: %d, Children: %d, Zombies: %d\n", infoBlock->parent == NULL ? 0 : infoBlock->parent->pid,
+                  IListCount(&infoBlock->children), infoBlock->zombieChildren);
     
     return;
 }
 
 void PCB_totalInfo(void) {
-    Node* process = ListFirst(allJobs);
-    PCB* block;
+    PCB_print("Displaying all Jobs:\n");
     
-    printf("Displaying all Jobs:\n");
+    // Walk the table's columns rather than the PCBs themselves
+    for(int slot=0; slot<procTable.used; slot++) {
+        if(procTable.state[slot] == PT_FREE)
+            continue;
+        PCB_print("PID: %d, Priority: %d, State: %d \n",
+                  procTable.pid[slot], procTable.priority[slot], procTable.state[slot]);
+    }
     
-    while(process != NULL) {
-        
-        block = (PCB*) process->data;
-        printf("PID: %d, Priority: %d, State: %d \n", block->pid, block->priority, block->state);
-        process = process->next;
+    PCB_print("Running: %d, Ready: %d, Blocked: %d, Deadlocked: %d\n",
+              PTCountState(&procTable, RUNNING), PTCountState(&procTable, READY),
+              PTCountState(&procTable, BLOCKED), PTCountState(&procTable, DEADLOCKED));
+    if(simClock.now > 0)
+        PCB_print("Time: %llu ticks, %d timers armed\n", simClock.now, simClock.count);
+    if(numCPUs > 1)
+        PCB_cpuInfo();
+    
+    return;
+}
 
+/*
+ * Prints the pids of every process in the given state
+ */
+void PCB_listState(int state) {
+    int count = PTCountState(&procTable, state);
+    PCB_print("Processes in state %d: %d\n", state, count);
+    if(count == 0)
+        return;
+    
+    int* slots = malloc(count * sizeof(int));
+    if(slots == NULL) {
+        PCB_print("Out of memory. Cannot list the processes.\n");
+        return;
+    }
+    
+    count = PTFilter(&procTable, state, PT_ANY, slots, count);
+    for(int i=0; i<count; i++) {
+        PCB_print("%d%s", procTable.pid[slots[i]], i+1 < count ? " " : "\n");
     }
     
+    free(slots);
     return;
 }
+
+/*
+ * Summarises the metrics of a process that is exiting, and keeps them
+    whole if PCB_keepExits is set
+ * Its time in the last state must already be charged
+ */
+void recordExit(PCB* block) {
+    PROC_METRICS* m = &block->metrics;
+    HistAdd(&turnaroundHist, simClock.now - m->created);
+    HistAdd(&waitingHist, m->stateTime[READY + 1]);
+    HistAdd(&blockedHist, m->stateTime[BLOCKED + 1]);
+    exitedJobs++;
+    
+    if(!PCB_keepExits)
+        return;
+    if(exitRecordCount == exitRecordCapacity) {
+        int capacity = exitRecordCapacity == 0 ? 64 : exitRecordCapacity * 2;
+        EXIT_RECORD* grown = realloc(exitRecords, capacity * sizeof(EXIT_RECORD));
+        if(grown == NULL)
+            return;     // Only the histograms keep this one
+        exitRecords = grown;
+        exitRecordCapacity = capacity;
+    }
+    
+    EXIT_RECORD* record = &exitRecords[exitRecordCount++];
+    record->pid = block->pid;
+    record->priority = block->priority;
+    record->exited = simClock.now;
+    record->metrics = *m;
+}
+
+/*
+ * Helper to write the metrics of one process, live or exited
+ * state is its current state for a live process; for an exited one it
+    is ignored and exited is the exit time
+ */
+void writeProcMetrics(FILE* f, bool csv, bool first, int pid, int priority, int state,
+                      bool live, unsigned long long exited, PROC_METRICS* m) {
+    // A live process has not been charged for its current state yet
+    PROC_METRICS now = *m;
+    if(live)
+        MetricsState(&now, state, state == BLOCKED, simClock.now);
+    unsigned long long end = live ? simClock.now : exited;
+    
+    if(csv) {
+        fprintf(f, "%d,%d,%s,%llu,", pid, priority,
+                !live ? "exited" : state == RUNNING ? "running" : state == READY ? "ready" :
+                state == BLOCKED ? "blocked" : "deadlocked", now.created);
+        if(live)
+            fprintf(f, ",");
+        else
+            fprintf(f, "%llu,", exited);
+        fprintf(f, "%llu,%lld,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%ld,%ld\n",
+                end - now.created, now.response,
+                now.stateTime[RUNNING + 1], now.stateTime[READY + 1],
+                now.stateTime[BLOCKED + 1], now.stateTime[DEADLOCKED + 1],
+                now.waitTime[WAIT_IPC], now.waitTime[WAIT_SEMAPHORE], now.waitTime[WAIT_TIMER],
+                now.dispatches, now.switches);
+        return;
+    }
+    
+    fprintf(f, "%s    {\"pid\": %d, \"priority\": %d, \"state\": %d, \"created\": %llu, ",
+            first ? "" : ",\n", pid, priority, live ? state : EXITED, now.created);
+    if(live)
+        fprintf(f, "\"exited\": null, ");
+    else
+        fprintf(f, "\"exited\": %llu, ", exited);
+    fprintf(f, "\"turnaround\": %llu, \"response\": %lld, \"running\": %llu, \"ready\": %llu, "
+               "\"blocked\": %llu, \"deadlocked\": %llu, \"ipc_wait\": %llu, "
+               "\"semaphore_wait\": %llu, \"timer_wait\": %llu, \"dispatches\": %ld, \"switches\": %ld}",
+            end - now.created, now.response,
+            now.stateTime[RUNNING + 1], now.stateTime[READY + 1],
+            now.stateTime[BLOCKED + 1], now.stateTime[DEADLOCKED + 1],
+            now.waitTime[WAIT_IPC], now.waitTime[WAIT_SEMAPHORE], now.waitTime[WAIT_TIMER],
+            now.dispatches, now.switches);
+}
+
+/*
+ * Writes the metrics of every process, exited ones first, as CSV (one
+    row per process) or as JSON together with the per-CPU counters and
+    the histograms over exited processes
+ */
+void PCB_writeMetrics(FILE* f, bool csv) {
+    bool first = true;
+    
+    if(csv) {
+        fprintf(f, "pid,priority,state,created,exited,turnaround,response,running,ready,blocked,"
+                   "deadlocked,ipc_wait,semaphore_wait,timer_wait,dispatches,switches\n");
+    } else {
+        fprintf(f, "{\n  \"time\": %llu,\n  \"policy\": \"%s\",\n  \"cpus\": [\n",
+                simClock.now, schedPolicy->name);
+        for(int i=0; i<numCPUs; i++) {
+            fprintf(f, "    {\"cpu\": %d, \"dispatches\": %ld, \"switches\": %ld, \"migrations\": %ld, "
+                       "\"quanta\": %ld, \"busy_ticks\": %llu}%s\n",
+                    i, cpus[i].dispatches, cpus[i].switches, cpus[i].migrations,
+                    cpus[i].ticks, cpus[i].busyTime, i+1 < numCPUs ? "," : "");
+        }
+        fprintf(f, "  ],\n  \"exited\": %ld,\n  \"turnaround\": ", exitedJobs);
+        HistWriteJSON(&turnaroundHist, f);
+        fprintf(f, ",\n  \"waiting\": ");
+        HistWriteJSON(&waitingHist, f);
+        fprintf(f, ",\n  \"blocked\": ");
+        HistWriteJSON(&blockedHist, f);
+        fprintf(f, ",\n  \"response\": ");
+        HistWriteJSON(&responseHist, f);
+        fprintf(f, ",\n  \"processes\": [\n");
+    }
+    
+    for(int i=0; i<exitRecordCount; i++) {
+        EXIT_RECORD* r = &exitRecords[i];
+        writeProcMetrics(f, csv, first, r->pid, r->priority, 0, false, r->exited, &r->metrics);
+        first = false;
+    }
+    for(ILINK* link = allJobs.first; link != NULL; link = link->next) {
+        PCB* block = ILIST_ITEM(link, PCB, jobLink);
+        writeProcMetrics(f, csv, first, block->pid, block->priority, block->state, true, 0, &block->metrics);
+        first = false;
+    }
+    
+    if(!csv)
+        fprintf(f, "%s  ]\n}\n", first ? "" : "\n");
+}
+
+#endif
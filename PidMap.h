@@ -0,0 +1,181 @@
+#ifndef PIDMAP_H
+#define PIDMAP_H
+
+#include<stdint.h>
+#include<stdlib.h>
+#include<string.h>
+
+// Process ID allocator: a bitmap with one bit per pid, like a kernel's
+// pidmap. Pids are handed out in increasing order from a cursor that
+// wraps around at pidMax, so a pid freed by an exit is not given out
+// again until the cursor comes back round to it; a stale pid someone
+// kept keeps failing instead of reaching a new process.
+// The search goes a 64-bit word at a time with ctz, and a second bitmap
+// with one bit per full word skips 4096 taken pids a step, so
+// allocation stays O(1) amortized even with millions of pids nearly
+// all taken. Both bitmaps grow as the cursor first reaches new pids.
+typedef struct {
+    uint64_t* used;     // Bit per pid, set while it is taken
+    uint64_t* full;     // Bit per word of used, set while all 64 are taken
+    int words;          // Words of used allocated
+    int pidMax;         // Pids run from 1 to pidMax - 1
+    int last;           // Last pid handed out, the search starts after it
+    int count;          // Pids taken
+} PIDMAP;
+
+// Default pidMax, override at compile time with -D
+#ifndef PID_MAX
+#define PID_MAX (1 << 22)
+#endif
+
+
+/*
+ * Make an empty map of the pids 1 .. pidMax - 1
+ */
+void PidMapInit(PIDMAP* map, int pidMax);
+
+
+/*
+ * Release both bitmaps, leaving the map empty
+ */
+void PidMapFree(PIDMAP* map);
+
+
+/*
+ * Takes the first free pid after the last one handed out, wrapping
+    around to 1
+ * returns the pid, 0 if every pid is taken or memory ran out
+ */
+int PidAlloc(PIDMAP* map);
+
+
+/*
+ * Takes a given pid, e.g. one restored from a snapshot
+ * returns 0 for success, -1 if it is out of range, taken already or
+    memory ran out
+ */
+int PidMark(PIDMAP* map, int pid);
+
+
+/*
+ * Gives a taken pid back, to be handed out once the cursor reaches it
+ */
+void PidFree(PIDMAP* map, int pid);
+
+//------------------------------------------------------------------------------------
+
+void PidMapInit(PIDMAP* map, int pidMax) {
+    memset(map, 0, sizeof(PIDMAP));
+    map->pidMax = pidMax < 2 ? 2 : pidMax;
+}
+
+void PidMapFree(PIDMAP* map) {
+    free(map->used);
+    free(map->full);
+    PidMapInit(map, map->pidMax);
+}
+
+/*
+ * Helper to make both bitmaps cover pid, doubling them as needed
+ * Returns 0 for success, -1 for failure
+ */
+int pidGrow(PIDMAP* map, int pid) {
+    if(pid / 64 < map->words)
+        return 0;
+
+    int words = map->words == 0 ? 64 : map->words;
+    while(words <= pid / 64)
+        words *= 2;
+    int fullWords = (words + 63) / 64;
+    int oldFullWords = (map->words + 63) / 64;
+
+    uint64_t* grown = realloc(map->used, words * sizeof(uint64_t));
+    if(grown == NULL)
+        return -1;
+    memset(grown + map->words, 0, (words - map->words) * sizeof(uint64_t));
+    map->used = grown;
+
+    grown = realloc(map->full, fullWords * sizeof(uint64_t));
+    if(grown == NULL)
+        return -1;  // used is bigger, but words still says the old size
+    memset(grown + oldFullWords, 0, (fullWords - oldFullWords) * sizeof(uint64_t));
+    map->full = grown;
+    map->words = words;
+    return 0;
+}
+
+/*
+ * Helper to find the first free pid at or after from
+ * Past the words allocated every pid is free, so it always finds one,
+    but it may be pidMax or more
+ */
+int pidFindFree(PIDMAP* map, int from) {
+    int word = from / 64;
+    if(word >= map->words)
+        return from;
+
+    // Rest of the word from is in
+    uint64_t open = ~map->used[word] & (~0ULL << (from & 63));
+    if(open != 0)
+        return word * 64 + __builtin_ctzll(open);
+
+    // Then the first word that is not full
+    for(word++; word < map->words; word = (word | 63) + 1) {
+        uint64_t notFull = ~map->full[word / 64] & (~0ULL << (word & 63));
+        if(notFull != 0) {
+            word = (word & ~63) + __builtin_ctzll(notFull);
+            if(word >= map->words)
+                break;
+            return word * 64 + __builtin_ctzll(~map->used[word]);
+        }
+    }
+    return map->words * 64;
+}
+
+/*
+ * Helper to set the bit of a free pid, and its word's bit once full
+ */
+void pidTake(PIDMAP* map, int pid) {
+    int word = pid / 64;
+    map->used[word] |= 1ULL << (pid & 63);
+    if(map->used[word] == ~0ULL)
+        map->full[word / 64] |= 1ULL << (word & 63);
+    map->count++;
+}
+
+int PidAlloc(PIDMAP* map) {
+    if(map->count >= map->pidMax - 1)
+        return 0;
+
+    int pid = pidFindFree(map, map->last + 1);
+    if(pid >= map->pidMax)
+        pid = pidFindFree(map, 1);
+    if(pid >= map->pidMax || pidGrow(map, pid) != 0)
+        return 0;
+
+    pidTake(map, pid);
+    map->last = pid;
+    return pid;
+}
+
+int PidMark(PIDMAP* map, int pid) {
+    if(pid <= 0 || pid >= map->pidMax || pidGrow(map, pid) != 0)
+        return -1;
+    if(map->used[pid / 64] & (1ULL << (pid & 63)))
+        return -1;
+
+    pidTake(map, pid);
+    return 0;
+}
+
+void PidFree(PIDMAP* map, int pid) {
+    if(pid <= 0 || pid / 64 >= map->words || !(map->used[pid / 64] & (1ULL << (pid & 63))))
+        return;
+
+    int word = pid / 64;
+    map->used[word] &= ~(1ULL << (pid & 63));
+    map->full[word / 64] &= ~(1ULL << (word & 63));
+    map->count--;
+}
+
+#endif
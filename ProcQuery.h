@@ -0,0 +1,268 @@
+#ifndef PROCQUERY_H
+#define PROCQUERY_H
+
+#include "ProcTable.h"
+
+// Queries over the state and priority columns of a PROCTABLE. Each query
+// has a scalar kernel and, on x86, SSE4.2 and AVX2 kernels that compare
+// 16 or 32 states (4 or 8 priorities) per instruction. The best kernels
+// the CPU supports are picked at run time on first use.
+
+// Matches any state or priority in PTFilter
+#define PT_ANY (-127)
+
+typedef struct {
+    const char* name;
+    int (*countState)(PROCTABLE* pt, int state);
+    int (*findState)(PROCTABLE* pt, int state, int from);
+    int (*filter)(PROCTABLE* pt, int state, int priority, int* slots, int max);
+} PT_KERNELS;
+
+
+/*
+ * returns the number of live processes in the given state
+ */
+int PTCountState(PROCTABLE* pt, int state);
+
+
+/*
+ * returns the first slot at or after from holding a process in the given
+    state, -1 if there is none
+ */
+int PTFindState(PROCTABLE* pt, int state, int from);
+
+
+/*
+ * Writes the slots of the live processes matching both state and
+    priority (either may be PT_ANY) to slots, in slot order
+ * At most max slots are written
+ * returns the number of slots written
+ */
+int PTFilter(PROCTABLE* pt, int state, int priority, int* slots, int max);
+
+
+/*
+ * returns the kernels in use, picking them on the first call
+ * Assign ptKernels to force a set, e.g. &ptScalarKernels
+ */
+PT_KERNELS* PTKernels(void);
+
+//------------------------------------------------------------------------------------
+
+// ---- Scalar kernels, used when no vector unit is available ----------------
+
+int ptCountScalar(PROCTABLE* pt, int state) {
+    int count = 0;
+    for(int i=0; i<pt->used; i++)
+        count += pt->state[i] == state;
+    return count;
+}
+
+int ptFindScalar(PROCTABLE* pt, int state, int from) {
+    for(int i = from < 0 ? 0 : from; i<pt->used; i++) {
+        if(pt->state[i] == state)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * Helper to test one slot against a PTFilter query
+ */
+int ptMatches(PROCTABLE* pt, int slot, int state, int priority) {
+    if(pt->state[slot] == PT_FREE)
+        return 0;
+    if(state != PT_ANY && pt->state[slot] != state)
+        return 0;
+    return priority == PT_ANY || pt->priority[slot] == priority;
+}
+
+int ptFilterScalar(PROCTABLE* pt, int state, int priority, int* slots, int max) {
+    int found = 0;
+    for(int i=0; i<pt->used && found < max; i++) {
+        if(ptMatches(pt, i, state, priority))
+            slots[found++] = i;
+    }
+    return found;
+}
+
+PT_KERNELS ptScalarKernels = {
+    "scalar", ptCountScalar, ptFindScalar, ptFilterScalar
+};
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include<immintrin.h>
+
+// ---- SSE4.2: 16 states or 4 priorities per compare ------------------------
+
+__attribute__((target("sse4.2,popcnt")))
+int ptCountSse42(PROCTABLE* pt, int state) {
+    __m128i want = _mm_set1_epi8((char) state);
+    int count = 0;
+    int i = 0;
+
+    for(; i+16 <= pt->used; i+=16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(pt->state + i));
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, want)));
+    }
+    for(; i<pt->used; i++)
+        count += pt->state[i] == state;
+    return count;
+}
+
+__attribute__((target("sse4.2,popcnt")))
+int ptFindSse42(PROCTABLE* pt, int state, int from) {
+    __m128i want = _mm_set1_epi8((char) state);
+    int i = from < 0 ? 0 : from;
+
+    for(; i+16 <= pt->used; i+=16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(pt->state + i));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, want));
+        if(mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return ptFindScalar(pt, state, i);
+}
+
+__attribute__((target("sse4.2,popcnt")))
+int ptFilterSse42(PROCTABLE* pt, int state, int priority, int* slots, int max) {
+    __m128i wantPriority = _mm_set1_epi32(priority);
+    __m128i wantState = _mm_set1_epi32(state);
+    __m128i freeState = _mm_set1_epi32(PT_FREE);
+    int found = 0;
+    int i = 0;
+
+    for(; i+4 <= pt->used && found < max; i+=4) {
+        int packed;
+        memcpy(&packed, pt->state + i, sizeof(int));
+        __m128i states = _mm_cvtepi8_epi32(_mm_cvtsi32_si128(packed));
+
+        // Lanes that hold a live process, then narrow to the query
+        __m128i hit = _mm_xor_si128(_mm_cmpeq_epi32(states, freeState), _mm_set1_epi32(-1));
+        if(state != PT_ANY)
+            hit = _mm_and_si128(hit, _mm_cmpeq_epi32(states, wantState));
+        if(priority != PT_ANY) {
+            __m128i priorities = _mm_loadu_si128((const __m128i*)(pt->priority + i));
+            hit = _mm_and_si128(hit, _mm_cmpeq_epi32(priorities, wantPriority));
+        }
+
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(hit));
+        while(mask != 0 && found < max) {
+            slots[found++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    for(; i<pt->used && found < max; i++) {
+        if(ptMatches(pt, i, state, priority))
+            slots[found++] = i;
+    }
+    return found;
+}
+
+PT_KERNELS ptSse42Kernels = {
+    "sse4.2", ptCountSse42, ptFindSse42, ptFilterSse42
+};
+
+
+// ---- AVX2: 32 states or 8 priorities per compare --------------------------
+
+__attribute__((target("avx2,popcnt")))
+int ptCountAvx2(PROCTABLE* pt, int state) {
+    __m256i want = _mm256_set1_epi8((char) state);
+    int count = 0;
+    int i = 0;
+
+    for(; i+32 <= pt->used; i+=32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(pt->state + i));
+        count += __builtin_popcount((unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, want)));
+    }
+    for(; i<pt->used; i++)
+        count += pt->state[i] == state;
+    return count;
+}
+
+__attribute__((target("avx2,popcnt")))
+int ptFindAvx2(PROCTABLE* pt, int state, int from) {
+    __m256i want = _mm256_set1_epi8((char) state);
+    int i = from < 0 ? 0 : from;
+
+    for(; i+32 <= pt->used; i+=32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(pt->state + i));
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, want));
+        if(mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return ptFindScalar(pt, state, i);
+}
+
+__attribute__((target("avx2,popcnt")))
+int ptFilterAvx2(PROCTABLE* pt, int state, int priority, int* slots, int max) {
+    __m256i wantPriority = _mm256_set1_epi32(priority);
+    __m256i wantState = _mm256_set1_epi32(state);
+    __m256i freeState = _mm256_set1_epi32(PT_FREE);
+    int found = 0;
+    int i = 0;
+
+    for(; i+8 <= pt->used && found < max; i+=8) {
+        __m256i states = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(pt->state + i)));
+
+        // Lanes that hold a live process, then narrow to the query
+        __m256i hit = _mm256_xor_si256(_mm256_cmpeq_epi32(states, freeState), _mm256_set1_epi32(-1));
+        if(state != PT_ANY)
+            hit = _mm256_and_si256(hit, _mm256_cmpeq_epi32(states, wantState));
+        if(priority != PT_ANY) {
+            __m256i priorities = _mm256_loadu_si256((const __m256i*)(pt->priority + i));
+            hit = _mm256_and_si256(hit, _mm256_cmpeq_epi32(priorities, wantPriority));
+        }
+
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(hit));
+        while(mask != 0 && found < max) {
+            slots[found++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    for(; i<pt->used && found < max; i++) {
+        if(ptMatches(pt, i, state, priority))
+            slots[found++] = i;
+    }
+    return found;
+}
+
+PT_KERNELS ptAvx2Kernels = {
+    "avx2", ptCountAvx2, ptFindAvx2, ptFilterAvx2
+};
+
+#endif
+
+
+PT_KERNELS* ptKernels = NULL;   // Picked by PTKernels on first use
+
+PT_KERNELS* PTKernels(void) {
+    if(ptKernels != NULL)
+        return ptKernels;
+
+    ptKernels = &ptScalarKernels;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+        ptKernels = &ptAvx2Kernels;
+    else if(__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+        ptKernels = &ptSse42Kernels;
+#endif
+    return ptKernels;
+}
+
+int PTCountState(PROCTABLE* pt, int state) {
+    return PTKernels()->countState(pt, state);
+}
+
+int PTFindState(PROCTABLE* pt, int state, int from) {
+    return PTKernels()->findState(pt, state, from);
+}
+
+int PTFilter(PROCTABLE* pt, int state, int priority, int* slots, int max) {
+    return PTKernels()->filter(pt, state, priority, slots, max);
+}
+
+#endif
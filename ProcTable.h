@@ -0,0 +1,146 @@
+#ifndef PROCTABLE_H
+#define PROCTABLE_H
+
+#include<stdlib.h>
+#include<string.h>
+
+// Process table stored as structure of arrays. Each column is one
+// contiguous array indexed by slot, so a pass over every process (all
+// states, all priorities, ...) streams through memory instead of
+// chasing a pointer per process. A slot is a stable handle: columns grow
+// by reallocation, but a process keeps its slot until it is removed.
+typedef struct {
+    int* pid;
+    int* priority;
+    signed char* state;     // PT_FREE for unused slots
+    int* mail;              // Messages waiting in the process's mailbox
+    void** item;            // Process owning the slot
+    int* freeSlots;         // Stack of slots given back by PTRemove
+    int freeCount;
+    int used;               // Slots handed out so far, live or free
+    int count;              // Live processes
+    int capacity;
+} PROCTABLE;
+
+#define PT_FREE (-128)
+#define PT_INITIAL_SLOTS 64
+
+
+/*
+ * Make the table empty
+ */
+void PTInit(PROCTABLE* pt);
+
+
+/*
+ * Release every column of the table
+ */
+void PTFree(PROCTABLE* pt);
+
+
+/*
+ * Adds a process to the table
+ * returns its slot, -1 if memory ran out
+ */
+int PTAdd(PROCTABLE* pt, void* item, int pid, int priority, int state);
+
+
+/*
+ * Frees slot for reuse by a later PTAdd
+ */
+void PTRemove(PROCTABLE* pt, int slot);
+
+
+/*
+ * Grows every column to hold at least slots slots in one step, e.g.
+    before filling the columns of a table restored in bulk
+ * returns 0 for success, -1 if memory ran out
+ */
+int PTReserve(PROCTABLE* pt, int slots);
+
+//------------------------------------------------------------------------------------
+
+void PTInit(PROCTABLE* pt) {
+    memset(pt, 0, sizeof(PROCTABLE));
+}
+
+void PTFree(PROCTABLE* pt) {
+    free(pt->pid);
+    free(pt->priority);
+    free(pt->state);
+    free(pt->mail);
+    free(pt->item);
+    free(pt->freeSlots);
+    PTInit(pt);
+}
+
+/*
+ * Helper to grow every column to capacity slots
+ * Returns 0 for success, -1 for failure
+ */
+int ptGrow(PROCTABLE* pt, int capacity) {
+    // Columns are swapped in one at a time so a failure leaves the
+    // table consistent at its old capacity
+    void* grown;
+    if((grown = realloc(pt->pid, capacity * sizeof(int))) == NULL)
+        return -1;
+    pt->pid = grown;
+    if((grown = realloc(pt->priority, capacity * sizeof(int))) == NULL)
+        return -1;
+    pt->priority = grown;
+    if((grown = realloc(pt->state, capacity * sizeof(signed char))) == NULL)
+        return -1;
+    pt->state = grown;
+    if((grown = realloc(pt->mail, capacity * sizeof(int))) == NULL)
+        return -1;
+    pt->mail = grown;
+    if((grown = realloc(pt->item, capacity * sizeof(void*))) == NULL)
+        return -1;
+    pt->item = grown;
+    if((grown = realloc(pt->freeSlots, capacity * sizeof(int))) == NULL)
+        return -1;
+    pt->freeSlots = grown;
+
+    pt->capacity = capacity;
+    return 0;
+}
+
+int PTAdd(PROCTABLE* pt, void* item, int pid, int priority, int state) {
+    int slot;
+
+    if(pt->freeCount > 0) {
+        slot = pt->freeSlots[--pt->freeCount];
+    } else {
+        if(pt->used == pt->capacity &&
+           ptGrow(pt, pt->capacity == 0 ? PT_INITIAL_SLOTS : pt->capacity * 2) != 0)
+            return -1;
+        slot = pt->used++;
+    }
+
+    pt->pid[slot] = pid;
+    pt->priority[slot] = priority;
+    pt->state[slot] = (signed char) state;
+    pt->mail[slot] = 0;
+    pt->item[slot] = item;
+    pt->count++;
+    return slot;
+}
+
+int PTReserve(PROCTABLE* pt, int slots) {
+    if(slots <= pt->capacity)
+        return 0;
+
+    int capacity = pt->capacity == 0 ? PT_INITIAL_SLOTS : pt->capacity;
+    while(capacity < slots)
+        capacity *= 2;
+    return ptGrow(pt, capacity);
+}
+
+void PTRemove(PROCTABLE* pt, int slot) {
+    pt->state[slot] = PT_FREE;
+    pt->item[slot] = NULL;
+    pt->freeSlots[pt->freeCount++] = slot;
+    pt->count--;
+}
+
+#endif
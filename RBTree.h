@@ -0,0 +1,328 @@
+#ifndef RBTREE_H
+#define RBTREE_H
+
+#include<stddef.h>
+
+// Intrusive red-black tree. An RBNODE is embedded in the item being
+// sorted and RB_ITEM gets the item back from its node. The tree caches
+// its leftmost node so the smallest item is found in O(1).
+typedef struct rbnode {
+    struct rbnode* parent;
+    struct rbnode* left;
+    struct rbnode* right;
+    int red;
+} RBNODE;
+
+typedef struct {
+    RBNODE* root;
+    RBNODE* leftmost;   // Smallest node, NULL when the tree is empty
+    int count;
+    int (*less)(RBNODE*, RBNODE*);  // Ordering of the items
+} RBTREE;
+
+// Returns the item of type containing member as its RBNODE
+#define RB_ITEM(node, type, member) ((type*)((char*)(node) - offsetof(type, member)))
+
+
+/*
+ * Make the tree empty, ordered by less
+ */
+void RBInit(RBTREE* tree, int (*less)(RBNODE*, RBNODE*));
+
+
+/*
+ * adds node to the tree
+ * equal nodes are placed after the existing ones
+ * runs in O(log n) time
+ */
+void RBInsert(RBTREE* tree, RBNODE* node);
+
+
+/*
+ * takes node out of the tree
+ * runs in O(log n) time
+ */
+void RBErase(RBTREE* tree, RBNODE* node);
+
+
+/*
+ * returns the smallest node, NULL if the tree is empty
+ */
+RBNODE* RBFirst(RBTREE* tree);
+
+
+/*
+ * returns the node after node in order, NULL if it is the last
+ * runs in O(log n) time, O(1) on average over a whole walk
+ */
+RBNODE* RBNext(RBNODE* node);
+
+//------------------------------------------------------------------------------------
+
+void RBInit(RBTREE* tree, int (*less)(RBNODE*, RBNODE*)) {
+    tree->root = NULL;
+    tree->leftmost = NULL;
+    tree->count = 0;
+    tree->less = less;
+}
+
+RBNODE* RBFirst(RBTREE* tree) {
+    return tree->leftmost;
+}
+
+RBNODE* RBNext(RBNODE* node) {
+    if(node->right != NULL) {
+        node = node->right;
+        while(node->left != NULL)
+            node = node->left;
+        return node;
+    }
+    while(node->parent != NULL && node == node->parent->right)
+        node = node->parent;
+    return node->parent;
+}
+
+/*
+ * Helper to rotate x down to the left
+ */
+void rbRotateLeft(RBTREE* tree, RBNODE* x) {
+    RBNODE* y = x->right;
+
+    x->right = y->left;
+    if(y->left != NULL)
+        y->left->parent = x;
+
+    y->parent = x->parent;
+    if(x->parent == NULL)
+        tree->root = y;
+    else if(x == x->parent->left)
+        x->parent->left = y;
+    else
+        x->parent->right = y;
+
+    y->left = x;
+    x->parent = y;
+}
+
+/*
+ * Helper to rotate x down to the right
+ */
+void rbRotateRight(RBTREE* tree, RBNODE* x) {
+    RBNODE* y = x->left;
+
+    x->left = y->right;
+    if(y->right != NULL)
+        y->right->parent = x;
+
+    y->parent = x->parent;
+    if(x->parent == NULL)
+        tree->root = y;
+    else if(x == x->parent->right)
+        x->parent->right = y;
+    else
+        x->parent->left = y;
+
+    y->right = x;
+    x->parent = y;
+}
+
+void RBInsert(RBTREE* tree, RBNODE* node) {
+    RBNODE* parent = NULL;
+    RBNODE* curr = tree->root;
+    int leftmost = 1;
+
+    while(curr != NULL) {
+        parent = curr;
+        if(tree->less(node, curr)) {
+            curr = curr->left;
+        } else {
+            curr = curr->right;
+            leftmost = 0;
+        }
+    }
+
+    node->parent = parent;
+    node->left = node->right = NULL;
+    node->red = 1;
+
+    if(parent == NULL)
+        tree->root = node;
+    else if(tree->less(node, parent))
+        parent->left = node;
+    else
+        parent->right = node;
+
+    if(leftmost)
+        tree->leftmost = node;
+    tree->count++;
+
+    // Fix up red-red violations on the way to the root
+    while(node->parent != NULL && node->parent->red) {
+        RBNODE* gparent = node->parent->parent;
+
+        if(node->parent == gparent->left) {
+            RBNODE* uncle = gparent->right;
+            if(uncle != NULL && uncle->red) {
+                node->parent->red = 0;
+                uncle->red = 0;
+                gparent->red = 1;
+                node = gparent;
+            } else {
+                if(node == node->parent->right) {
+                    node = node->parent;
+                    rbRotateLeft(tree, node);
+                }
+                node->parent->red = 0;
+                gparent->red = 1;
+                rbRotateRight(tree, gparent);
+            }
+        } else {
+            RBNODE* uncle = gparent->left;
+            if(uncle != NULL && uncle->red) {
+                node->parent->red = 0;
+                uncle->red = 0;
+                gparent->red = 1;
+                node = gparent;
+            } else {
+                if(node == node->parent->left) {
+                    node = node->parent;
+                    rbRotateRight(tree, node);
+                }
+                node->parent->red = 0;
+                gparent->red = 1;
+                rbRotateLeft(tree, gparent);
+            }
+        }
+    }
+    tree->root->red = 0;
+}
+
+/*
+ * Helper to put v in u's place under u's parent
+ */
+void rbTransplant(RBTREE* tree, RBNODE* u, RBNODE* v) {
+    if(u->parent == NULL)
+        tree->root = v;
+    else if(u == u->parent->left)
+        u->parent->left = v;
+    else
+        u->parent->right = v;
+
+    if(v != NULL)
+        v->parent = u->parent;
+}
+
+void RBErase(RBTREE* tree, RBNODE* node) {
+    // Keep the cached leftmost node up to date
+    if(tree->leftmost == node) {
+        if(node->right != NULL) {
+            RBNODE* next = node->right;
+            while(next->left != NULL)
+                next = next->left;
+            tree->leftmost = next;
+        } else {
+            tree->leftmost = node->parent;
+        }
+    }
+
+    RBNODE* child;
+    RBNODE* parent;
+    int removedRed = node->red;
+
+    if(node->left == NULL) {
+        child = node->right;
+        parent = node->parent;
+        rbTransplant(tree, node, child);
+    } else if(node->right == NULL) {
+        child = node->left;
+        parent = node->parent;
+        rbTransplant(tree, node, child);
+    } else {
+        RBNODE* next = node->right;
+        while(next->left != NULL)
+            next = next->left;
+
+        removedRed = next->red;
+        child = next->right;
+        if(next->parent == node) {
+            parent = next;
+        } else {
+            parent = next->parent;
+            rbTransplant(tree, next, next->right);
+            next->right = node->right;
+            next->right->parent = next;
+        }
+        rbTransplant(tree, node, next);
+        next->left = node->left;
+        next->left->parent = next;
+        next->red = node->red;
+    }
+
+    tree->count--;
+    node->parent = node->left = node->right = NULL;
+    if(removedRed)
+        return;
+
+    // Fix up the missing black on the way to the root
+    while(child != tree->root && (child == NULL || !child->red)) {
+        if(child == parent->left) {
+            RBNODE* sibling = parent->right;
+            if(sibling->red) {
+                sibling->red = 0;
+                parent->red = 1;
+                rbRotateLeft(tree, parent);
+                sibling = parent->right;
+            }
+            if((sibling->left == NULL || !sibling->left->red) &&
+               (sibling->right == NULL || !sibling->right->red)) {
+                sibling->red = 1;
+                child = parent;
+                parent = child->parent;
+            } else {
+                if(sibling->right == NULL || !sibling->right->red) {
+                    sibling->left->red = 0;
+                    sibling->red = 1;
+                    rbRotateRight(tree, sibling);
+                    sibling = parent->right;
+                }
+                sibling->red = parent->red;
+                parent->red = 0;
+                if(sibling->right != NULL)
+                    sibling->right->red = 0;
+                rbRotateLeft(tree, parent);
+                child = tree->root;
+            }
+        } else {
+            RBNODE* sibling = parent->left;
+            if(sibling->red) {
+                sibling->red = 0;
+                parent->red = 1;
+                rbRotateRight(tree, parent);
+                sibling = parent->left;
+            }
+            if((sibling->left == NULL || !sibling->left->red) &&
+               (sibling->right == NULL || !sibling->right->red)) {
+                sibling->red = 1;
+                child = parent;
+                parent = child->parent;
+            } else {
+                if(sibling->left == NULL || !sibling->left->red) {
+                    sibling->right->red = 0;
+                    sibling->red = 1;
+                    rbRotateLeft(tree, sibling);
+                    sibling = parent->left;
+                }
+                sibling->red = parent->red;
+                parent->red = 0;
+                if(sibling->left != NULL)
+                    sibling->left->red = 0;
+                rbRotateRight(tree, parent);
+                child = tree->root;
+            }
+        }
+    }
+    if(child != NULL)
+        child->red = 0;
+}
+
+#endif
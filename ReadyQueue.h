@@ -0,0 +1,179 @@
+#ifndef READYQUEUE_H
+#define READYQUEUE_H
+
+#include<stdlib.h>
+#include "IList.h"
+
+// Multi-level ready queue: one intrusive FIFO per priority level plus a
+// bitmap of the non-empty levels, so the highest ready level is found with
+// a count-leading-zeros instead of a scan of the queued items. Items carry
+// their own ILINK, so queueing never allocates.
+typedef struct {
+    int levels;                     // Number of priority levels
+    int count;                      // Items queued over all levels
+    ILIST* queues;                  // FIFO for each level
+    unsigned long long* bitmap;     // Bit i set when queues[i] is non-empty
+} READYQ;
+
+#define RQ_WORD_BITS 64
+
+
+/*
+ * Make a new, empty ready queue with the given number of levels
+ * Return NULL if failed
+ */
+READYQ* RQCreate(int levels);
+
+
+/*
+ * return the number of items on all levels
+ */
+int RQCount(READYQ* rq);
+
+
+/*
+ * return the highest non-empty level, -1 if the queue is empty
+ */
+int RQHighest(READYQ* rq);
+
+
+/*
+ * adds link to the end of the FIFO for level
+ * returns 0 for success, -1 if level is out of range
+ */
+int RQEnqueue(READYQ* rq, ILINK* link, int level);
+
+
+/*
+ * takes the oldest link off the highest non-empty level
+ * returns NULL if the queue is empty
+ */
+ILINK* RQDequeue(READYQ* rq);
+
+
+/*
+ * takes link, queued at level, off the ready queue
+ */
+void RQRemove(READYQ* rq, ILINK* link, int level);
+
+
+/*
+ * delete the ready queue
+ * items themselves are not freed
+ */
+void RQFree(READYQ* rq);
+
+//------------------------------------------------------------------------------------
+
+/*
+ * Make a new, empty ready queue with the given number of levels
+ * Return NULL if failed
+ */
+READYQ* RQCreate(int levels) {
+    if(levels <= 0)
+        return NULL;
+
+    READYQ* rq = malloc(sizeof(READYQ));
+    if(rq == NULL)
+        return NULL;
+
+    int words = (levels + RQ_WORD_BITS - 1) / RQ_WORD_BITS;
+    rq->levels = levels;
+    rq->count = 0;
+    rq->queues = calloc(levels, sizeof(ILIST));
+    rq->bitmap = calloc(words, sizeof(unsigned long long));
+    if(rq->queues == NULL || rq->bitmap == NULL) {
+        RQFree(rq);
+        return NULL;
+    }
+
+    for(int i=0; i<levels; i++) {
+        IListInit(&rq->queues[i]);
+    }
+
+    return rq;
+}
+
+
+/*
+ * return the number of items on all levels
+ */
+int RQCount(READYQ* rq) {
+    return rq->count;
+}
+
+
+/*
+ * return the highest non-empty level, -1 if the queue is empty
+ * Looks at one bitmap word per 64 levels
+ */
+int RQHighest(READYQ* rq) {
+    int words = (rq->levels + RQ_WORD_BITS - 1) / RQ_WORD_BITS;
+
+    for(int w=words-1; w>=0; w--) {
+        if(rq->bitmap[w] != 0)
+            return w * RQ_WORD_BITS + (RQ_WORD_BITS - 1 - __builtin_clzll(rq->bitmap[w]));
+    }
+
+    return -1;
+}
+
+
+/*
+ * adds link to the end of the FIFO for level
+ * returns 0 for success, -1 if level is out of range
+ */
+int RQEnqueue(READYQ* rq, ILINK* link, int level) {
+    if(level < 0 || level >= rq->levels)
+        return -1;
+
+    IListAppend(&rq->queues[level], link);
+    rq->bitmap[level / RQ_WORD_BITS] |= 1ULL << (level % RQ_WORD_BITS);
+    rq->count++;
+    return 0;
+}
+
+
+/*
+ * takes link, queued at level, off the ready queue
+ */
+void RQRemove(READYQ* rq, ILINK* link, int level) {
+    ILIST* queue = &rq->queues[level];
+
+    IListRemove(queue, link);
+    rq->count--;
+
+    if(IListCount(queue) == 0)
+        rq->bitmap[level / RQ_WORD_BITS] &= ~(1ULL << (level % RQ_WORD_BITS));
+}
+
+
+/*
+ * takes the oldest link off the highest non-empty level
+ * returns NULL if the queue is empty
+ */
+ILINK* RQDequeue(READYQ* rq) {
+    int level = RQHighest(rq);
+    if(level < 0)
+        return NULL;
+
+    ILINK* link = rq->queues[level].first;
+    RQRemove(rq, link, level);
+    return link;
+}
+
+
+/*
+ * delete the ready queue
+ * items themselves are not freed
+ */
+void RQFree(READYQ* rq) {
+    if(rq == NULL)
+        return;
+
+    free(rq->queues);
+    free(rq->bitmap);
+    free(rq);
+}
+
+#endif
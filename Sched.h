@@ -0,0 +1,540 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "IList.h"
+#include "ReadyQueue.h"
+#include "RBTree.h"
+
+// Scheduling state carried by every process. Each policy only uses the
+// fields it needs; item points back at the owning process.
+typedef struct {
+    void* item;             // Process owning this entity
+    int priority;           // Static priority, 0 = lowest
+    int queueLevel;         // Level of the READYQ holding it, -1 if not queued
+    ILINK runLink;          // Link on that READYQ level
+    int mlfqLevel;          // MLFQ level, -1 until first queued
+    int used;               // MLFQ quanta used at mlfqLevel
+    long long queuedAt;     // MLFQ clock when queued, for aging
+    unsigned long long vruntime;    // CFS weighted CPU time
+    RBNODE rb;              // CFS tree link
+    unsigned long long pass;        // Stride pass value
+    int heapIndex;          // Slot in the stride heap, -1 if not queued
+} SCHED_ENTITY;
+
+// Scheduling policy. A policy owns an opaque run queue made by create;
+// every operation below gets that run queue as its first argument.
+typedef struct {
+    const char* name;
+    void* (*create)(int priorities);    // New empty run queue, NULL for failure
+    void (*destroy)(void* rq);
+    int (*enqueue)(void* rq, SCHED_ENTITY* se);     // 0 for success, -1 for failure
+    SCHED_ENTITY* (*pick_next)(void* rq);           // Dequeues the next to run, NULL if empty
+    void (*remove)(void* rq, SCHED_ENTITY* se);     // Takes a queued entity out
+    int (*count)(void* rq);
+    void (*on_tick)(void* rq, SCHED_ENTITY* se);    // se used up a whole quantum
+    void (*on_block)(void* rq, SCHED_ENTITY* se);   // se left the CPU to wait
+    void (*on_wake)(void* rq, SCHED_ENTITY* se);    // se is about to be queued after waiting
+    // Snapshots: walk visits every queued entity in an order that requeue,
+    // called on an empty run queue, rebuilds the same queue from; clock is
+    // the policy's own time (MLFQ dispatches, stride pass, CFS vruntime)
+    void (*walk)(void* rq, void (*visit)(SCHED_ENTITY* se, void* arg), void* arg);
+    int (*requeue)(void* rq, SCHED_ENTITY* se);     // 0 for success, -1 for failure
+    unsigned long long (*get_clock)(void* rq);
+    void (*set_clock)(void* rq, unsigned long long clock);
+} SCHED_POLICY;
+
+// MLFQ tuning
+#ifndef MLFQ_LEVELS
+#define MLFQ_LEVELS 8
+#endif
+#ifndef MLFQ_ALLOTMENT
+#define MLFQ_ALLOTMENT 2        // Quanta at a level before demotion
+#endif
+#ifndef MLFQ_AGE_LIMIT
+#define MLFQ_AGE_LIMIT 64       // Dispatches a job may wait before promotion
+#endif
+
+// Stride tuning
+#define STRIDE_ONE (1ULL << 20)
+#define STRIDE_TICKETS 100      // Tickets per priority step
+
+// CFS tuning
+#define CFS_NICE0_WEIGHT 1024
+#define CFS_QUANTUM 1000        // vruntime charged per quantum at weight 1024
+
+
+/*
+ * Initialize the scheduling state of a new process
+ */
+void SchedInitEntity(SCHED_ENTITY* se, void* item, int priority);
+
+
+/*
+ * returns the policy with the given name, NULL if there is none
+ */
+SCHED_POLICY* SchedFind(const char* name);
+
+//------------------------------------------------------------------------------------
+
+void SchedInitEntity(SCHED_ENTITY* se, void* item, int priority) {
+    se->item = item;
+    se->priority = priority;
+    se->queueLevel = -1;
+    se->runLink.next = se->runLink.prev = NULL;
+    se->mlfqLevel = -1;
+    se->used = 0;
+    se->queuedAt = 0;
+    se->vruntime = 0;
+    se->pass = 0;
+    se->heapIndex = -1;
+}
+
+/*
+ * No-op hook for policies that do not care about an event
+ */
+void schedIgnore(void* rq, SCHED_ENTITY* se) {
+    (void) rq;
+    (void) se;
+}
+
+/*
+ * Clock hooks for policies that keep no time of their own
+ */
+unsigned long long schedNoClock(void* rq) {
+    (void) rq;
+    return 0;
+}
+
+void schedSetNoClock(void* rq, unsigned long long clock) {
+    (void) rq;
+    (void) clock;
+}
+
+/*
+ * Helper to visit a READYQ level by level, each in FIFO order
+ */
+void schedWalkLevels(READYQ* rq, void (*visit)(SCHED_ENTITY* se, void* arg), void* arg) {
+    for(int level=0; level<rq->levels; level++) {
+        for(ILINK* link = rq->queues[level].first; link != NULL; link = link->next)
+            visit(ILIST_ITEM(link, SCHED_ENTITY, runLink), arg);
+    }
+}
+
+
+// ---- Priority: strict priority, FIFO within a level ----------------------
+
+void* prioCreate(int priorities) {
+    return RQCreate(priorities);
+}
+
+void prioDestroy(void* rq) {
+    RQFree(rq);
+}
+
+int prioEnqueueAt(READYQ* rq, SCHED_ENTITY* se, int level) {
+    if(RQEnqueue(rq, &se->runLink, level) != 0)
+        return -1;
+    se->queueLevel = level;
+    return 0;
+}
+
+int prioEnqueue(void* rq, SCHED_ENTITY* se) {
+    return prioEnqueueAt(rq, se, se->priority);
+}
+
+void prioRemove(void* rq, SCHED_ENTITY* se) {
+    RQRemove(rq, &se->runLink, se->queueLevel);
+    se->queueLevel = -1;
+}
+
+int prioRequeue(void* rq, SCHED_ENTITY* se) {
+    return prioEnqueueAt(rq, se, se->queueLevel);
+}
+
+void prioWalk(void* rq, void (*visit)(SCHED_ENTITY* se, void* arg), void* arg) {
+    schedWalkLevels(rq, visit, arg);
+}
+
+SCHED_ENTITY* prioPickNext(void* rq) {
+    ILINK* link = RQDequeue(rq);
+    if(link == NULL)
+        return NULL;
+
+    SCHED_ENTITY* se = ILIST_ITEM(link, SCHED_ENTITY, runLink);
+    se->queueLevel = -1;
+    return se;
+}
+
+int prioCount(void* rq) {
+    return RQCount(rq);
+}
+
+SCHED_POLICY priorityPolicy = {
+    "priority", prioCreate, prioDestroy, prioEnqueue, prioPickNext,
+    prioRemove, prioCount, schedIgnore, schedIgnore, schedIgnore,
+    prioWalk, prioRequeue, schedNoClock, schedSetNoClock
+};
+
+
+// ---- Round robin: one FIFO, priorities ignored ----------------------------
+
+void* rrCreate(int priorities) {
+    (void) priorities;
+    return RQCreate(1);
+}
+
+int rrEnqueue(void* rq, SCHED_ENTITY* se) {
+    return prioEnqueueAt(rq, se, 0);
+}
+
+SCHED_POLICY roundRobinPolicy = {
+    "rr", rrCreate, prioDestroy, rrEnqueue, prioPickNext,
+    prioRemove, prioCount, schedIgnore, schedIgnore, schedIgnore,
+    prioWalk, prioRequeue, schedNoClock, schedSetNoClock
+};
+
+
+// ---- MLFQ: new jobs start at the top level, jobs that use up their
+// ---- allotment drop a level, jobs that wait too long are aged to the top
+
+typedef struct {
+    READYQ* levels;
+    long long clock;        // Dispatches so far
+} MLFQ;
+
+void* mlfqCreate(int priorities) {
+    (void) priorities;
+    MLFQ* mlfq = malloc(sizeof(MLFQ));
+    if(mlfq == NULL)
+        return NULL;
+
+    mlfq->levels = RQCreate(MLFQ_LEVELS);
+    mlfq->clock = 0;
+    if(mlfq->levels == NULL) {
+        free(mlfq);
+        return NULL;
+    }
+    return mlfq;
+}
+
+void mlfqDestroy(void* rq) {
+    MLFQ* mlfq = rq;
+    RQFree(mlfq->levels);
+    free(mlfq);
+}
+
+int mlfqEnqueue(void* rq, SCHED_ENTITY* se) {
+    MLFQ* mlfq = rq;
+    if(se->mlfqLevel < 0) {
+        se->mlfqLevel = MLFQ_LEVELS - 1;
+        se->used = 0;
+    }
+    se->queuedAt = mlfq->clock;
+    return prioEnqueueAt(mlfq->levels, se, se->mlfqLevel);
+}
+
+void mlfqRemove(void* rq, SCHED_ENTITY* se) {
+    prioRemove(((MLFQ*) rq)->levels, se);
+}
+
+// Requeueing keeps queuedAt, so aging carries on where it was
+int mlfqRequeue(void* rq, SCHED_ENTITY* se) {
+    return prioEnqueueAt(((MLFQ*) rq)->levels, se, se->queueLevel);
+}
+
+void mlfqWalk(void* rq, void (*visit)(SCHED_ENTITY* se, void* arg), void* arg) {
+    schedWalkLevels(((MLFQ*) rq)->levels, visit, arg);
+}
+
+unsigned long long mlfqGetClock(void* rq) {
+    return (unsigned long long)((MLFQ*) rq)->clock;
+}
+
+void mlfqSetClock(void* rq, unsigned long long clock) {
+    ((MLFQ*) rq)->clock = (long long) clock;
+}
+
+/*
+ * Moves every job that has waited longer than MLFQ_AGE_LIMIT to the top
+ * Only queue heads are checked since each level is FIFO, so this is
+    O(MLFQ_LEVELS) plus O(1) per promoted job
+ */
+void mlfqAge(MLFQ* mlfq) {
+    for(int level=0; level<MLFQ_LEVELS-1; level++) {
+        ILIST* queue = &mlfq->levels->queues[level];
+
+        while(queue->first != NULL) {
+            SCHED_ENTITY* se = ILIST_ITEM(queue->first, SCHED_ENTITY, runLink);
+            if(mlfq->clock - se->queuedAt <= MLFQ_AGE_LIMIT)
+                break;
+
+            prioRemove(mlfq->levels, se);
+            se->mlfqLevel = MLFQ_LEVELS - 1;
+            se->used = 0;
+            prioEnqueueAt(mlfq->levels, se, se->mlfqLevel);
+        }
+    }
+}
+
+SCHED_ENTITY* mlfqPickNext(void* rq) {
+    MLFQ* mlfq = rq;
+    mlfq->clock++;
+    mlfqAge(mlfq);
+    return prioPickNext(mlfq->levels);
+}
+
+int mlfqCount(void* rq) {
+    return RQCount(((MLFQ*) rq)->levels);
+}
+
+void mlfqOnTick(void* rq, SCHED_ENTITY* se) {
+    (void) rq;
+    se->used++;
+    if(se->used >= MLFQ_ALLOTMENT && se->mlfqLevel > 0) {
+        se->mlfqLevel--;
+        se->used = 0;
+    }
+}
+
+SCHED_POLICY mlfqPolicy = {
+    "mlfq", mlfqCreate, mlfqDestroy, mlfqEnqueue, mlfqPickNext,
+    mlfqRemove, mlfqCount, mlfqOnTick, schedIgnore, schedIgnore,
+    mlfqWalk, mlfqRequeue, mlfqGetClock, mlfqSetClock
+};
+
+
+// ---- Stride: deterministic lottery. Each job holds tickets in proportion
+// ---- to its priority and the lowest pass runs next, from a binary heap
+
+typedef struct {
+    SCHED_ENTITY** heap;
+    int count;
+    int capacity;
+    unsigned long long globalPass;  // Pass of the last job picked
+} STRIDE;
+
+unsigned long long strideOf(SCHED_ENTITY* se) {
+    return STRIDE_ONE / ((unsigned long long)(se->priority + 1) * STRIDE_TICKETS);
+}
+
+void* strideCreate(int priorities) {
+    (void) priorities;
+    STRIDE* stride = calloc(1, sizeof(STRIDE));
+    return stride;
+}
+
+void strideDestroy(void* rq) {
+    STRIDE* stride = rq;
+    free(stride->heap);
+    free(stride);
+}
+
+/*
+ * Helper to place se at slot i of the heap
+ */
+void strideSet(STRIDE* stride, int i, SCHED_ENTITY* se) {
+    stride->heap[i] = se;
+    se->heapIndex = i;
+}
+
+void strideSiftUp(STRIDE* stride, int i) {
+    SCHED_ENTITY* se = stride->heap[i];
+    while(i > 0) {
+        int parent = (i - 1) / 2;
+        if(stride->heap[parent]->pass <= se->pass)
+            break;
+        strideSet(stride, i, stride->heap[parent]);
+        i = parent;
+    }
+    strideSet(stride, i, se);
+}
+
+void strideSiftDown(STRIDE* stride, int i) {
+    SCHED_ENTITY* se = stride->heap[i];
+    while(1) {
+        int child = 2 * i + 1;
+        if(child >= stride->count)
+            break;
+        if(child + 1 < stride->count && stride->heap[child + 1]->pass < stride->heap[child]->pass)
+            child++;
+        if(se->pass <= stride->heap[child]->pass)
+            break;
+        strideSet(stride, i, stride->heap[child]);
+        i = child;
+    }
+    strideSet(stride, i, se);
+}
+
+int strideEnqueue(void* rq, SCHED_ENTITY* se) {
+    STRIDE* stride = rq;
+
+    if(stride->count == stride->capacity) {
+        int capacity = stride->capacity == 0 ? 64 : stride->capacity * 2;
+        SCHED_ENTITY** grown = realloc(stride->heap, capacity * sizeof(SCHED_ENTITY*));
+        if(grown == NULL)
+            return -1;
+        stride->heap = grown;
+        stride->capacity = capacity;
+    }
+
+    // Jobs that were away do not get to catch up on missed passes
+    if(se->pass < stride->globalPass)
+        se->pass = stride->globalPass;
+
+    strideSet(stride, stride->count++, se);
+    strideSiftUp(stride, se->heapIndex);
+    return 0;
+}
+
+void strideRemove(void* rq, SCHED_ENTITY* se) {
+    STRIDE* stride = rq;
+    int i = se->heapIndex;
+
+    stride->count--;
+    if(i != stride->count) {
+        strideSet(stride, i, stride->heap[stride->count]);
+        strideSiftDown(stride, i);
+        strideSiftUp(stride, stride->heap[i]->heapIndex);
+    }
+    se->heapIndex = -1;
+}
+
+SCHED_ENTITY* stridePickNext(void* rq) {
+    STRIDE* stride = rq;
+    if(stride->count == 0)
+        return NULL;
+
+    SCHED_ENTITY* se = stride->heap[0];
+    strideRemove(stride, se);
+    stride->globalPass = se->pass;
+    se->pass += strideOf(se);
+    return se;
+}
+
+int strideCount(void* rq) {
+    return ((STRIDE*) rq)->count;
+}
+
+// Visiting in heap order and requeueing in the same order rebuilds the
+// same heap, since every entity sifts up to where it was
+void strideWalk(void* rq, void (*visit)(SCHED_ENTITY* se, void* arg), void* arg) {
+    STRIDE* stride = rq;
+    for(int i=0; i<stride->count; i++)
+        visit(stride->heap[i], arg);
+}
+
+unsigned long long strideGetClock(void* rq) {
+    return ((STRIDE*) rq)->globalPass;
+}
+
+void strideSetClock(void* rq, unsigned long long clock) {
+    ((STRIDE*) rq)->globalPass = clock;
+}
+
+SCHED_POLICY stridePolicy = {
+    "stride", strideCreate, strideDestroy, strideEnqueue, stridePickNext,
+    strideRemove, strideCount, schedIgnore, schedIgnore, schedIgnore,
+    strideWalk, strideEnqueue, strideGetClock, strideSetClock
+};
+
+
+// ---- CFS: the job with the least weighted CPU time (vruntime) runs
+// ---- next, from a red-black tree ordered by vruntime
+
+typedef struct {
+    RBTREE tree;
+    unsigned long long minVruntime;     // Never decreases
+} CFS;
+
+int cfsLess(RBNODE* a, RBNODE* b) {
+    return RB_ITEM(a, SCHED_ENTITY, rb)->vruntime < RB_ITEM(b, SCHED_ENTITY, rb)->vruntime;
+}
+
+void* cfsCreate(int priorities) {
+    (void) priorities;
+    CFS* cfs = malloc(sizeof(CFS));
+    if(cfs == NULL)
+        return NULL;
+
+    RBInit(&cfs->tree, cfsLess);
+    cfs->minVruntime = 0;
+    return cfs;
+}
+
+void cfsDestroy(void* rq) {
+    free(rq);
+}
+
+int cfsEnqueue(void* rq, SCHED_ENTITY* se) {
+    CFS* cfs = rq;
+
+    // New and woken jobs start level with the others
+    if(se->vruntime < cfs->minVruntime)
+        se->vruntime = cfs->minVruntime;
+
+    RBInsert(&cfs->tree, &se->rb);
+    return 0;
+}
+
+void cfsRemove(void* rq, SCHED_ENTITY* se) {
+    RBErase(&((CFS*) rq)->tree, &se->rb);
+}
+
+SCHED_ENTITY* cfsPickNext(void* rq) {
+    CFS* cfs = rq;
+    RBNODE* first = RBFirst(&cfs->tree);
+    if(first == NULL)
+        return NULL;
+
+    SCHED_ENTITY* se = RB_ITEM(first, SCHED_ENTITY, rb);
+    RBErase(&cfs->tree, first);
+    if(se->vruntime > cfs->minVruntime)
+        cfs->minVruntime = se->vruntime;
+    return se;
+}
+
+int cfsCount(void* rq) {
+    return ((CFS*) rq)->tree.count;
+}
+
+void cfsOnTick(void* rq, SCHED_ENTITY* se) {
+    (void) rq;
+    unsigned long long weight = (unsigned long long)(se->priority + 1) * CFS_NICE0_WEIGHT;
+    se->vruntime += CFS_QUANTUM * CFS_NICE0_WEIGHT / weight;
+}
+
+// In vruntime order; equal ones go back in after each other, as they were
+void cfsWalk(void* rq, void (*visit)(SCHED_ENTITY* se, void* arg), void* arg) {
+    for(RBNODE* node = RBFirst(&((CFS*) rq)->tree); node != NULL; node = RBNext(node))
+        visit(RB_ITEM(node, SCHED_ENTITY, rb), arg);
+}
+
+unsigned long long cfsGetClock(void* rq) {
+    return ((CFS*) rq)->minVruntime;
+}
+
+void cfsSetClock(void* rq, unsigned long long clock) {
+    ((CFS*) rq)->minVruntime = clock;
+}
+
+SCHED_POLICY cfsPolicy = {
+    "cfs", cfsCreate, cfsDestroy, cfsEnqueue, cfsPickNext,
+    cfsRemove, cfsCount, cfsOnTick, schedIgnore, schedIgnore,
+    cfsWalk, cfsEnqueue, cfsGetClock, cfsSetClock
+};
+
+
+// Every built in policy, NULL terminated
+SCHED_POLICY* schedPolicies[] = {
+    &priorityPolicy, &roundRobinPolicy, &mlfqPolicy, &stridePolicy, &cfsPolicy, NULL
+};
+
+SCHED_POLICY* SchedFind(const char* name) {
+    for(int i=0; schedPolicies[i] != NULL; i++) {
+        if(strcmp(schedPolicies[i]->name, name) == 0)
+            return schedPolicies[i];
+    }
+    return NULL;
+}
+
+#endif
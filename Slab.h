@@ -0,0 +1,256 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include<stdint.h>
+#include<stdlib.h>
+#include<string.h>
+#include<sys/mman.h>
+
+// Allocator for objects of one fixed size. Objects are carved out of
+// chunks of SLAB_CHUNK_OBJECTS at a time and freed ones are kept on a
+// free list, so steady-state churn never touches malloc; the chunks are
+// only given back by SlabDeinit, or kept by SlabReset for the next set
+// of objects. When the number of objects is known up front, SlabReserve
+// maps all their chunks in one piece instead of a malloc per chunk.
+//
+// Every object has a number, its index in carving order, and a
+// generation that goes up when it is allocated and again when it is
+// freed, so it is odd exactly while the object is live. A handle names
+// one life of one object: a handle kept past the object's free no
+// longer resolves, even once the memory has gone to a new object.
+typedef uint64_t SLAB_HANDLE;   // Generation << 32 | index, 0 is never live
+
+typedef struct slabHeader {
+    uint32_t index;
+    uint32_t generation;
+    struct slabHeader* nextFree;    // Link on the free list
+} SLAB_HEADER;
+
+// Objects per chunk, a power of two
+#ifndef SLAB_CHUNK_OBJECTS
+#define SLAB_CHUNK_OBJECTS 256
+#endif
+#if SLAB_CHUNK_OBJECTS & (SLAB_CHUNK_OBJECTS - 1)
+#error SLAB_CHUNK_OBJECTS must be a power of two
+#endif
+
+// Headers and objects are kept 16 byte aligned
+#define SLAB_ALIGN(n) (((n) + 15) & ~(size_t) 15)
+#define SLAB_HEADER_SIZE SLAB_ALIGN(sizeof(SLAB_HEADER))
+
+typedef struct {
+    size_t stride;          // Bytes per object, header included
+    char** chunks;
+    int chunkCount;
+    int chunkCapacity;
+    uint32_t carved;        // Objects carved out of the chunks so far
+    uint32_t carvedMax;     // Most ever carved; their headers outlive SlabReset
+    char* reserved;         // Mapping made by SlabReserve, NULL if none
+    int reservedFirst;      // Its chunks, which SlabDeinit must not free
+    int reservedChunks;
+    SLAB_HEADER* freeList;
+    long inUse;             // Objects allocated and not yet freed
+    long allocs;            // Allocations since SlabInit
+    long frees;             // Frees since SlabInit
+} SLAB;
+
+
+/*
+ * Make an empty slab of objects of size bytes
+ */
+void SlabInit(SLAB* slab, size_t size);
+
+
+/*
+ * Release every chunk of the slab
+ * All objects and handles from it are invalid afterwards
+ */
+void SlabDeinit(SLAB* slab);
+
+
+/*
+ * Frees every object at once but keeps the chunks, so the next objects
+    are carved from memory that is mapped already
+ * Handles from before stay invalid
+ */
+void SlabReset(SLAB* slab);
+
+
+/*
+ * Makes room for count more objects than the chunks have left, in one
+    mapping, so carving them never calls malloc
+ * A slab takes one reservation; later calls leave it to carve as usual
+ * returns 0 for success, -1 if memory ran out
+ */
+int SlabReserve(SLAB* slab, long count);
+
+
+/*
+ * Takes an object off the slab, its contents undefined
+ * returns NULL if memory ran out
+ */
+void* SlabAlloc(SLAB* slab);
+
+
+/*
+ * Gives an object back to the slab, ending its handle
+ */
+void SlabFree(SLAB* slab, void* item);
+
+
+/*
+ * returns the handle of a live object
+ */
+SLAB_HANDLE SlabHandle(void* item);
+
+
+/*
+ * returns the object a handle names, NULL if it has been freed since
+    or the handle is 0
+ * Runs in O(1) time
+ */
+void* SlabLookup(SLAB* slab, SLAB_HANDLE handle);
+
+//------------------------------------------------------------------------------------
+
+void SlabInit(SLAB* slab, size_t size) {
+    memset(slab, 0, sizeof(SLAB));
+    slab->stride = SLAB_HEADER_SIZE + SLAB_ALIGN(size);
+}
+
+void SlabDeinit(SLAB* slab) {
+    for(int i=0; i<slab->chunkCount; i++) {
+        if(i < slab->reservedFirst || i >= slab->reservedFirst + slab->reservedChunks)
+            free(slab->chunks[i]);
+    }
+    if(slab->reserved != NULL)
+        munmap(slab->reserved, (size_t) slab->reservedChunks * SLAB_CHUNK_OBJECTS * slab->stride);
+    free(slab->chunks);
+    SlabInit(slab, slab->stride - SLAB_HEADER_SIZE);
+}
+
+/*
+ * Helper to return the header of the object with the given index
+ */
+SLAB_HEADER* slabHeaderAt(SLAB* slab, uint32_t index) {
+    char* chunk = slab->chunks[index / SLAB_CHUNK_OBJECTS];
+    return (SLAB_HEADER*)(chunk + (index & (SLAB_CHUNK_OBJECTS - 1)) * slab->stride);
+}
+
+/*
+ * Helper to make room for count more chunk pointers
+ * Returns 0 for success, -1 for failure
+ */
+int slabGrowChunks(SLAB* slab, int count) {
+    if(slab->chunkCount + count <= slab->chunkCapacity)
+        return 0;
+
+    int capacity = slab->chunkCapacity == 0 ? 16 : slab->chunkCapacity;
+    while(capacity < slab->chunkCount + count)
+        capacity *= 2;
+    char** grown = realloc(slab->chunks, capacity * sizeof(char*));
+    if(grown == NULL)
+        return -1;
+    slab->chunks = grown;
+    slab->chunkCapacity = capacity;
+    return 0;
+}
+
+/*
+ * Helper to carve a new object, adding a chunk if needed
+ * Returns NULL if memory ran out
+ */
+SLAB_HEADER* slabCarve(SLAB* slab) {
+    if(slab->carved == (uint32_t) slab->chunkCount * SLAB_CHUNK_OBJECTS) {
+        if(slabGrowChunks(slab, 1) != 0)
+            return NULL;
+
+        char* chunk = malloc(SLAB_CHUNK_OBJECTS * slab->stride);
+        if(chunk == NULL)
+            return NULL;
+        slab->chunks[slab->chunkCount++] = chunk;
+    }
+
+    // An object carved before a SlabReset goes on from its generation,
+    // made even again if it was live, so no old handle resolves to it
+    SLAB_HEADER* header = slabHeaderAt(slab, slab->carved);
+    if(slab->carved < slab->carvedMax) {
+        header->generation += header->generation & 1;
+    } else {
+        header->generation = 0;
+        slab->carvedMax++;
+    }
+    header->index = slab->carved++;
+    return header;
+}
+
+void SlabReset(SLAB* slab) {
+    slab->frees += slab->inUse;
+    slab->inUse = 0;
+    slab->carved = 0;
+    slab->freeList = NULL;
+}
+
+int SlabReserve(SLAB* slab, long count) {
+    long spare = (long) slab->chunkCount * SLAB_CHUNK_OBJECTS - slab->carved;
+    if(count <= spare || slab->reserved != NULL)
+        return 0;
+
+    int chunks = (int)((count - spare + SLAB_CHUNK_OBJECTS - 1) / SLAB_CHUNK_OBJECTS);
+    if(slabGrowChunks(slab, chunks) != 0)
+        return -1;
+    size_t chunkSize = SLAB_CHUNK_OBJECTS * slab->stride;
+    char* region = mmap(NULL, chunks * chunkSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(region == MAP_FAILED)
+        return -1;
+
+    slab->reserved = region;
+    slab->reservedFirst = slab->chunkCount;
+    slab->reservedChunks = chunks;
+    for(int i=0; i<chunks; i++)
+        slab->chunks[slab->chunkCount++] = region + i * chunkSize;
+    return 0;
+}
+
+void* SlabAlloc(SLAB* slab) {
+    SLAB_HEADER* header = slab->freeList;
+    if(header != NULL) {
+        slab->freeList = header->nextFree;
+    } else {
+        header = slabCarve(slab);
+        if(header == NULL)
+            return NULL;
+    }
+
+    header->generation++;
+    header->nextFree = NULL;
+    slab->inUse++;
+    slab->allocs++;
+    return (char*) header + SLAB_HEADER_SIZE;
+}
+
+void SlabFree(SLAB* slab, void* item) {
+    SLAB_HEADER* header = (SLAB_HEADER*)((char*) item - SLAB_HEADER_SIZE);
+    header->generation++;
+    header->nextFree = slab->freeList;
+    slab->freeList = header;
+    slab->inUse--;
+    slab->frees++;
+}
+
+SLAB_HANDLE SlabHandle(void* item) {
+    SLAB_HEADER* header = (SLAB_HEADER*)((char*) item - SLAB_HEADER_SIZE);
+    return (SLAB_HANDLE) header->generation << 32 | header->index;
+}
+
+void* SlabLookup(SLAB* slab, SLAB_HANDLE handle) {
+    uint32_t index = (uint32_t) handle;
+    uint32_t generation = (uint32_t)(handle >> 32);
+    if((generation & 1) == 0 || index >= slab->carved)
+        return NULL;
+
+    SLAB_HEADER* header = slabHeaderAt(slab, index);
+    return header->generation == generation ? (char*) header + SLAB_HEADER_SIZE : NULL;
+}
+
+#endif
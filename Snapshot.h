@@ -0,0 +1,870 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include<stdio.h>
+#include<stdint.h>
+#include<string.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include "PCB.h"
+
+// Snapshot of the whole simulator in one image file. The image is a
+// SNAP_HEADER followed by sections of fixed-size records, each starting
+// on an 8 byte boundary. Records hold no pointers: a process is named
+// by its index in the process section, a message by its index in the
+// message section and its text by an offset in the text section, and a
+// queue by a start and count in the index section, which lists the
+// members of the queue in order. The image is therefore position
+// independent: SnapshotLoad maps the file and reads the records in
+// place, with nothing to parse or byte-swap.
+//
+// The records are not the live structures, though, so the simulator is
+// still rebuilt from them: a PCB per process, a copy of each message,
+// and the lists, run queues and timers that link them. That is kept
+// close to the cost of writing the PCBs once. Everything is sized from
+// the header up front: the PCB chunks in one mapping (or the chunks of
+// the simulator being replaced, whose pages are mapped already), the
+// process table columns and the pid index, which are then filled with
+// plain stores in one pass over the records. A second pass visits only
+// the processes that link to others. Loading into a fresh process still
+// pays a page fault for every page of PCBs, as creating them would, so
+// a load costs about what building the same processes does; what it
+// saves is replaying whatever got them into their states.
+//
+// Processes are stored in allJobs order, which is also the order of
+// every priorityJobs list, and zombies follow them in the order their
+// parents' children lists give. Run queues are stored in the order their
+// policy's walk gives and timers in the order they sit on the wheel, so
+// a restored system schedules and fires exactly as the saved one would.
+// Records are laid out for the build that wrote them; the header keeps
+// their sizes so an image from a different layout is refused.
+
+// Sections of the image, in file order
+enum {
+    SNAP_PROCS,     // SNAP_PROC per process
+    SNAP_CPUS,      // SNAP_CPU per simulated CPU
+    SNAP_SEMS,      // SNAP_SEM per semaphore in use
+    SNAP_HOLDS,     // SNAP_HOLD per HOLD, in each semaphore's holder order
+    SNAP_TIMERS,    // SNAP_TIMER per armed timer
+    SNAP_MESSAGES,  // SNAP_MESSAGE per message in a mailbox or held by a sender
+    SNAP_INDEXES,   // int32_t process indexes that the queues point into
+    SNAP_EXITS,     // EXIT_RECORD per exit kept
+    SNAP_TEXT,      // Message text, NUL terminated, one byte per record
+    NUM_SNAP_SECTIONS
+};
+
+typedef struct {
+    uint64_t offset;    // From the start of the file
+    uint64_t count;     // Records in the section
+} SNAP_SECTION;
+
+typedef struct {
+    int32_t pid;
+    int32_t priority;
+    int32_t state;
+    int32_t cpu;
+    int32_t homeCPU;
+    int32_t receiving;
+    int32_t sendTarget;     // Process index, -1 if none
+    int32_t waitingOn;      // Semaphore id, -1 if none
+    int32_t outgoing;       // Message index, -1 if none
+    int32_t mailCount;      // Messages in its mailbox, oldest first from mailFirst
+    int32_t mailFirst;
+    int32_t sendersFirst;   // Senders waiting on it, in the index section
+    int32_t sendersCount;
+    int32_t cpuBurst;
+    int32_t ioBurst;
+    int32_t waitingChild;
+    int32_t childrenFirst;  // Its children, zombies first, in the index section
+    int32_t childrenCount;
+    int32_t pad;
+    int32_t queueLevel;     // SCHED_ENTITY values; the links are rebuilt
+    int32_t mlfqLevel;
+    int32_t used;
+    int64_t queuedAt;
+    uint64_t vruntime;
+    uint64_t pass;
+    int64_t burstLeft;
+    int64_t workLeft;
+    uint64_t dispatched;
+    uint64_t cpuTime;
+    PROC_METRICS metrics;
+} SNAP_PROC;
+
+typedef struct {
+    int32_t running;        // Process index, -1 when idle
+    int32_t lastRan;        // Process index, -1 if none
+    int32_t queueFirst;     // Run queue, in the index section
+    int32_t queueCount;
+    int64_t ticks;
+    int64_t busyTicks;
+    int64_t migrations;
+    int64_t dispatches;
+    int64_t switches;
+    uint64_t busyTime;
+    uint64_t clock;         // The policy's own time for this run queue
+} SNAP_CPU;
+
+typedef struct {
+    int32_t id;
+    int32_t value;
+    int32_t waitersFirst;   // Waiters, in the index section
+    int32_t waitersCount;
+} SNAP_SEM;
+
+typedef struct {
+    int32_t proc;           // Process index
+    int32_t semaphoreID;
+    int32_t count;
+} SNAP_HOLD;
+
+// Timer owners below 0 are the quantum timer of CPU -1 - owner
+enum { SNAP_QUANTUM, SNAP_BURST, SNAP_WAIT, SNAP_TIMEOUT };
+
+typedef struct {
+    uint64_t expires;
+    int32_t owner;          // Process index, or a CPU as above
+    int32_t kind;           // SNAP_QUANTUM, ... which fire function to call
+} SNAP_TIMER;
+
+typedef struct {
+    uint64_t text;          // Offset in the text section
+    int32_t length;
+    int32_t pad;
+} SNAP_MESSAGE;
+
+typedef struct {
+    char magic[8];          // "PCBSNAP"
+    uint32_t version;
+    uint32_t recordSize[NUM_SNAP_SECTIONS];
+    char policy[32];        // Name of the scheduling policy
+    int32_t numPriorities;
+    int32_t numCPUs;
+    int32_t currentCPU;
+    int32_t quantumTicks;
+    int32_t blockTimeout;
+    int32_t pidMax;
+    int32_t lastPid;        // Where the pid allocator's cursor stands
+    int32_t pidLimit;       // Every pid saved is below it, to size the pid index once
+    uint64_t now;           // Simulated clock
+    int64_t fired;
+    int64_t exitedJobs;
+    int64_t deadlocksFound;
+    HIST turnaround;
+    HIST waiting;
+    HIST response;
+    HIST blocked;
+    SNAP_SECTION sections[NUM_SNAP_SECTIONS];
+} SNAP_HEADER;
+
+#define SNAP_VERSION 3
+
+
+/*
+ * Writes the whole simulator to path as a snapshot image
+ * Only reads the simulator, so it may go on running afterwards
+ * returns 0 for success, -1 for failure
+ */
+int SnapshotSave(const char* path);
+
+
+/*
+ * Replaces the simulator with the one saved in the image at path, along
+    with its policy, priority levels, CPUs, quantum, timeout and pid range
+ * An image that cannot be used leaves the simulator as it was; one that
+    fails part way through restoring leaves it empty
+ * returns 0 for success, -1 for failure
+ */
+int SnapshotLoad(const char* path);
+
+//------------------------------------------------------------------------------------
+
+// Record size of each section, for the header and for checking it
+const uint32_t snapRecordSize[NUM_SNAP_SECTIONS] = {
+    sizeof(SNAP_PROC), sizeof(SNAP_CPU), sizeof(SNAP_SEM), sizeof(SNAP_HOLD),
+    sizeof(SNAP_TIMER), sizeof(SNAP_MESSAGE), sizeof(int32_t), sizeof(EXIT_RECORD), 1
+};
+
+// Index of each process while saving, by procTable slot
+int* snapIndex;
+
+// Image being written
+typedef struct {
+    FILE* f;
+    uint64_t pos;       // Bytes written so far
+    bool failed;
+} SNAP_WRITER;
+
+/*
+ * Helper to append bytes to the image
+ */
+void snapWrite(SNAP_WRITER* w, const void* data, size_t size) {
+    if(size > 0 && fwrite(data, size, 1, w->f) != 1)
+        w->failed = true;
+    w->pos += size;
+}
+
+/*
+ * Helper to pad the image out to the start of a section
+ */
+void snapSeek(SNAP_WRITER* w, uint64_t offset) {
+    static const char zeros[8];
+    while(w->pos < offset)
+        snapWrite(w, zeros, offset - w->pos < 8 ? offset - w->pos : 8);
+}
+
+/*
+ * Helper to get the index a process is saved at, -1 for NULL
+ */
+int32_t snapProc(PCB* block) {
+    return block == NULL ? -1 : snapIndex[block->slot];
+}
+
+/*
+ * Helper to write one member of a run queue, for schedPolicy->walk
+ */
+void snapWriteQueued(SCHED_ENTITY* se, void* arg) {
+    int32_t index = snapProc(se->item);
+    snapWrite(arg, &index, sizeof(index));
+}
+
+/*
+ * Helper to write each member of a list of processes linked by waitLink
+ */
+void snapWriteWaiters(SNAP_WRITER* w, ILIST* list) {
+    for(ILINK* link = list->first; link != NULL; link = link->next) {
+        int32_t index = snapProc(ILIST_ITEM(link, PCB, waitLink));
+        snapWrite(w, &index, sizeof(index));
+    }
+}
+
+/*
+ * Helper to write the children of a process: zombies get the indexes
+    after the live processes, counting on from *zombie
+ */
+void snapWriteChildren(SNAP_WRITER* w, PCB* block, int32_t* zombie) {
+    for(ILINK* link = block->children.first; link != NULL; link = link->next) {
+        PCB* child = ILIST_ITEM(link, PCB, siblingLink);
+        int32_t index = child->state == ZOMBIE ? (*zombie)++ : snapProc(child);
+        snapWrite(w, &index, sizeof(index));
+    }
+}
+
+/*
+ * Helper to write the record of one message and move past its text
+ */
+void snapWriteMessage(SNAP_WRITER* w, MESSAGE* msg, uint64_t* text) {
+    SNAP_MESSAGE record = { *text, msg->length, 0 };
+    snapWrite(w, &record, sizeof(record));
+    *text += msg->length + 1;
+}
+
+int SnapshotSave(const char* path) {
+    SNAP_HEADER header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "PCBSNAP", 8);
+    header.version = SNAP_VERSION;
+    memcpy(header.recordSize, snapRecordSize, sizeof(snapRecordSize));
+    strncpy(header.policy, schedPolicy->name, sizeof(header.policy) - 1);
+    header.numPriorities = numPriorities;
+    header.numCPUs = numCPUs;
+    header.currentCPU = currentCPU;
+    header.quantumTicks = quantumTicks;
+    header.blockTimeout = blockTimeout;
+    header.pidMax = pidMap.pidMax;
+    header.lastPid = pidMap.last;
+    header.pidLimit = pidMap.words * 64 < pidMap.pidMax ? pidMap.words * 64 : pidMap.pidMax;
+    header.now = simClock.now;
+    header.fired = simClock.fired;
+    header.exitedJobs = exitedJobs;
+    header.deadlocksFound = deadlocksFound;
+    header.turnaround = turnaroundHist;
+    header.waiting = waitingHist;
+    header.response = responseHist;
+    header.blocked = blockedHist;
+
+    // Number the processes and size every section
+    snapIndex = malloc((procTable.used > 0 ? procTable.used : 1) * sizeof(int));
+    if(snapIndex == NULL)
+        return -1;
+
+    uint64_t count[NUM_SNAP_SECTIONS] = {0};
+    uint64_t zombies = 0;
+    uint64_t children = 0;
+    for(ILINK* link = allJobs.first; link != NULL; link = link->next) {
+        PCB* block = ILIST_ITEM(link, PCB, jobLink);
+        snapIndex[block->slot] = (int) count[SNAP_PROCS]++;
+        count[SNAP_INDEXES] += IListCount(&block->senders);
+        zombies += block->zombieChildren;
+        children += IListCount(&block->children);
+
+        int mail = MboxCount(&block->mailbox);
+        for(int i=0; i<mail; i++)
+            count[SNAP_TEXT] += block->mailbox.slots[(block->mailbox.head + i) & (MAILBOX_SIZE - 1)]->length + 1;
+        count[SNAP_MESSAGES] += mail;
+        if(block->outgoing != NULL) {
+            count[SNAP_TEXT] += block->outgoing->length + 1;
+            count[SNAP_MESSAGES]++;
+        }
+    }
+    count[SNAP_CPUS] = numCPUs;
+    for(int i=0; i<numCPUs; i++)
+        count[SNAP_INDEXES] += schedPolicy->count(cpus[i].runQueue);
+    for(int i=0; i<semaphoreTableSize; i++) {
+        if(!semaphores[i].inUse)
+            continue;
+        count[SNAP_SEMS]++;
+        count[SNAP_INDEXES] += IListCount(&semaphores[i].waiters);
+        count[SNAP_HOLDS] += IListCount(&semaphores[i].holders);
+    }
+    int32_t childIndexes = (int32_t) count[SNAP_INDEXES];
+    int32_t zombieIndexes = (int32_t) count[SNAP_PROCS];
+    count[SNAP_INDEXES] += children;
+    count[SNAP_PROCS] += zombies;
+    count[SNAP_TIMERS] = simClock.count;
+    count[SNAP_EXITS] = exitRecordCount;
+
+    uint64_t offset = sizeof(SNAP_HEADER);
+    for(int s=0; s<NUM_SNAP_SECTIONS; s++) {
+        offset = (offset + 7) & ~7ULL;
+        header.sections[s].offset = offset;
+        header.sections[s].count = count[s];
+        offset += count[s] * snapRecordSize[s];
+    }
+
+    SNAP_WRITER w = { fopen(path, "wb"), 0, false };
+    if(w.f == NULL) {
+        free(snapIndex);
+        return -1;
+    }
+    snapWrite(&w, &header, sizeof(header));
+
+    // Processes. Queue members go into the index section in the order
+    // it is written below: senders, then run queues, then semaphore
+    // waiters, then children
+    int32_t indexes = 0;
+    int32_t messages = 0;
+    snapSeek(&w, header.sections[SNAP_PROCS].offset);
+    for(ILINK* link = allJobs.first; link != NULL; link = link->next) {
+        PCB* block = ILIST_ITEM(link, PCB, jobLink);
+        SNAP_PROC p;
+        memset(&p, 0, sizeof(p));
+        p.pid = block->pid;
+        p.priority = block->priority;
+        p.state = block->state;
+        p.cpu = block->cpu;
+        p.homeCPU = block->homeCPU;
+        p.receiving = block->receiving;
+        p.sendTarget = snapProc(block->sendTarget);
+        p.waitingOn = block->waitingOn;
+        p.mailFirst = messages;
+        p.mailCount = MboxCount(&block->mailbox);
+        messages += p.mailCount;
+        p.outgoing = block->outgoing != NULL ? messages++ : -1;
+        p.sendersFirst = indexes;
+        p.sendersCount = IListCount(&block->senders);
+        indexes += p.sendersCount;
+        p.cpuBurst = block->cpuBurst;
+        p.ioBurst = block->ioBurst;
+        p.waitingChild = block->waitingChild;
+        p.childrenFirst = childIndexes;
+        p.childrenCount = IListCount(&block->children);
+        childIndexes += p.childrenCount;
+        p.queueLevel = block->sched.queueLevel;
+        p.mlfqLevel = block->sched.mlfqLevel;
+        p.used = block->sched.used;
+        p.queuedAt = block->sched.queuedAt;
+        p.vruntime = block->sched.vruntime;
+        p.pass = block->sched.pass;
+        p.burstLeft = block->burstLeft;
+        p.workLeft = block->workLeft;
+        p.dispatched = block->dispatched;
+        p.cpuTime = block->cpuTime;
+        p.metrics = block->metrics;
+        snapWrite(&w, &p, sizeof(p));
+    }
+    for(ILINK* link = allJobs.first; link != NULL; link = link->next) {
+        for(ILINK* c = ILIST_ITEM(link, PCB, jobLink)->children.first; c != NULL; c = c->next) {
+            PCB* child = ILIST_ITEM(c, PCB, siblingLink);
+            if(child->state != ZOMBIE)
+                break;  // Zombies come first
+            SNAP_PROC p;
+            memset(&p, 0, sizeof(p));
+            p.pid = child->pid;
+            p.priority = child->priority;
+            p.state = ZOMBIE;
+            p.cpu = -1;
+            p.sendTarget = -1;
+            p.waitingOn = -1;
+            p.outgoing = -1;
+            p.metrics = child->metrics;
+            snapWrite(&w, &p, sizeof(p));
+        }
+    }
+
+    snapSeek(&w, header.sections[SNAP_CPUS].offset);
+    for(int i=0; i<numCPUs; i++) {
+        CPU* cpu = &cpus[i];
+        SNAP_CPU c = {
+            snapProc(cpu->running), snapProc(findHandle(cpu->lastRan)), indexes, schedPolicy->count(cpu->runQueue),
+            cpu->ticks, cpu->busyTicks, cpu->migrations, cpu->dispatches, cpu->switches,
+            cpu->busyTime, schedPolicy->get_clock(cpu->runQueue)
+        };
+        indexes += c.queueCount;
+        snapWrite(&w, &c, sizeof(c));
+    }
+
+    snapSeek(&w, header.sections[SNAP_SEMS].offset);
+    for(int i=0; i<semaphoreTableSize; i++) {
+        SEMAPHORE* sem = &semaphores[i];
+        if(!sem->inUse)
+            continue;
+        SNAP_SEM record = { i, sem->value, indexes, IListCount(&sem->waiters) };
+        indexes += record.waitersCount;
+        snapWrite(&w, &record, sizeof(record));
+    }
+
+    snapSeek(&w, header.sections[SNAP_HOLDS].offset);
+    for(int i=0; i<semaphoreTableSize; i++) {
+        if(!semaphores[i].inUse)
+            continue;
+        for(ILINK* link = semaphores[i].holders.first; link != NULL; link = link->next) {
+            HOLD* hold = ILIST_ITEM(link, HOLD, semLink);
+            SNAP_HOLD record = { snapProc(hold->block), hold->semaphoreID, hold->count };
+            snapWrite(&w, &record, sizeof(record));
+        }
+    }
+
+    // Timers in wheel order, which is the order they would fire in
+    snapSeek(&w, header.sections[SNAP_TIMERS].offset);
+    for(int level=0; level<TW_LEVELS; level++) {
+        for(int s=0; s<TW_SLOTS; s++) {
+            for(ILINK* link = simClock.slots[level][s].first; link != NULL; link = link->next) {
+                TIMER* timer = ILIST_ITEM(link, TIMER, link);
+                SNAP_TIMER record = { timer->expires, 0, SNAP_QUANTUM };
+                if(timer->fire == quantumExpired) {
+                    record.owner = -1 - (int32_t)(TIMER_ITEM(timer, CPU, quantumTimer) - cpus);
+                } else {
+                    record.owner = snapProc(TIMER_ITEM(timer, PCB, timer));
+                    record.kind = timer->fire == burstDone ? SNAP_BURST :
+                                  timer->fire == waitDone ? SNAP_WAIT : SNAP_TIMEOUT;
+                }
+                snapWrite(&w, &record, sizeof(record));
+            }
+        }
+    }
+
+    uint64_t text = 0;
+    snapSeek(&w, header.sections[SNAP_MESSAGES].offset);
+    for(ILINK* link = allJobs.first; link != NULL; link = link->next) {
+        PCB* block = ILIST_ITEM(link, PCB, jobLink);
+        int mail = MboxCount(&block->mailbox);
+        for(int i=0; i<mail; i++)
+            snapWriteMessage(&w, block->mailbox.slots[(block->mailbox.head + i) & (MAILBOX_SIZE - 1)], &text);
+        if(block->outgoing != NULL)
+            snapWriteMessage(&w, block->outgoing, &text);
+    }
+
+    snapSeek(&w, header.sections[SNAP_INDEXES].offset);
+    for(ILINK* link = allJobs.first; link != NULL; link = link->next)
+        snapWriteWaiters(&w, &ILIST_ITEM(link, PCB, jobLink)->senders);
+    for(int i=0; i<numCPUs; i++)
+        schedPolicy->walk(cpus[i].runQueue, snapWriteQueued, &w);
+    for(int i=0; i<semaphoreTableSize; i++) {
+        if(semaphores[i].inUse)
+            snapWriteWaiters(&w, &semaphores[i].waiters);
+    }
+    for(ILINK* link = allJobs.first; link != NULL; link = link->next)
+        snapWriteChildren(&w, ILIST_ITEM(link, PCB, jobLink), &zombieIndexes);
+
+    snapSeek(&w, header.sections[SNAP_EXITS].offset);
+    snapWrite(&w, exitRecords, exitRecordCount * sizeof(EXIT_RECORD));
+
+    snapSeek(&w, header.sections[SNAP_TEXT].offset);
+    for(ILINK* link = allJobs.first; link != NULL; link = link->next) {
+        PCB* block = ILIST_ITEM(link, PCB, jobLink);
+        int mail = MboxCount(&block->mailbox);
+        for(int i=0; i<mail; i++) {
+            MESSAGE* msg = block->mailbox.slots[(block->mailbox.head + i) & (MAILBOX_SIZE - 1)];
+            snapWrite(&w, msg->text, msg->length + 1);
+        }
+        if(block->outgoing != NULL)
+            snapWrite(&w, block->outgoing->text, block->outgoing->length + 1);
+    }
+
+    free(snapIndex);
+    snapIndex = NULL;
+    if(fclose(w.f) != 0 || w.failed || w.pos != offset)
+        return -1;
+    return 0;
+}
+
+/*
+ * Helper to check that the sections of a mapped image lie inside it
+ * returns 0 if the image can be used, -1 if not
+ */
+int snapCheckHeader(const SNAP_HEADER* header, uint64_t size) {
+    if(size < sizeof(SNAP_HEADER) || memcmp(header->magic, "PCBSNAP", 8) != 0 ||
+       header->version != SNAP_VERSION ||
+       memcmp(header->recordSize, snapRecordSize, sizeof(snapRecordSize)) != 0)
+        return -1;
+    for(int s=0; s<NUM_SNAP_SECTIONS; s++) {
+        const SNAP_SECTION* section = &header->sections[s];
+        if(section->offset % 8 != 0 || section->offset > size ||
+           section->count > (size - section->offset) / snapRecordSize[s])
+            return -1;
+    }
+    if(header->numCPUs < 1 || header->numCPUs > MAX_CPUS || header->numPriorities < 1 ||
+       header->sections[SNAP_CPUS].count != (uint64_t) header->numCPUs ||
+       header->sections[SNAP_PROCS].count > INT32_MAX || header->pidMax < 2 ||
+       header->lastPid < 0 || header->lastPid >= header->pidMax ||
+       header->pidLimit < 0 || header->pidLimit > header->pidMax)
+        return -1;
+    return 0;
+}
+
+/*
+ * Helper to get a restored process by index
+ * returns NULL if the index is out of range
+ */
+PCB* snapBlock(PCB** blocks, long procs, int32_t index) {
+    return index >= 0 && index < procs ? blocks[index] : NULL;
+}
+
+/*
+ * Helper to check that a queue lies inside the index section
+ */
+bool snapRange(int32_t first, int32_t count, uint64_t indexes) {
+    return first >= 0 && count >= 0 && (uint64_t) first + count <= indexes;
+}
+
+/*
+ * Rebuilds the simulator from a checked image; init_PCB has already
+    set up an empty one with the image's configuration
+ * returns 0 for success, -1 if a record does not fit the rest
+ */
+int snapRestore(const char* image, const SNAP_HEADER* header) {
+    const SNAP_PROC* procs = (const SNAP_PROC*)(image + header->sections[SNAP_PROCS].offset);
+    const SNAP_CPU* cpuRecords = (const SNAP_CPU*)(image + header->sections[SNAP_CPUS].offset);
+    const SNAP_SEM* sems = (const SNAP_SEM*)(image + header->sections[SNAP_SEMS].offset);
+    const SNAP_HOLD* holds = (const SNAP_HOLD*)(image + header->sections[SNAP_HOLDS].offset);
+    const SNAP_TIMER* timers = (const SNAP_TIMER*)(image + header->sections[SNAP_TIMERS].offset);
+    const SNAP_MESSAGE* messages = (const SNAP_MESSAGE*)(image + header->sections[SNAP_MESSAGES].offset);
+    const int32_t* indexes = (const int32_t*)(image + header->sections[SNAP_INDEXES].offset);
+    const char* text = image + header->sections[SNAP_TEXT].offset;
+    long recordCount = (long) header->sections[SNAP_PROCS].count;
+    uint64_t indexCount = header->sections[SNAP_INDEXES].count;
+    uint64_t messageCount = header->sections[SNAP_MESSAGES].count;
+    uint64_t textSize = header->sections[SNAP_TEXT].count;
+
+    // Restored processes by index, and the live ones that link to others
+    PCB** blocks = malloc((recordCount > 0 ? recordCount : 1) * sizeof(PCB*));
+    int32_t* linked = malloc((recordCount > 0 ? recordCount : 1) * sizeof(int32_t));
+    long linkedCount = 0;
+    long runningCount = 0;
+    if(blocks == NULL || linked == NULL) {
+        free(blocks);
+        free(linked);
+        return -1;
+    }
+
+    // Everything the processes go into is sized once from the header:
+    // the PCBs come out of chunks reserved in one piece, and the table
+    // columns and pid index are written directly, the live process at
+    // index i taking slot i of the empty table
+    if(SlabReserve(&pcbSlab, recordCount) != 0 || PTReserve(&procTable, (int) recordCount) != 0 ||
+       (header->pidLimit > 0 && growPidIndex(header->pidLimit - 1) != 0))
+        goto fail;
+
+    // Processes first, with what is theirs alone: the fields, table
+    // columns, pid index and mailbox. Only the live ones, before the
+    // zombies, can be named anywhere but a children list
+    long procCount = recordCount;
+    long made = 0;
+    for(; made<recordCount; made++) {
+        const SNAP_PROC* p = &procs[made];
+        if(p->priority < 0 || p->priority >= numPriorities || p->state < ZOMBIE || p->state > RUNNING ||
+           p->homeCPU < 0 || p->homeCPU >= numCPUs || (made > procCount && p->state != ZOMBIE) ||
+           p->pid >= header->pidLimit || PidMark(&pidMap, p->pid) != 0)
+            goto fail;     // Out of range, or a pid twice
+
+        PCB* block = SlabAlloc(&pcbSlab);
+        if(block == NULL)
+            goto fail;
+        initPCB(block, p->pid, p->priority);
+        block->metrics = p->metrics;
+        blocks[made] = block;
+        if(p->state == ZOMBIE) {
+            block->state = ZOMBIE;
+            if(procCount == recordCount)
+                procCount = made;
+            continue;
+        }
+        block->state = p->state;
+        block->homeCPU = p->homeCPU;
+        block->receiving = p->receiving != 0;
+        block->waitingOn = p->waitingOn;
+        block->waitingChild = p->waitingChild != 0;
+        block->cpuBurst = p->cpuBurst;
+        block->ioBurst = p->ioBurst;
+        block->sched.queueLevel = p->queueLevel;
+        block->sched.mlfqLevel = p->mlfqLevel;
+        block->sched.used = p->used;
+        block->sched.queuedAt = p->queuedAt;
+        block->sched.vruntime = p->vruntime;
+        block->sched.pass = p->pass;
+        block->burstLeft = p->burstLeft;
+        block->workLeft = p->workLeft;
+        block->dispatched = p->dispatched;
+        block->cpuTime = p->cpuTime;
+
+        int slot = (int) made;
+        block->slot = slot;
+        procTable.pid[slot] = block->pid;
+        procTable.priority[slot] = block->priority;
+        procTable.state[slot] = (signed char) block->state;
+        procTable.item[slot] = block;
+        pidIndex[block->pid] = block;
+        IListAppend(&allJobs, &block->jobLink);
+        IListAppend(&priorityJobs[block->priority], &block->priorityLink);
+        if(block->cpuBurst > 0) {
+            profiledJobs++;
+            readyProfiled += block->state == READY;
+        }
+        runningCount += block->state == RUNNING;
+
+        if(p->mailCount < 0 || p->mailCount > MAILBOX_SIZE || p->mailFirst < 0 ||
+           (uint64_t) p->mailFirst + p->mailCount > messageCount || p->outgoing >= (int64_t) messageCount)
+            goto fail;
+        for(int32_t j=0; j<=p->mailCount; j++) {
+            int32_t m = j < p->mailCount ? p->mailFirst + j : p->outgoing;
+            if(m < 0)
+                continue;
+            const SNAP_MESSAGE* record = &messages[m];
+            if(record->length < 0 || record->text >= textSize || (uint64_t) record->length >= textSize - record->text)
+                goto fail;
+            MESSAGE* msg = MsgCreate(text + record->text, record->length);
+            if(msg == NULL)
+                goto fail;
+            if(j < p->mailCount)
+                MboxPut(&block->mailbox, msg);
+            else
+                block->outgoing = msg;
+        }
+        procTable.mail[slot] = MboxCount(&block->mailbox);
+
+        if(p->sendTarget >= 0 || p->sendersCount != 0 || p->childrenCount != 0 ||
+           p->waitingOn >= 0 || p->state == DEADLOCKED)
+            linked[linkedCount++] = (int32_t) made;
+    }
+    procTable.used = procTable.count = (int) procCount;
+
+    // Semaphores and the processes waiting on them
+    for(uint64_t i=0; i<header->sections[SNAP_SEMS].count; i++) {
+        const SNAP_SEM* s = &sems[i];
+        if(s->id < 0 || s->id >= MAX_SEMAPHORES || growSemaphores(s->id) != 0 ||
+           semaphores[s->id].inUse || !snapRange(s->waitersFirst, s->waitersCount, indexCount))
+            goto fail;
+        initSemaphore(&semaphores[s->id], s->value);
+        for(int32_t j=0; j<s->waitersCount; j++) {
+            PCB* waiter = snapBlock(blocks, procCount, indexes[s->waitersFirst + j]);
+            if(waiter == NULL || waiter->waitingOn != s->id)
+                goto fail;
+            IListAppend(&semaphores[s->id].waiters, &waiter->waitLink);
+        }
+    }
+
+    // CPUs, what they run and their run queues in pick order
+    for(int i=0; i<numCPUs; i++) {
+        const SNAP_CPU* c = &cpuRecords[i];
+        CPU* cpu = &cpus[i];
+        if(!snapRange(c->queueFirst, c->queueCount, indexCount))
+            goto fail;
+        cpu->ticks = c->ticks;
+        cpu->busyTicks = c->busyTicks;
+        cpu->migrations = c->migrations;
+        cpu->dispatches = c->dispatches;
+        cpu->switches = c->switches;
+        cpu->busyTime = c->busyTime;
+        PCB* lastRan = snapBlock(blocks, procCount, c->lastRan);
+        cpu->lastRan = lastRan == NULL ? 0 : SlabHandle(lastRan);
+        if(c->running >= 0) {
+            PCB* block = snapBlock(blocks, procCount, c->running);
+            if(block == NULL || block->state != RUNNING || block->cpu >= 0)
+                goto fail;
+            block->cpu = i;
+            cpu->running = block;
+            idleCPUs &= ~(1ULL << i);
+        }
+
+        schedPolicy->set_clock(cpu->runQueue, c->clock);
+        for(int32_t j=0; j<c->queueCount; j++) {
+            PCB* block = snapBlock(blocks, procCount, indexes[c->queueFirst + j]);
+            if(block == NULL || block->state != READY || block->homeCPU != i ||
+               schedPolicy->requeue(cpu->runQueue, &block->sched) != 0)
+                goto fail;
+        }
+        runningCount -= cpu->running != NULL;
+    }
+    if(runningCount != 0)
+        goto fail;  // A RUNNING process no CPU runs
+
+    // Timers in the order they sat on the wheel
+    simClock.now = header->now;
+    simClock.fired = header->fired;
+    for(uint64_t i=0; i<header->sections[SNAP_TIMERS].count; i++) {
+        const SNAP_TIMER* t = &timers[i];
+        if(t->owner < 0) {
+            int cpu = -1 - t->owner;
+            if(cpu >= numCPUs || t->kind != SNAP_QUANTUM || TimerArmed(&cpus[cpu].quantumTimer))
+                goto fail;
+            TWAdd(&simClock, &cpus[cpu].quantumTimer, t->expires);
+            continue;
+        }
+
+        PCB* block = snapBlock(blocks, procCount, t->owner);
+        if(block == NULL || TimerArmed(&block->timer) || t->kind < SNAP_BURST || t->kind > SNAP_TIMEOUT)
+            goto fail;
+        block->timer.fire = t->kind == SNAP_BURST ? burstDone : t->kind == SNAP_WAIT ? waitDone : waitTimedOut;
+        TWAdd(&simClock, &block->timer, t->expires);
+        armedProcessTimers++;
+    }
+
+    // Then the processes that link to others: the senders waiting on
+    // each, the process tree and the counts kept alongside the states.
+    // A parent is always older than its children, so it comes first
+    for(long k=0; k<linkedCount; k++) {
+        long i = linked[k];
+        const SNAP_PROC* p = &procs[i];
+        PCB* block = blocks[i];
+        if(block->waitingOn >= 0 && findSemaphore(block->waitingOn) == NULL)
+            goto fail;
+        if(p->sendTarget >= 0 && (block->sendTarget = snapBlock(blocks, procCount, p->sendTarget)) == NULL)
+            goto fail;
+        if(!snapRange(p->sendersFirst, p->sendersCount, indexCount) ||
+           !snapRange(p->childrenFirst, p->childrenCount, indexCount))
+            goto fail;
+
+        for(int32_t j=0; j<p->sendersCount; j++) {
+            PCB* sender = snapBlock(blocks, procCount, indexes[p->sendersFirst + j]);
+            if(sender == NULL || procs[indexes[p->sendersFirst + j]].sendTarget != i)
+                goto fail;
+            IListAppend(&block->senders, &sender->waitLink);
+        }
+
+        for(int32_t j=0; j<p->childrenCount; j++) {
+            int32_t index = indexes[p->childrenFirst + j];
+            PCB* child = snapBlock(blocks, recordCount, index);
+            if(child == NULL || index <= i || child->parent != NULL ||
+               (child->state == ZOMBIE && block->zombieChildren < j))
+                goto fail;
+            child->parent = block;
+            IListAppend(&block->children, &child->siblingLink);
+            block->zombieChildren += child->state == ZOMBIE;
+        }
+
+        if(block->state != DEADLOCKED)
+            continue;
+        deadlockedCount++;
+        if(block->sendTarget != NULL)
+            block->sendTarget->deadlockedSenders++;
+        if(block->waitingOn >= 0)
+            semaphores[block->waitingOn].deadlockedWaiters++;
+    }
+    for(long i=procCount; i<recordCount; i++) {
+        if(blocks[i]->parent == NULL)
+            goto fail;  // Every zombie has a parent
+    }
+    zombieCount = (int)(recordCount - procCount);
+
+    for(uint64_t i=0; i<header->sections[SNAP_HOLDS].count; i++) {
+        PCB* holder = snapBlock(blocks, procCount, holds[i].proc);
+        if(holder == NULL || findSemaphore(holds[i].semaphoreID) == NULL || holds[i].count < 1)
+            goto fail;
+        addHold(holder, holds[i].semaphoreID);
+        HOLD* hold = findHold(holder, holds[i].semaphoreID);
+        if(hold == NULL)
+            goto fail;
+        hold->count = holds[i].count;
+    }
+    deadlocksFound = header->deadlocksFound;
+
+    uint64_t exits = header->sections[SNAP_EXITS].count;
+    if(exits > 0) {
+        exitRecords = malloc(exits * sizeof(EXIT_RECORD));
+        if(exitRecords == NULL)
+            goto fail;
+        memcpy(exitRecords, image + header->sections[SNAP_EXITS].offset, exits * sizeof(EXIT_RECORD));
+        exitRecordCount = exitRecordCapacity = (int) exits;
+    }
+    exitedJobs = header->exitedJobs;
+    turnaroundHist = header->turnaround;
+    waitingHist = header->waiting;
+    responseHist = header->response;
+    blockedHist = header->blocked;
+    pidMap.last = header->lastPid;
+    currentCPU = header->currentCPU >= 0 && header->currentCPU < numCPUs ? header->currentCPU : 0;
+
+    free(blocks);
+    free(linked);
+    return 0;
+
+fail:
+    free(blocks);
+    free(linked);
+    return -1;
+}
+
+int SnapshotLoad(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return -1;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(SNAP_HEADER)) {
+        close(fd);
+        return -1;
+    }
+    char* image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if(image == MAP_FAILED)
+        return -1;
+
+    const SNAP_HEADER* header = (const SNAP_HEADER*) image;
+    char policy[sizeof(header->policy) + 1];
+    memcpy(policy, header->policy, sizeof(header->policy));
+    policy[sizeof(header->policy)] = '\0';
+    SCHED_POLICY* policyFound = SchedFind(policy);
+    if(snapCheckHeader(header, st.st_size) != 0 || policyFound == NULL) {
+        munmap(image, st.st_size);
+        return -1;
+    }
+
+    // The image replaces everything, configuration included. The PCBs
+    // of the simulator it replaces are freed but their chunks are kept:
+    // carving the new ones from them takes no page faults
+    SLAB pcbs = pcbSlab;
+    SlabInit(&pcbSlab, sizeof(PCB));
+    deinit_PCB();
+    schedPolicy = policyFound;
+    numPriorities = header->numPriorities;
+    numCPUs = header->numCPUs;
+    quantumTicks = header->quantumTicks;
+    blockTimeout = header->blockTimeout;
+    pidMax = header->pidMax;
+    init_PCB();
+    pcbSlab = pcbs;
+    SlabReset(&pcbSlab);
+
+    int result = snapRestore(image, header);
+    munmap(image, st.st_size);
+    if(result != 0) {
+        deinit_PCB();
+        init_PCB();
+    }
+    return result;
+}
+
+#endif
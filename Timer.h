@@ -0,0 +1,237 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include<stddef.h>
+#include "IList.h"
+
+// Hierarchical timer wheel driving the simulated clock. Level 0 has one
+// slot per tick for the next 64 ticks, level 1 one slot per 64 ticks for
+// the next 64*64, and so on. A timer sits in the coarsest slot that
+// still tells it apart from now; when the wheel reaches that slot the
+// timer cascades one level down, so each timer moves at most TW_LEVELS
+// times. A bitmap of occupied slots per level lets the wheel jump
+// straight to the next tick that has work instead of stepping through
+// empty ones. Timers are embedded in their owner like ILINKs, so arming
+// one never allocates, and cancelling one is O(1).
+
+#define TW_BITS 6
+#define TW_SLOTS (1 << TW_BITS)     // One bit per slot in a 64-bit word
+#define TW_MASK (TW_SLOTS - 1)
+#define TW_LEVELS 6                 // 2^36 ticks ahead; later timers wait at the top
+
+typedef struct timer {
+    ILINK link;             // Link on its wheel slot
+    ILIST* slot;            // Slot holding it, NULL while not armed
+    unsigned long long expires;
+    void (*fire)(struct timer* timer);  // Called once the clock reaches expires
+} TIMER;
+
+typedef struct {
+    unsigned long long now;         // Current simulated time, in ticks
+    int count;                      // Timers armed
+    long fired;                     // Timers fired so far
+    unsigned long long occupied[TW_LEVELS];    // Bit s set while slots[level][s] is non-empty
+    ILIST slots[TW_LEVELS][TW_SLOTS];
+} TIMERWHEEL;
+
+// Returns the item of type containing member as its TIMER
+#define TIMER_ITEM(timer, type, member) ((type*)((char*)(timer) - offsetof(type, member)))
+
+
+/*
+ * Make the wheel empty, with the clock at 0
+ */
+void TWInit(TIMERWHEEL* tw);
+
+
+/*
+ * Sets up a timer that calls fire when it expires
+ */
+void TimerInit(TIMER* timer, void (*fire)(TIMER* timer));
+
+
+/*
+ * return 1 if the timer is waiting to fire
+ */
+int TimerArmed(TIMER* timer);
+
+
+/*
+ * Arms timer to fire at time expires, or at once if that has passed
+ * timer must not be armed already
+ * Runs in O(1) time
+ */
+void TWAdd(TIMERWHEEL* tw, TIMER* timer, unsigned long long expires);
+
+
+/*
+ * Disarms timer
+ * returns 1 if it was armed, 0 if not
+ * Runs in O(1) time
+ */
+int TWCancel(TIMERWHEEL* tw, TIMER* timer);
+
+
+/*
+ * returns the next time at which the wheel has work, either a timer
+    expiring or a slot cascading down, ULLONG_MAX if no timer is armed
+ */
+unsigned long long TWNext(TIMERWHEEL* tw);
+
+
+/*
+ * Moves the clock to the next time the wheel has work, if that is no
+    later than until, and fires every timer expiring then
+ * Timers due at the same time fire in a deterministic order; a timer
+    armed for the current time from inside fire goes off in the same step
+ * returns 1 if the clock moved, 0 if nothing is due by until
+ */
+int TWStep(TIMERWHEEL* tw, unsigned long long until);
+
+
+/*
+ * Fires every timer expiring up to until, in time order, then moves
+    the clock to until
+ * returns the number of timers fired
+ */
+long TWAdvance(TIMERWHEEL* tw, unsigned long long until);
+
+//------------------------------------------------------------------------------------
+
+void TWInit(TIMERWHEEL* tw) {
+    tw->now = 0;
+    tw->count = 0;
+    tw->fired = 0;
+    for(int level=0; level<TW_LEVELS; level++) {
+        tw->occupied[level] = 0;
+        for(int s=0; s<TW_SLOTS; s++)
+            IListInit(&tw->slots[level][s]);
+    }
+}
+
+void TimerInit(TIMER* timer, void (*fire)(TIMER* timer)) {
+    timer->slot = NULL;
+    timer->expires = 0;
+    timer->fire = fire;
+}
+
+int TimerArmed(TIMER* timer) {
+    return timer->slot != NULL;
+}
+
+/*
+ * Helper to put an armed timer in the slot matching its distance from now
+ */
+void twPlace(TIMERWHEEL* tw, TIMER* timer) {
+    unsigned long long expires = timer->expires < tw->now ? tw->now : timer->expires;
+    unsigned long long delta = expires - tw->now;
+
+    int level = delta == 0 ? 0 : (63 - __builtin_clzll(delta)) / TW_BITS;
+    if(level >= TW_LEVELS) {
+        // Beyond the top level: wait in its furthest slot and be placed
+        // again when that slot cascades
+        level = TW_LEVELS - 1;
+        expires = tw->now + (1ULL << (TW_BITS * TW_LEVELS)) - 1;
+    }
+
+    int s = (int)((expires >> (TW_BITS * level)) & TW_MASK);
+    timer->slot = &tw->slots[level][s];
+    IListAppend(timer->slot, &timer->link);
+    tw->occupied[level] |= 1ULL << s;
+}
+
+void TWAdd(TIMERWHEEL* tw, TIMER* timer, unsigned long long expires) {
+    timer->expires = expires;
+    twPlace(tw, timer);
+    tw->count++;
+}
+
+int TWCancel(TIMERWHEEL* tw, TIMER* timer) {
+    if(timer->slot == NULL)
+        return 0;
+
+    IListRemove(timer->slot, &timer->link);
+    if(IListCount(timer->slot) == 0) {
+        int index = (int)(timer->slot - &tw->slots[0][0]);
+        tw->occupied[index / TW_SLOTS] &= ~(1ULL << (index % TW_SLOTS));
+    }
+    timer->slot = NULL;
+    tw->count--;
+    return 1;
+}
+
+unsigned long long TWNext(TIMERWHEEL* tw) {
+    unsigned long long next = ~0ULL;
+    if(tw->count == 0)
+        return next;
+
+    for(int level=0; level<TW_LEVELS; level++) {
+        unsigned long long bits = tw->occupied[level];
+        if(bits == 0)
+            continue;
+
+        // Level 0's current slot is due now; a higher level's current
+        // slot comes round again only after a full turn
+        int shift = TW_BITS * level;
+        int current = (int)((tw->now >> shift) & TW_MASK);
+        int start = level == 0 ? current : (current + 1) & TW_MASK;
+        unsigned long long rotated = (bits >> start) | (bits << ((TW_SLOTS - start) & TW_MASK));
+        unsigned long long distance = __builtin_ctzll(rotated) + (level == 0 ? 0 : 1);
+
+        unsigned long long when = level == 0 ? tw->now + distance
+                                             : ((tw->now >> shift) << shift) + (distance << shift);
+        if(when < next)
+            next = when;
+    }
+    return next;
+}
+
+int TWStep(TIMERWHEEL* tw, unsigned long long until) {
+    unsigned long long next = TWNext(tw);
+    if(next == ~0ULL || next > until)
+        return 0;
+    tw->now = next;
+
+    // Cascade from the top so timers dropping through several levels
+    // at this time all reach their final slot
+    for(int level=TW_LEVELS-1; level>=1; level--) {
+        int shift = TW_BITS * level;
+        if((tw->now & ((1ULL << shift) - 1)) != 0)
+            continue;
+
+        int s = (int)((tw->now >> shift) & TW_MASK);
+        ILIST due = tw->slots[level][s];
+        if(IListCount(&due) == 0)
+            continue;
+        IListInit(&tw->slots[level][s]);
+        tw->occupied[level] &= ~(1ULL << s);
+
+        ILINK* link;
+        while((link = IListPop(&due)) != NULL)
+            twPlace(tw, ILIST_ITEM(link, TIMER, link));
+    }
+
+    int s = (int)(tw->now & TW_MASK);
+    ILIST* due = &tw->slots[0][s];
+    ILINK* link;
+    while((link = IListPop(due)) != NULL) {
+        TIMER* timer = ILIST_ITEM(link, TIMER, link);
+        timer->slot = NULL;
+        tw->count--;
+        tw->fired++;
+        timer->fire(timer);
+    }
+    tw->occupied[0] &= ~(1ULL << s);
+    return 1;
+}
+
+long TWAdvance(TIMERWHEEL* tw, unsigned long long until) {
+    long fired = tw->fired;
+    while(TWStep(tw, until))
+        ;
+    if(until > tw->now)
+        tw->now = until;
+    return tw->fired - fired;
+}
+
+#endif
@@ -0,0 +1,304 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<string.h>
+#include<stdbool.h>
+#include<stdatomic.h>
+#include<pthread.h>
+
+// Binary event trace. Each event is one fixed-size TRACE_RECORD written
+// into a block owned by the calling thread, so recording an event takes
+// no lock and makes no call. A full block is handed to a writer thread
+// that appends it to the trace file, and the recording thread carries
+// on with a free block; there are TRACE_BLOCKS blocks in all, so memory
+// stays bounded and a thread only waits if the writer falls that far
+// behind. Records carry a global sequence number, so the blocks of
+// several threads can be merged back into order (replay.c does).
+//
+// File layout: a TRACE_HEADER, then records in block order.
+
+// Kinds of event
+enum {
+    TRACE_STATE,    // pid moved from oldState to state, on cpu if RUNNING
+    TRACE_CREATE,   // pid created, arg = priority
+    TRACE_KILL,     // pid killed or exited
+    TRACE_QUANTUM,  // quantum ended on cpu
+    TRACE_SEND,     // pid sent to arg
+    TRACE_RECEIVE,  // pid asked for a message
+    TRACE_REPLY,    // pid replied to arg
+    TRACE_SEM_P,    // pid did P on semaphore arg
+    TRACE_SEM_V,    // pid did V on semaphore arg
+    NUM_TRACE_EVENTS
+};
+
+typedef struct {
+    uint64_t time;      // Simulated clock
+    uint32_t seq;       // Order of the event across all threads
+    int32_t pid;        // Process acted on, 0 if none
+    int32_t arg;        // Priority, pid or semaphore id, by kind
+    int8_t event;
+    int8_t oldState;    // For other kinds, the state of pid when it happened
+    int8_t state;
+    uint8_t cpu;
+} TRACE_RECORD;
+
+typedef struct {
+    char magic[8];      // "PCBTRACE"
+    uint32_t version;
+    uint32_t recordSize;
+} TRACE_HEADER;
+
+#define TRACE_VERSION 1
+
+// Records per block, and blocks in the ring
+#ifndef TRACE_BLOCK_RECORDS
+#define TRACE_BLOCK_RECORDS 4096
+#endif
+#ifndef TRACE_BLOCKS
+#define TRACE_BLOCKS 16
+#endif
+
+typedef struct traceblock {
+    struct traceblock* next;    // On the full queue or the free stack
+    int count;
+    TRACE_RECORD records[TRACE_BLOCK_RECORDS];
+} TRACE_BLOCK;
+
+// Set while a trace is being recorded; the TRACE macro tests it first,
+// so tracing costs one branch while off
+bool traceEnabled = false;
+
+#define TRACE(event, pid, oldState, state, cpu, arg, time) \
+    do { if(traceEnabled) TraceEmit(event, pid, oldState, state, cpu, arg, time); } while(0)
+
+
+/*
+ * Opens path for a new trace and starts the writer thread
+ * returns 0 for success, -1 for failure
+ */
+int TraceStart(const char* path);
+
+
+/*
+ * Flushes the calling thread's block, waits for the writer to write
+    everything and closes the trace
+ * Other threads that recorded events must call TraceFlushThread first
+ */
+void TraceStop(void);
+
+
+/*
+ * Hands the calling thread's partly filled block to the writer
+ */
+void TraceFlushThread(void);
+
+
+/*
+ * Records one event; use the TRACE macro so nothing happens while
+    tracing is off
+ */
+void TraceEmit(int event, int pid, int oldState, int state, int cpu, int arg, unsigned long long time);
+
+
+/*
+ * Reads a whole trace file into memory
+ * returns the records (caller frees) and sets *count, NULL for failure
+ */
+TRACE_RECORD* TraceLoad(const char* path, long* count);
+
+//------------------------------------------------------------------------------------
+
+// Writer state, shared with the recording threads under traceLock
+FILE* traceFile;
+pthread_t traceWriter;
+pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t traceFull = PTHREAD_COND_INITIALIZER;   // Signalled when a block is queued or on stop
+pthread_cond_t traceFree = PTHREAD_COND_INITIALIZER;   // Signalled when a block is written
+TRACE_BLOCK* traceBlocks;       // All TRACE_BLOCKS blocks
+TRACE_BLOCK* traceFreeBlocks;   // Stack of empty blocks
+TRACE_BLOCK* traceQueueFirst;   // Full blocks waiting to be written, FIFO
+TRACE_BLOCK* traceQueueLast;
+bool traceStopping;
+atomic_uint traceSeq;
+int traceGeneration;            // Bumped by TraceStart so stale thread blocks are dropped
+
+// Block the calling thread is filling, NULL until its first event
+_Thread_local TRACE_BLOCK* traceBlock;
+_Thread_local int traceBlockGeneration;
+
+/*
+ * Writer thread: writes full blocks in the order they were queued
+ */
+void* traceWriterMain(void* arg) {
+    (void) arg;
+    pthread_mutex_lock(&traceLock);
+    for(;;) {
+        while(traceQueueFirst == NULL && !traceStopping)
+            pthread_cond_wait(&traceFull, &traceLock);
+        if(traceQueueFirst == NULL)
+            break;      // Stopping and drained
+
+        TRACE_BLOCK* block = traceQueueFirst;
+        traceQueueFirst = block->next;
+        if(traceQueueFirst == NULL)
+            traceQueueLast = NULL;
+
+        // Write without the lock so recording threads can hand over more
+        pthread_mutex_unlock(&traceLock);
+        fwrite(block->records, sizeof(TRACE_RECORD), block->count, traceFile);
+        pthread_mutex_lock(&traceLock);
+
+        block->count = 0;
+        block->next = traceFreeBlocks;
+        traceFreeBlocks = block;
+        pthread_cond_signal(&traceFree);
+    }
+    pthread_mutex_unlock(&traceLock);
+    return NULL;
+}
+
+int TraceStart(const char* path) {
+    traceFile = fopen(path, "wb");
+    if(traceFile == NULL)
+        return -1;
+
+    TRACE_HEADER header = { "PCBTRACE", TRACE_VERSION, sizeof(TRACE_RECORD) };
+    traceBlocks = malloc(TRACE_BLOCKS * sizeof(TRACE_BLOCK));
+    if(traceBlocks == NULL || fwrite(&header, sizeof(header), 1, traceFile) != 1) {
+        free(traceBlocks);
+        fclose(traceFile);
+        return -1;
+    }
+
+    traceFreeBlocks = NULL;
+    for(int i=0; i<TRACE_BLOCKS; i++) {
+        traceBlocks[i].count = 0;
+        traceBlocks[i].next = traceFreeBlocks;
+        traceFreeBlocks = &traceBlocks[i];
+    }
+    traceQueueFirst = traceQueueLast = NULL;
+    traceStopping = false;
+    atomic_store(&traceSeq, 0);
+    traceGeneration++;
+
+    if(pthread_create(&traceWriter, NULL, traceWriterMain, NULL) != 0) {
+        free(traceBlocks);
+        fclose(traceFile);
+        return -1;
+    }
+    traceEnabled = true;
+    return 0;
+}
+
+/*
+ * Helper to queue a block for the writer and take an empty one,
+    waiting for the writer if every block is full
+ * block may be NULL to only take an empty one
+ */
+TRACE_BLOCK* traceSwap(TRACE_BLOCK* block, bool takeEmpty) {
+    TRACE_BLOCK* empty = NULL;
+    pthread_mutex_lock(&traceLock);
+    if(block != NULL && block->count > 0) {
+        block->next = NULL;
+        if(traceQueueLast == NULL)
+            traceQueueFirst = block;
+        else
+            traceQueueLast->next = block;
+        traceQueueLast = block;
+        pthread_cond_signal(&traceFull);
+    } else if(block != NULL) {
+        block->next = traceFreeBlocks;
+        traceFreeBlocks = block;
+    }
+
+    if(takeEmpty) {
+        while(traceFreeBlocks == NULL)
+            pthread_cond_wait(&traceFree, &traceLock);
+        empty = traceFreeBlocks;
+        traceFreeBlocks = empty->next;
+        empty->count = 0;
+    }
+    pthread_mutex_unlock(&traceLock);
+    return empty;
+}
+
+void TraceFlushThread(void) {
+    if(traceEnabled && traceBlock != NULL && traceBlockGeneration == traceGeneration)
+        traceSwap(traceBlock, false);
+    traceBlock = NULL;
+}
+
+void TraceStop(void) {
+    if(!traceEnabled)
+        return;
+    TraceFlushThread();
+    traceEnabled = false;
+
+    pthread_mutex_lock(&traceLock);
+    traceStopping = true;
+    pthread_cond_signal(&traceFull);
+    pthread_mutex_unlock(&traceLock);
+    pthread_join(traceWriter, NULL);
+
+    fclose(traceFile);
+    traceFile = NULL;
+    free(traceBlocks);
+    traceBlocks = NULL;
+}
+
+void TraceEmit(int event, int pid, int oldState, int state, int cpu, int arg, unsigned long long time) {
+    TRACE_BLOCK* block = traceBlock;
+    if(block == NULL || traceBlockGeneration != traceGeneration) {
+        block = traceBlock = traceSwap(NULL, true);
+        traceBlockGeneration = traceGeneration;
+    } else if(block->count == TRACE_BLOCK_RECORDS) {
+        block = traceBlock = traceSwap(block, true);
+    }
+
+    TRACE_RECORD* r = &block->records[block->count++];
+    r->time = time;
+    r->seq = atomic_fetch_add_explicit(&traceSeq, 1, memory_order_relaxed);
+    r->pid = pid;
+    r->arg = arg;
+    r->event = (int8_t) event;
+    r->oldState = (int8_t) oldState;
+    r->state = (int8_t) state;
+    r->cpu = (uint8_t) cpu;
+}
+
+TRACE_RECORD* TraceLoad(const char* path, long* count) {
+    FILE* f = fopen(path, "rb");
+    if(f == NULL)
+        return NULL;
+
+    TRACE_HEADER header;
+    if(fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, "PCBTRACE", 8) != 0 ||
+       header.version != TRACE_VERSION || header.recordSize != sizeof(TRACE_RECORD)) {
+        fclose(f);
+        return NULL;
+    }
+
+    long capacity = 1 << 16;
+    long used = 0;
+    TRACE_RECORD* records = malloc(capacity * sizeof(TRACE_RECORD));
+    size_t got;
+    while(records != NULL && (got = fread(records + used, sizeof(TRACE_RECORD), capacity - used, f)) > 0) {
+        used += (long) got;
+        if(used == capacity) {
+            capacity *= 2;
+            TRACE_RECORD* grown = realloc(records, capacity * sizeof(TRACE_RECORD));
+            if(grown == NULL)
+                free(records);
+            records = grown;
+        }
+    }
+    fclose(f);
+
+    *count = used;
+    return records;
+}
+
+#endif
@@ -0,0 +1,988 @@
+/*
+ * Benchmark suite for the PCB simulator
+ * Build: cc -O2 -pthread -o bench bench.c
+ * Run:   ./bench [-j] [-n ops] [-r seed] [-s policy] [-w workload] [-m count] [-u cpus] [-t trace]
+ *   -j          print results as JSON
+ *   -n ops      operations per workload (default 200000)
+ *   -r seed     seed for the workload generator (default 1)
+ *   -s policy   scheduling policy
+ *   -w workload run only one workload
+ *   -m count    semaphores the workloads contend on (default 5)
+ *   -u cpus     simulated CPUs (default 1)
+ *   -t trace    record an event trace of the workloads, to measure its cost
+ */
+#include <time.h>
+#include "Engine.h"
+#include "CList.h"
+#include "Snapshot.h"
+
+// Operation types measured by the workloads
+enum {
+    OP_CREATE, OP_FORK, OP_KILL, OP_EXIT, OP_QUANTUM,
+    OP_SEND, OP_RECEIVE, OP_REPLY, OP_SEM_P, OP_SEM_V, OP_WAIT, OP_KILLTREE,
+    NUM_OPS
+};
+
+const char* opNames[NUM_OPS] = {
+    "create", "fork", "kill", "exit", "quantum",
+    "send", "receive", "reply", "semP", "semV", "wait", "killtree"
+};
+
+// A workload is a weight per operation type, plus a starting population
+typedef struct {
+    const char* name;
+    int initialJobs;
+    int weights[NUM_OPS];
+} WORKLOAD;
+
+WORKLOAD workloads[] = {
+    //                      create fork kill exit quantum send recv reply P   V  wait tree
+    { "create-heavy",    0, {  90,   0,   0,   0,  10,    0,   0,   0,    0,  0,   0,  0 } },
+    { "ipc-heavy",    1000, {   0,   0,   0,   0,  10,   35,  25,  30,    0,  0,   0,  0 } },
+    { "semaphore",    1000, {   0,   0,   0,   0,  20,    0,   0,   0,   40, 40,   0,  0 } },
+    { "fork-bomb",       1, {   0,  70,   0,  10,  20,    0,   0,   0,    0,  0,   0,  0 } },
+    { "process-tree",   10, {   0,  45,   0,  15,  20,    0,   0,   0,    0,  0,  15,  5 } },
+    { "mixed",         100, {  15,   5,  10,   5,  25,   10,  10,  10,    5,  5,   0,  0 } },
+};
+#define NUM_WORKLOADS (int)(sizeof(workloads) / sizeof(workloads[0]))
+
+// Latency samples of one run, per operation type
+typedef struct {
+    unsigned int* samples[NUM_OPS];     // Nanoseconds per operation
+    long count[NUM_OPS];
+    double seconds;                     // Wall time of all operations
+    long peakMemoryKB;                  // Held by the simulator's allocators and tables
+    long peakJobs;
+    double busy;                        // Fraction of CPU quanta spent running
+    long migrations;                    // Processes stolen between CPUs
+    long pcbAllocs;                     // PCBs taken from and given back to pcbSlab
+    long pcbFrees;
+    long pcbSlabObjects;                // PCBs the slab carved, live or free
+} RESULT;
+
+unsigned long long rngState;
+int numSemaphores = 5;
+
+/*
+ * xorshift64* generator, so runs are reproducible for a given seed
+ */
+unsigned long long rngStep(unsigned long long* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+unsigned long long rngNext(void) {
+    return rngStep(&rngState);
+}
+
+int rngBelow(int n) {
+    return (int)(rngNext() % (unsigned long long) n);
+}
+
+/*
+ * Helper function returning a monotonic timestamp in seconds
+ */
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+long long nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Returns the bytes held by the simulator's allocators and tables: the
+    PCB slab, the message arena, the process table columns, the pid
+    index and pid map, and the semaphore table
+ * None of them gives memory back before deinit_PCB, so at the end of a
+    run this is the run's peak. Unlike the process's peak RSS, it counts
+    only the run, not the benchmarks before it
+ */
+long simulatorBytes(void) {
+    long bytes = (long) pcbSlab.chunkCount * SLAB_CHUNK_OBJECTS * pcbSlab.stride;
+    bytes += (long) msgArenaBytes;
+    bytes += (long) procTable.capacity * (4 * sizeof(int) + sizeof(signed char) + sizeof(void*));
+    bytes += (long) pidIndexSize * sizeof(PCB*);
+    bytes += (long)(pidMap.words + (pidMap.words + 63) / 64) * sizeof(uint64_t);
+    bytes += (long) semaphoreTableSize * sizeof(SEMAPHORE);
+    return bytes;
+}
+
+/*
+ * Picks an operation type according to the workload's weights
+ */
+int pickOpFrom(WORKLOAD* w, unsigned long long* state) {
+    int total = 0;
+    for(int i=0; i<NUM_OPS; i++)
+        total += w->weights[i];
+
+    int r = (int)(rngStep(state) % (unsigned long long) total);
+    for(int i=0; i<NUM_OPS; i++) {
+        if(r < w->weights[i])
+            return i;
+        r -= w->weights[i];
+    }
+    return OP_QUANTUM;
+}
+
+int pickOp(WORKLOAD* w) {
+    return pickOpFrom(w, &rngState);
+}
+
+/*
+ * Performs one operation with arguments drawn from the generator
+ */
+void doOp(int op) {
+    static const char text[] = "benchmark message";
+    // The pid of a random slot; a free slot keeps its last process's pid,
+    // so some operations name a process that has exited
+    int pid = procTable.used > 0 ? procTable.pid[rngBelow(procTable.used)] : 1;
+
+    switch(op) {
+        case OP_CREATE:  create(rngBelow(numPriorities)); break;
+        case OP_FORK:    PCB_fork(); break;
+        case OP_KILL:    PCB_kill(pid); break;
+        case OP_EXIT:    PCB_exit(); break;
+        case OP_QUANTUM: PCB_quantum(); break;
+        case OP_SEND:    PCBsend(pid, MsgCreate(text, sizeof(text) - 1)); break;
+        case OP_RECEIVE: PCB_receive(); break;
+        case OP_REPLY:   PCB_reply(pid, MsgCreate(text, sizeof(text) - 1)); break;
+        case OP_SEM_P:   PCB_semaphoreP(rngBelow(numSemaphores)); break;
+        case OP_SEM_V:   PCB_semaphoreV(rngBelow(numSemaphores)); break;
+        case OP_WAIT:    PCB_wait(); break;
+        case OP_KILLTREE: PCB_killTree(pid); break;
+    }
+}
+
+int compareSamples(const void* a, const void* b) {
+    unsigned int x = *(const unsigned int*) a;
+    unsigned int y = *(const unsigned int*) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Returns the p-th percentile of the sorted samples of op
+ */
+unsigned int percentile(RESULT* r, int op, double p) {
+    if(r->count[op] == 0)
+        return 0;
+    long i = (long)(p * (r->count[op] - 1));
+    return r->samples[op][i];
+}
+
+/*
+ * Runs ops operations of workload w on a fresh simulator
+ * Returns 0 for success, -1 for failure
+ */
+int runWorkload(WORKLOAD* w, long ops, RESULT* r) {
+    memset(r, 0, sizeof(RESULT));
+    for(int i=0; i<NUM_OPS; i++) {
+        r->samples[i] = malloc(ops * sizeof(unsigned int));
+        if(r->samples[i] == NULL)
+            return -1;
+    }
+
+    init();
+    init_PCB();
+    for(int i=0; i<w->initialJobs; i++)
+        create(rngBelow(numPriorities));
+    for(int i=0; i<numSemaphores; i++)
+        PCB_newSemaphore(i, 1);
+
+    double start = now();
+    for(long i=0; i<ops; i++) {
+        int op = pickOp(w);
+        long long t0 = nowNs();
+        doOp(op);
+        long long t1 = nowNs();
+        r->samples[op][r->count[op]++] = (unsigned int)(t1 - t0);
+
+        if(IListCount(&allJobs) > r->peakJobs)
+            r->peakJobs = IListCount(&allJobs);
+    }
+    r->seconds = now() - start;
+    r->peakMemoryKB = simulatorBytes() / 1024;
+
+    for(int i=0; i<NUM_OPS; i++)
+        qsort(r->samples[i], r->count[i], sizeof(unsigned int), compareSamples);
+
+    long ticks = 0;
+    long busyTicks = 0;
+    for(int i=0; i<numCPUs; i++) {
+        ticks += cpus[i].ticks;
+        busyTicks += cpus[i].busyTicks;
+        r->migrations += cpus[i].migrations;
+    }
+    r->busy = ticks == 0 ? 0.0 : (double) busyTicks / ticks;
+
+    // Every PCB not on allJobs or a zombie must have gone back to the slab
+    r->pcbAllocs = pcbSlab.allocs;
+    r->pcbFrees = pcbSlab.frees;
+    r->pcbSlabObjects = pcbSlab.carved;
+    long leaked = pcbSlab.inUse - IListCount(&allJobs) - zombieCount;
+
+    deinit_PCB();
+    deinit();
+    if(leaked != 0) {
+        fprintf(stderr, "%s: %ld PCBs leaked\n", w->name, leaked);
+        return -1;
+    }
+    return 0;
+}
+
+void freeResult(RESULT* r) {
+    for(int i=0; i<NUM_OPS; i++)
+        free(r->samples[i]);
+}
+
+/*
+ * Creates n PCBs on a fresh simulator and reports the create throughput
+ * Returns 0 for success, -1 if a create failed
+ */
+int benchCreate(int n, bool json, bool last) {
+    init();
+    init_PCB();
+
+    double start = now();
+    for(int i=0; i<n; i++) {
+        if(create(i % numPriorities) == 0) {
+            fprintf(stderr, "create failed after %d PCBs\n", i);
+            deinit_PCB();
+            deinit();
+            return -1;
+        }
+    }
+    double elapsed = now() - start;
+
+    if(json) {
+        printf("    {\"pcbs\": %d, \"seconds\": %.6f, \"creates_per_sec\": %.0f}%s\n",
+               n, elapsed, n / elapsed, last ? "" : ",");
+    } else {
+        printf("create %8d PCBs: %9.6f s, %12.0f creates/s\n",
+               n, elapsed, n / elapsed);
+    }
+
+    deinit_PCB();
+    deinit();
+    return 0;
+}
+
+/*
+ * Counts the READY processes among n, once by walking allJobs and then
+    over procTable's state column with the scalar and the selected
+    vector kernels, reporting the time per process of each
+ * Also times a find of an absent state (a full scan) and a filter by
+    priority with the selected kernels, in microseconds per query
+ * Returns 0 for success, -1 if a create failed
+ */
+int benchScan(int n, bool json, bool last) {
+    init();
+    init_PCB();
+    for(int i=0; i<n; i++) {
+        if(create(i % numPriorities) == 0) {
+            fprintf(stderr, "create failed after %d PCBs\n", i);
+            deinit_PCB();
+            deinit();
+            return -1;
+        }
+    }
+
+    // Enough passes that each method runs for a measurable time
+    int passes = n >= 20000000 ? 1 : 20000000 / n;
+    volatile long sink = 0;
+
+    double start = now();
+    for(int p=0; p<passes; p++) {
+        long ready = 0;
+        for(ILINK* link = allJobs.first; link != NULL; link = link->next)
+            ready += ILIST_ITEM(link, PCB, jobLink)->state == READY;
+        sink += ready;
+    }
+    double listNs = (now() - start) * 1e9 / ((double) passes * n);
+
+    start = now();
+    for(int p=0; p<passes; p++)
+        sink += ptScalarKernels.countState(&procTable, READY);
+    double scalarNs = (now() - start) * 1e9 / ((double) passes * n);
+
+    PT_KERNELS* kernels = PTKernels();
+    start = now();
+    for(int p=0; p<passes; p++)
+        sink += kernels->countState(&procTable, READY);
+    double vectorNs = (now() - start) * 1e9 / ((double) passes * n);
+
+    start = now();
+    for(int p=0; p<passes; p++)
+        sink += kernels->findState(&procTable, DEADLOCKED, 0);
+    double findUs = (now() - start) * 1e6 / passes;
+
+    int* slots = malloc(n * sizeof(int));
+    if(slots == NULL) {
+        deinit_PCB();
+        deinit();
+        return -1;
+    }
+    start = now();
+    for(int p=0; p<passes; p++)
+        sink += kernels->filter(&procTable, PT_ANY, 1, slots, n);
+    double filterUs = (now() - start) * 1e6 / passes;
+    free(slots);
+
+    // Every backend must treat a negative from as 0
+    ptKernels = &ptScalarKernels;
+    for(int state=DEADLOCKED; state<=RUNNING; state++) {
+        if(PTFindState(&procTable, state, -1) != kernels->findState(&procTable, state, 0)) {
+            fprintf(stderr, "scalar find from -1 differs from %s\n", kernels->name);
+            ptKernels = kernels;
+            deinit_PCB();
+            deinit();
+            return -1;
+        }
+    }
+    ptKernels = kernels;
+
+    if(json) {
+        printf("    {\"pcbs\": %d, \"kernels\": \"%s\", \"list_ns_per_pcb\": %.3f, "
+               "\"scalar_ns_per_pcb\": %.3f, \"vector_ns_per_pcb\": %.3f, "
+               "\"find_us\": %.3f, \"filter_us\": %.3f}%s\n",
+               n, kernels->name, listNs, scalarNs, vectorNs, findUs, filterUs, last ? "" : ",");
+    } else {
+        printf("scan   %8d PCBs: list %7.3f, scalar %7.3f, %s %7.3f ns/PCB; find %.1f us, filter %.1f us\n",
+               n, listNs, scalarNs, kernels->name, vectorNs, findUs, filterUs);
+    }
+
+    deinit_PCB();
+    deinit();
+    return 0;
+}
+
+// Burst profiles for benchClock: CPU burst, IO burst
+const int burstProfiles[3][2] = {
+    { 40, 0 },      // CPU bound
+    { 10, 10 },     // Mixed
+    { 2, 30 },      // Interactive
+};
+
+/*
+ * Runs n profiled jobs on the simulated clock until they all finish,
+    reporting how fast the timer events are processed and how busy
+    the CPUs were
+ * Returns 0 for success, -1 for failure
+ */
+int benchClock(int n, unsigned long long seed, bool json, bool last) {
+    unsigned long long rng = seed;
+    init();
+    init_PCB();
+    for(int i=0; i<n; i++) {
+        const int* profile = burstProfiles[i % 3];
+        long work = 50 + (long)(rngStep(&rng) % 451);
+        if(PCB_createJob(i % numPriorities, profile[0], profile[1], work) == 0) {
+            fprintf(stderr, "create failed after %d jobs\n", i);
+            deinit_PCB();
+            deinit();
+            return -1;
+        }
+    }
+
+    double start = now();
+    long events = PCB_advance(0);
+    double elapsed = now() - start;
+
+    unsigned long long busy = 0;
+    for(int i=0; i<numCPUs; i++)
+        busy += cpus[i].busyTime;
+    double utilisation = simClock.now == 0 ? 0.0 : (double) busy / ((double) simClock.now * numCPUs);
+    int unfinished = profiledJobs;
+
+    if(json) {
+        printf("    {\"jobs\": %d, \"events\": %ld, \"seconds\": %.6f, \"events_per_sec\": %.0f, "
+               "\"ticks\": %llu, \"cpu_busy\": %.4f, \"unfinished\": %d}%s\n",
+               n, events, elapsed, events / elapsed, simClock.now, utilisation, unfinished, last ? "" : ",");
+    } else {
+        printf("clock  %8d jobs: %9.6f s, %12.0f events/s, %llu ticks, %.1f%% busy",
+               n, elapsed, events / elapsed, simClock.now, 100.0 * utilisation);
+        if(unfinished > 0)
+            printf(", %d unfinished", unfinished);
+        printf("\n");
+    }
+
+    deinit_PCB();
+    deinit();
+    return 0;
+}
+
+/*
+ * Builds n processes with create, one in four with a message waiting,
+    then times saving them to a snapshot image and loading it twice:
+    over the simulator it was saved from, which hands its PCB memory on,
+    and into an empty one, which has to fault in the pages like create
+ * A second row compares the cold load with creating the processes
+ */
+int benchSnapshot(int n, bool json, bool last) {
+    char path[] = "/tmp/pcbsnapXXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0) {
+        perror("mkstemp");
+        return -1;
+    }
+    close(fd);
+
+    init();
+    init_PCB();
+    double start = now();
+    for(int i=0; i<n; i++) {
+        if(create(i % numPriorities) == 0) {
+            fprintf(stderr, "create failed after %d PCBs\n", i);
+            unlink(path);
+            deinit_PCB();
+            deinit();
+            return -1;
+        }
+    }
+    double created = now() - start;
+    for(int pid=2; pid<=n; pid+=4)
+        PCBsend(pid, MsgCreate("snapshot", 8));
+
+    start = now();
+    int saved = SnapshotSave(path);
+    double saving = now() - start;
+    start = now();
+    int loaded = saved == 0 ? SnapshotLoad(path) : -1;
+    double loading = now() - start;
+    if(loaded == 0 && IListCount(&allJobs) != n)
+        loaded = -1;
+
+    deinit_PCB();
+    init_PCB();
+    start = now();
+    if(loaded == 0)
+        loaded = SnapshotLoad(path);
+    double coldLoading = now() - start;
+
+    struct stat st;
+    long size = stat(path, &st) == 0 ? (long) st.st_size : 0;
+    unlink(path);
+    if(loaded != 0 || IListCount(&allJobs) != n) {
+        fprintf(stderr, "snapshot of %d PCBs failed\n", n);
+        deinit_PCB();
+        deinit();
+        return -1;
+    }
+
+    if(json) {
+        printf("    {\"pcbs\": %d, \"create_seconds\": %.6f, \"save_seconds\": %.6f, "
+               "\"load_seconds\": %.6f, \"cold_load_seconds\": %.6f, \"cold_load_vs_create\": %.3f, "
+               "\"image_bytes\": %ld}%s\n",
+               n, created, saving, loading, coldLoading, coldLoading / created, size, last ? "" : ",");
+    } else {
+        printf("snapshot %6d PCBs: create %9.6f s, save %9.6f s, load %9.6f s, cold load %9.6f s, %ld bytes\n",
+               n, created, saving, loading, coldLoading, size);
+        printf("snapshot %6d PCBs: cold load %9.6f s vs create %9.6f s, %.2fx\n",
+               n, coldLoading, created, coldLoading / created);
+    }
+
+    deinit_PCB();
+    deinit();
+    return 0;
+}
+
+/*
+ * Runs n profiled jobs on the simulated clock, saving a snapshot half
+    way, then runs on to the end both from where it saved and from the
+    image
+ * Saving must leave the simulator as it was, so both runs have to end
+    at the same tick with the same exits
+ * Returns 0 for success, -1 for failure
+ */
+int benchResume(int n, unsigned long long seed, bool json, bool last) {
+    char path[] = "/tmp/pcbsnapXXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0) {
+        perror("mkstemp");
+        return -1;
+    }
+    close(fd);
+
+    unsigned long long rng = seed;
+    long totalWork = 0;
+    init();
+    init_PCB();
+    for(int i=0; i<n; i++) {
+        const int* profile = burstProfiles[i % 3];
+        long work = 50 + (long)(rngStep(&rng) % 451);
+        totalWork += work;
+        if(PCB_createJob(i % numPriorities, profile[0], profile[1], work) == 0) {
+            fprintf(stderr, "create failed after %d jobs\n", i);
+            unlink(path);
+            deinit_PCB();
+            deinit();
+            return -1;
+        }
+    }
+
+    // About half the work, had the CPUs been busy all along
+    PCB_advance(totalWork / (2 * numCPUs));
+    unsigned long long savedAt = simClock.now;
+    int armed = armedProcessTimers;
+    double start = now();
+    int saved = SnapshotSave(path);
+    double saving = now() - start;
+    bool untouched = saved == 0 && armedProcessTimers == armed && PCB_checkInvariants() == 0;
+
+    PCB_advance(0);
+    unsigned long long endedAt = simClock.now;
+    long exits = exitedJobs;
+
+    start = now();
+    int loaded = saved == 0 ? SnapshotLoad(path) : -1;
+    double loading = now() - start;
+    unlink(path);
+    if(loaded == 0)
+        PCB_advance(0);
+    bool same = loaded == 0 && simClock.now == endedAt && exitedJobs == exits && PCB_checkInvariants() == 0;
+
+    deinit_PCB();
+    deinit();
+    if(!untouched || !same) {
+        fprintf(stderr, "resuming %d jobs from a snapshot failed: %s\n",
+                n, untouched ? "the runs ended differently" : "saving changed the simulator");
+        return -1;
+    }
+
+    if(json) {
+        printf("    {\"jobs\": %d, \"saved_at\": %llu, \"ended_at\": %llu, \"save_seconds\": %.6f, "
+               "\"load_seconds\": %.6f}%s\n",
+               n, savedAt, endedAt, saving, loading, last ? "" : ",");
+    } else {
+        printf("resume   %6d jobs: saved at tick %llu in %9.6f s, loaded in %9.6f s, both ended at tick %llu\n",
+               n, savedAt, saving, loading, endedAt);
+    }
+    return 0;
+}
+
+/*
+ * Takes fill of the pids of a PID_MAX map, then times ops rounds of
+    freeing a random taken pid and allocating another, which keeps the
+    map that full
+ * Returns 0 for success, -1 for failure
+ */
+int benchPidMap(double fill, long ops, bool json, bool last) {
+    int taken = (int)(fill * (PID_MAX - 1));
+    int* pids = malloc((taken > 0 ? taken : 1) * sizeof(int));
+    if(pids == NULL)
+        return -1;
+
+    PIDMAP map;
+    PidMapInit(&map, PID_MAX);
+    double start = now();
+    for(int i=0; i<taken; i++)
+        pids[i] = PidAlloc(&map);
+    double filling = now() - start;
+
+    start = now();
+    for(long i=0; i<ops && taken > 0; i++) {
+        int victim = rngBelow(taken);
+        PidFree(&map, pids[victim]);
+        pids[victim] = PidAlloc(&map);
+    }
+    double churn = now() - start;
+    bool exhausted = taken > 0 && (pids[taken - 1] == 0 || map.count != taken);
+    PidMapFree(&map);
+    free(pids);
+    if(exhausted) {
+        fprintf(stderr, "pid map ran out at %.4f full\n", fill);
+        return -1;
+    }
+
+    if(json) {
+        printf("    {\"pid_max\": %d, \"fill\": %.4f, \"fill_seconds\": %.6f, \"ops\": %ld, "
+               "\"churn_ns_per_op\": %.1f}%s\n",
+               PID_MAX, fill, filling, ops, churn * 1e9 / ops, last ? "" : ",");
+    } else {
+        printf("pidmap %5.2f%% of %d: fill %9.6f s, free+alloc %8.1f ns\n",
+               100.0 * fill, PID_MAX, filling, churn * 1e9 / ops);
+    }
+    return 0;
+}
+
+// Command letter for each operation type, for the engine clients
+const char opCommands[NUM_OPS] = { 'C', 'F', 'K', 'E', 'Q', 'S', 'R', 'Y', 'P', 'V', 'W', 'X' };
+
+// One load generator thread of benchEngine
+typedef struct {
+    ENGINE* engine;
+    long ops;
+    unsigned long long rng;
+} ENGINE_LOAD;
+
+/*
+ * Load generator: submits ops commands drawn from the mixed workload,
+    keeping a window of them in flight
+ */
+void* engineLoad(void* arg) {
+    ENGINE_LOAD* load = arg;
+    static char text[] = "benchmark message";
+    ENGINE_CLIENT client;
+    if(EngineClientInit(&client, 256) != 0)
+        return NULL;
+
+    WORKLOAD* mixed = &workloads[NUM_WORKLOADS - 1];
+    for(long i=0; i<load->ops; i++) {
+        int op = pickOpFrom(mixed, &load->rng);
+        unsigned long long r = rngStep(&load->rng);
+        COMMAND cmd = { opCommands[op], 0, NULL, 0 };
+
+        if(op == OP_CREATE)
+            cmd.arg = (int)(r % numPriorities);
+        else if(op == OP_SEM_P || op == OP_SEM_V)
+            cmd.arg = (int)(r % numSemaphores);
+        else
+            cmd.arg = (int)(r % 1000) + 1;     // pid
+        if(op == OP_SEND || op == OP_REPLY) {
+            cmd.msg = text;
+            cmd.msgLen = sizeof(text) - 1;
+        }
+
+        EngineSubmit(load->engine, &client, &cmd);
+    }
+
+    EngineWait(&client, client.submitted);
+    EngineClientFree(&client);
+    return NULL;
+}
+
+/*
+ * Drives the simulator from clients load generator threads through the
+    engine thread, ops commands in total, and reports the throughput
+ * Returns 0 for success, -1 for failure
+ */
+int benchEngine(int clients, long ops, unsigned long long seed, bool json, bool last) {
+    init();
+    init_PCB();
+    for(int i=0; i<100; i++)
+        create(i % numPriorities);
+    for(int i=0; i<numSemaphores; i++)
+        PCB_newSemaphore(i, 1);
+
+    ENGINE engine;
+    pthread_t threads[64];
+    ENGINE_LOAD loads[64];
+    if(clients > 64 || EngineStart(&engine) != 0) {
+        deinit_PCB();
+        deinit();
+        return -1;
+    }
+
+    double start = now();
+    for(int i=0; i<clients; i++) {
+        loads[i].engine = &engine;
+        loads[i].ops = ops / clients;
+        loads[i].rng = seed + i;
+        pthread_create(&threads[i], NULL, engineLoad, &loads[i]);
+    }
+    for(int i=0; i<clients; i++)
+        pthread_join(threads[i], NULL);
+    double elapsed = now() - start;
+    EngineStop(&engine);
+
+    double perBatch = engine.batches == 0 ? 0.0 : (double) engine.executed / engine.batches;
+    if(json) {
+        printf("    {\"clients\": %d, \"commands\": %ld, \"seconds\": %.6f, \"commands_per_sec\": %.0f, "
+               "\"commands_per_batch\": %.1f}%s\n",
+               clients, engine.executed, elapsed, engine.executed / elapsed, perBatch, last ? "" : ",");
+    } else {
+        printf("engine %8d clients: %9.6f s, %12.0f commands/s, %.1f commands per batch\n",
+               clients, elapsed, engine.executed / elapsed, perBatch);
+    }
+
+    deinit_PCB();
+    deinit();
+    return 0;
+}
+
+// One worker thread of benchQueue
+typedef struct {
+    CQUEUE* queue;          // Lock-free queue, or NULL for the locked list
+    LIST* list;
+    pthread_mutex_t* lock;
+    long pairs;
+} QUEUE_LOAD;
+
+/*
+ * Queue worker: appends an item and takes one off the front, pairs times
+ */
+void* queueLoad(void* arg) {
+    QUEUE_LOAD* load = arg;
+    static int item;
+
+    for(long i=0; i<load->pairs; i++) {
+        if(load->queue != NULL) {
+            CQueueEnqueue(load->queue, &item);
+            CQueueDequeue(load->queue);
+        } else {
+            // List.h pools are global, so one lock covers every list
+            pthread_mutex_lock(load->lock);
+            ListPrepend(load->list, &item);
+            pthread_mutex_unlock(load->lock);
+            pthread_mutex_lock(load->lock);
+            ListTrim(load->list);
+            pthread_mutex_unlock(load->lock);
+        }
+    }
+    if(load->queue != NULL)
+        CListFlushCache();
+    return NULL;
+}
+
+/*
+ * Helper to time threads workers sharing one FIFO, either the lock-free
+    CQUEUE or a LIST behind a mutex
+ * Returns the seconds taken, or a negative value on failure
+ */
+double timeQueue(int threads, long ops, bool lockFree) {
+    static int item;
+    CQUEUE queue;
+    LIST* list = ListCreate();
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_t workers[64];
+    QUEUE_LOAD loads[64];
+
+    if(list == NULL || CQueueInit(&queue) != 0)
+        return -1.0;
+    // Keep the queue from running dry so dequeues always find an item
+    for(int i=0; i<1000; i++) {
+        CQueueEnqueue(&queue, &item);
+        ListPrepend(list, &item);
+    }
+
+    double start = now();
+    for(int i=0; i<threads; i++) {
+        loads[i].queue = lockFree ? &queue : NULL;
+        loads[i].list = list;
+        loads[i].lock = &lock;
+        loads[i].pairs = ops / threads / 2;
+        pthread_create(&workers[i], NULL, queueLoad, &loads[i]);
+    }
+    for(int i=0; i<threads; i++)
+        pthread_join(workers[i], NULL);
+    double elapsed = now() - start;
+
+    CQueueFree(&queue);
+    ListFree(list, NULL);
+    return elapsed;
+}
+
+/*
+ * Measures FIFO throughput under contention from threads threads,
+    lock-free queue against the mutex-guarded list
+ * Returns 0 for success, -1 for failure
+ */
+int benchQueue(int threads, long ops, bool json, bool last) {
+    init();
+    CListInit();
+    double lockFree = timeQueue(threads, ops, true);
+    double locked = timeQueue(threads, ops, false);
+    CListDeinit();
+    deinit();
+    if(lockFree < 0 || locked < 0)
+        return -1;
+
+    if(json) {
+        printf("    {\"threads\": %d, \"ops\": %ld, \"lockfree_ops_per_sec\": %.0f, "
+               "\"locked_ops_per_sec\": %.0f}%s\n",
+               threads, ops, ops / lockFree, ops / locked, last ? "" : ",");
+    } else {
+        printf("queue  %8d threads: lock-free %12.0f ops/s, locked list %12.0f ops/s\n",
+               threads, ops / lockFree, ops / locked);
+    }
+    return 0;
+}
+
+void printResult(WORKLOAD* w, long ops, RESULT* r, bool json, bool last) {
+    if(json) {
+        printf("    {\"name\": \"%s\", \"ops\": %ld, \"seconds\": %.6f, \"ops_per_sec\": %.0f, "
+               "\"peak_memory_kb\": %ld, \"peak_jobs\": %ld, \"cpu_busy\": %.4f, \"migrations\": %ld, "
+               "\"pcb_allocs\": %ld, \"pcb_frees\": %ld, \"pcb_slab_objects\": %ld, \"operations\": {",
+               w->name, ops, r->seconds, ops / r->seconds, r->peakMemoryKB, r->peakJobs,
+               r->busy, r->migrations, r->pcbAllocs, r->pcbFrees, r->pcbSlabObjects);
+        bool first = true;
+        for(int i=0; i<NUM_OPS; i++) {
+            if(r->count[i] == 0)
+                continue;
+            printf("%s\"%s\": {\"count\": %ld, \"p50_ns\": %u, \"p99_ns\": %u}",
+                   first ? "" : ", ", opNames[i], r->count[i],
+                   percentile(r, i, 0.50), percentile(r, i, 0.99));
+            first = false;
+        }
+        printf("}}%s\n", last ? "" : ",");
+        return;
+    }
+
+    printf("\n%s: %ld ops in %.3f s, %.0f ops/s, peak %ld jobs, peak memory %ld KB\n",
+           w->name, ops, r->seconds, ops / r->seconds, r->peakJobs, r->peakMemoryKB);
+    printf("  %d CPUs %.1f%% busy, %ld migrations\n", numCPUs, 100.0 * r->busy, r->migrations);
+    printf("  %ld PCBs allocated, %ld freed, %ld in the slab\n", r->pcbAllocs, r->pcbFrees, r->pcbSlabObjects);
+    for(int i=0; i<NUM_OPS; i++) {
+        if(r->count[i] == 0)
+            continue;
+        printf("  %-8s %9ld ops  p50 %7u ns  p99 %7u ns\n",
+               opNames[i], r->count[i], percentile(r, i, 0.50), percentile(r, i, 0.99));
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int sizes[] = { 1000, 100000, 1000000 };
+    int scanSizes[] = { 10000, 1000000 };
+    int clientCounts[] = { 1, 2, 4, 8 };
+    double pidFills[] = { 0.5, 0.99, 0.9999 };
+    int jobCounts[] = { 1000, 100000 };
+    int threadCounts[] = { 1, 2, 4, 8, 16, 32, 64 };
+    bool json = false;
+    long ops = 200000;
+    unsigned long long seed = 1;
+    const char* only = NULL;
+    const char* traceName = NULL;
+
+    for(int i=1; i<argc; i++) {
+        if(strcmp(argv[i], "-j") == 0) {
+            json = true;
+        } else if(strcmp(argv[i], "-n") == 0 && i+1 < argc) {
+            ops = atol(argv[++i]);
+        } else if(strcmp(argv[i], "-r") == 0 && i+1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "-s") == 0 && i+1 < argc && SchedFind(argv[i+1]) != NULL) {
+            schedPolicy = SchedFind(argv[++i]);
+        } else if(strcmp(argv[i], "-w") == 0 && i+1 < argc) {
+            only = argv[++i];
+        } else if(strcmp(argv[i], "-u") == 0 && i+1 < argc && atoi(argv[i+1]) > 0 && atoi(argv[i+1]) <= MAX_CPUS) {
+            numCPUs = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "-m") == 0 && i+1 < argc && atoi(argv[i+1]) > 0) {
+            numSemaphores = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "-t") == 0 && i+1 < argc) {
+            traceName = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [-j] [-n ops] [-r seed] [-s policy] [-w workload] [-m count] [-u cpus] [-t trace]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(seed == 0)
+        seed = 1;   // xorshift must not start at 0
+
+    PCB_verbose = false;
+    PCB_keepExits = false;     // The histograms are enough here
+
+    if(json) {
+        printf("{\n  \"seed\": %llu,\n  \"ops\": %ld,\n  \"policy\": \"%s\",\n  \"cpus\": %d,\n  \"create_scale\": [\n",
+               seed, ops, schedPolicy->name, numCPUs);
+    }
+    if(only == NULL) {
+        for(int i=0; i<3; i++) {
+            if(benchCreate(sizes[i], json, i == 2) != 0)
+                return 1;
+        }
+    }
+    if(json) {
+        printf("  ],\n  \"scan\": [\n");
+    }
+    if(only == NULL) {
+        for(int i=0; i<2; i++) {
+            if(benchScan(scanSizes[i], json, i == 1) != 0)
+                return 1;
+        }
+    }
+    if(json) {
+        printf("  ],\n  \"clock\": [\n");
+    }
+    if(only == NULL) {
+        for(int i=0; i<2; i++) {
+            if(benchClock(jobCounts[i], seed, json, i == 1) != 0)
+                return 1;
+        }
+    }
+    if(json) {
+        printf("  ],\n  \"snapshot\": [\n");
+    }
+    if(only == NULL) {
+        for(int i=0; i<2; i++) {
+            if(benchSnapshot(jobCounts[i], json, i == 1) != 0)
+                return 1;
+        }
+    }
+    if(json) {
+        printf("  ],\n  \"resume\": [\n");
+    }
+    if(only == NULL) {
+        for(int i=0; i<2; i++) {
+            if(benchResume(jobCounts[i], seed, json, i == 1) != 0)
+                return 1;
+        }
+    }
+    if(json) {
+        printf("  ],\n  \"pidmap\": [\n");
+    }
+    if(only == NULL) {
+        for(int i=0; i<3; i++) {
+            if(benchPidMap(pidFills[i], ops, json, i == 2) != 0)
+                return 1;
+        }
+    }
+    if(json) {
+        printf("  ],\n  \"engine\": [\n");
+    }
+    if(only == NULL) {
+        for(int i=0; i<4; i++) {
+            if(benchEngine(clientCounts[i], ops, seed, json, i == 3) != 0)
+                return 1;
+        }
+    }
+    if(json) {
+        printf("  ],\n  \"queue\": [\n");
+    }
+    if(only == NULL) {
+        for(int i=0; i<7; i++) {
+            if(benchQueue(threadCounts[i], ops, json, i == 6) != 0)
+                return 1;
+        }
+    }
+    if(json) {
+        printf("  ],\n  \"workloads\": [\n");
+    }
+
+    if(traceName != NULL && TraceStart(traceName) != 0) {
+        perror(traceName);
+        return 1;
+    }
+
+    int remaining = 0;
+    for(int i=0; i<NUM_WORKLOADS; i++) {
+        if(only == NULL || strcmp(only, workloads[i].name) == 0)
+            remaining++;
+    }
+
+    for(int i=0; i<NUM_WORKLOADS; i++) {
+        if(only != NULL && strcmp(only, workloads[i].name) != 0)
+            continue;
+
+        RESULT r;
+        rngState = seed;
+        if(runWorkload(&workloads[i], ops, &r) != 0) {
+            fprintf(stderr, "running %s failed\n", workloads[i].name);
+            return 1;
+        }
+        printResult(&workloads[i], ops, &r, json, --remaining == 0);
+        freeResult(&r);
+    }
+    TraceStop();
+
+    if(json) {
+        printf("  ]\n}\n");
+    }
+
+    return 0;
+}
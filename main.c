@@ -1,4 +1,5 @@
-#include "PCB.h"
+#include "Engine.h"
+#include "Snapshot.h"
 
 char getInput()
 {
@@ -9,195 +10,231 @@ char getInput()
     return toupper(input); // Always upper case
 }
 
-int main() {
+/*
+ * Prompts for the argument and message of an interactive command
+ */
+void readArgs(COMMAND* cmd, char* msg) {
+    char tempMsg;
+
+    switch (cmd->op) {
+        case 'C':
+            printf("Creating...\nEnter a priority (0 = lowest, %d = highest): ", numPriorities - 1);
+            break;
+        case 'K':
+            printf("Enter pid to kill: ");
+            break;
+        case 'X':
+            printf("Enter pid to kill along with its descendants: ");
+            break;
+        case 'S':
+            printf("Enter the process (pid) to send the message to: ");
+            break;
+        case 'Y':
+            printf("Enter the process (pid) to send a reply to: ");
+            break;
+        case 'N':
+            printf("Give an initial value for the semaphore: ");
+            break;
+        case 'P':
+            printf("Enter the semaphore id for P operation: ");
+            break;
+        case 'V':
+            printf("Enter the semaphore id for V operation: ");
+            break;
+        case 'I':
+            printf("Enter the process (pid) to display on screen: ");
+            break;
+        case 'U':
+            printf("Enter the CPU for the next commands (0 to %d): ", numCPUs - 1);
+            break;
+        case 'L':
+            printf("Enter a state to list (-1 = deadlocked, 0 = blocked, 1 = ready, 2 = running): ");
+            break;
+        case 'J':
+            printf("Creating a job...\nEnter a priority (0 = lowest, %d = highest): ", numPriorities - 1);
+            break;
+        case 'A':
+            printf("Enter the ticks to advance the clock by (0 = until every job is done): ");
+            break;
+        case 'Z':
+            printf("Enter the ticks for the running process to sleep: ");
+            break;
+        case 'O':
+            printf("Enter the ticks before blocking operations time out (0 = never): ");
+            break;
+        case 'M':
+            printf("Enter the metrics format (0 = JSON, 1 = CSV): ");
+            break;
+    }
+
+    if(commandHasArg(cmd->op))
+        scanf("%d", &cmd->arg);
+
+    if(commandHasMsg(cmd->op)) {
+        if(cmd->op == 'J')
+            printf("Enter the CPU burst, IO burst and total work, in ticks:\n");
+        else
+            printf("Enter a valid message (up to %d characters):\n", MSG_MAX_LEN);
+        scanf("%c",&tempMsg); // temp statement to clear buffer
+        if(fgets(msg, MSG_MAX_LEN + 2, stdin) == NULL)
+            msg[0] = '\0';
+
+        cmd->msgLen = strcspn(msg, "\n");
+        if(msg[cmd->msgLen] != '\n') {
+            // Too long: drop the rest of the line and reject the message
+            int c;
+            while((c = getchar()) != '\n' && c != EOF) { }
+            cmd->msgLen = MSG_MAX_LEN + 1;
+        }
+        msg[cmd->msgLen > MSG_MAX_LEN ? MSG_MAX_LEN : cmd->msgLen] = '\0';
+        cmd->msg = msg;
+    }
+}
+
+/*
+ * Writes the run's metrics to path, as CSV if it ends in ".csv"
+    and JSON otherwise
+ */
+void dumpMetrics(const char* path) {
+    FILE* f = fopen(path, "w");
+    if(f == NULL) {
+        perror(path);
+        return;
+    }
+    
+    size_t length = strlen(path);
+    PCB_writeMetrics(f, length > 4 && strcmp(path + length - 4, ".csv") == 0);
+    fclose(f);
+}
+
+int main(int argc, char* argv[]) {
+    char* scriptName = NULL;
+    char* metricsName = NULL;
+    char* traceName = NULL;
+    char* loadName = NULL;
+    char* saveName = NULL;
+    bool useEngine = false;
+
+    // -c checks the CPU invariants after every command
+    // -d turns deadlock detection off
+    // -p <levels> sets the number of priority levels
+    // -s <policy> picks the scheduling policy
+    // -n <cpus> sets the number of simulated CPUs
+    // -t <ticks> sets the length of a quantum on the simulated clock
+    // -x <pids> sets pid_max, pids then run from 1 to pids - 1
+    // -b <file> runs the commands in file ("-" for stdin) without prompts
+    // -e runs the -b script through the engine thread
+    // -m <file> writes the metrics to file at the end of the run
+    // -r <file> records a binary event trace to file, for replay
+    // -l <file> starts from the snapshot image in file
+    // -w <file> writes a snapshot image of the simulator to file at the end
+    // -q suppresses all simulator output
+    for(int i=1; i<argc; i++) {
+        if(strcmp(argv[i], "-c") == 0) {
+            PCB_checkMode = true;
+        } else if(strcmp(argv[i], "-d") == 0) {
+            PCB_detectDeadlocks = false;
+        } else if(strcmp(argv[i], "-p") == 0 && i+1 < argc && atoi(argv[i+1]) > 0) {
+            numPriorities = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "-s") == 0 && i+1 < argc && SchedFind(argv[i+1]) != NULL) {
+            schedPolicy = SchedFind(argv[++i]);
+        } else if(strcmp(argv[i], "-n") == 0 && i+1 < argc && atoi(argv[i+1]) > 0 && atoi(argv[i+1]) <= MAX_CPUS) {
+            numCPUs = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "-t") == 0 && i+1 < argc && atoi(argv[i+1]) > 0) {
+            quantumTicks = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "-x") == 0 && i+1 < argc && atoi(argv[i+1]) > 1) {
+            pidMax = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "-b") == 0 && i+1 < argc) {
+            scriptName = argv[++i];
+        } else if(strcmp(argv[i], "-m") == 0 && i+1 < argc) {
+            metricsName = argv[++i];
+        } else if(strcmp(argv[i], "-r") == 0 && i+1 < argc) {
+            traceName = argv[++i];
+        } else if(strcmp(argv[i], "-l") == 0 && i+1 < argc) {
+            loadName = argv[++i];
+        } else if(strcmp(argv[i], "-w") == 0 && i+1 < argc) {
+            saveName = argv[++i];
+        } else if(strcmp(argv[i], "-e") == 0) {
+            useEngine = true;
+        } else if(strcmp(argv[i], "-q") == 0) {
+            PCB_verbose = false;
+        } else {
+            printf("Usage: %s [-c] [-d] [-q] [-p levels] [-s policy] [-n cpus] [-t ticks] [-x pids] [-m metrics] [-r trace] [-l image] [-w image] [-b script [-e]]\n", argv[0]);
+            printf("Policies:");
+            for(int j=0; schedPolicies[j] != NULL; j++) {
+                printf(" %s", schedPolicies[j]->name);
+            }
+            printf("\n");
+            return 1;
+        }
+    }
+    
     init();
     init_PCB();
+    if(loadName != NULL && SnapshotLoad(loadName) != 0) {
+        fprintf(stderr, "Failed to load snapshot %s\n", loadName);
+        return 1;
+    }
+    if(traceName != NULL && TraceStart(traceName) != 0) {
+        perror(traceName);
+        return 1;
+    }
+    
+    if(scriptName != NULL) {
+        FILE* f = strcmp(scriptName, "-") == 0 ? stdin : fopen(scriptName, "rb");
+        if(f == NULL) {
+            perror(scriptName);
+            return 1;
+        }
+        
+        size_t length = 0;
+        char* script = readScript(f, &length);
+        if(f != stdin)
+            fclose(f);
+        if(script == NULL) {
+            fprintf(stderr, "Failed to read %s\n", scriptName);
+            return 1;
+        }
+        
+        if(useEngine) {
+            ENGINE engine;
+            if(EngineStart(&engine) != 0) {
+                fprintf(stderr, "Failed to start the engine thread\n");
+                return 1;
+            }
+            EngineRunScript(&engine, script, length);
+            EngineStop(&engine);
+        } else {
+            runScript(script, length);
+        }
+        free(script);
+        TraceStop();
+        if(metricsName != NULL)
+            dumpMetrics(metricsName);
+        if(saveName != NULL && SnapshotSave(saveName) != 0)
+            perror(saveName);
+        return 0;
+    }
+    
     bool isRunning = true;
-    int priority = 0;
-    int pid = 0;
-    char msg[40];
-    char tempMsg;
-    int semaphoreID = 0;
-    int initialValue = 0;
+    char msg[MSG_MAX_LEN + 2];  // Text, newline and NUL
+    COMMAND cmd;
     
     printf("Input \"B\" to break simulation.\n\n");
     while(isRunning) {
-        switch (getInput()) {
-            case 'C':
-                // CREATE
-                printf("Creating...\nEnter a priority (0 = low, 1 = Normal, 2 = High): ");
-                scanf("%d", &priority);
-                if(priority < 0 || priority > 2) {
-                    printf("Invalid entry! Please enter a valid priority next time.\n\n");
-                    break;
-                }
-                
-                pid = create(priority);
-                printf("New process with pid: %d created\n\n", pid);
-                break;
-                
-            case 'F':
-                // FORK
-                
-                // Exception: When no processes in allJobs
-                if(ListCount(allJobs) == 0) {
-                    printf("No jobs present to fork.\n\n");
-                    break;
-                }
-                
-                PCB_fork();
-                break;
-                
-            case 'K':
-                // Kill
-                if(ListCount(allJobs) == 0) {
-                    printf("No jobs present to kill.\n\n");
-                    break;
-                }
-                printf("Enter pid to kill: ");
-                scanf("%d", &pid);
-                printf("\n\n");
-                
-                PCB_kill(pid);
-                break;
-                
-            case 'E':
-                // EXIT
-                if (ListCount(readyJobs) == 0) {
-                    printf("No running jobs to kill.\n\n");
-                    break;
-                }
-                
-                PCB_exit();
-                break;
-                
-            case 'Q':
-                // QUANTUM
-                if (ListCount(allJobs) == 0) {
-                    printf("No processes present for quantum to work.\n\n");
-                    break;
-                }
-                
-                PCB_quantum();
-                break;
-                
-            case 'S':
-                // SEND
-                if (ListCount(allJobs) <= 1) {
-                    printf("Not enough processes present to send to.\n\n");
-                    break;
-                }
-                printf("Enter the process (pid) to send the message to: ");
-                scanf("%d", &pid);
-                printf("Enter a valid message (under 40 characters):\n");
-                scanf("%c",&tempMsg); // temp statement to clear buffer
-                scanf("%[^\n]",msg);
-                printf("The msg is %s\n", msg);
-//                while(fscanf(stdin, "%[^\n]%*c", msg) != EOF) { }
-                
-                PCBsend(pid, msg);
-                printf("\n\n");
-                break;
-                
-            case 'R':
-                // RECEIVE
-                if(ListCount(allJobs) <= 1) {
-                    printf("Not enough processes present to receive a reply.\n\n");
-                    break;
-                }
-                
-                PCB_receive();
-                break;
-                
-            case 'Y':
-                // REPLY
-                if (ListCount(allJobs) <= 0) {
-                    printf("A reply cannot be made.\n\n");
-                    break;
-                }
-                printf("Enter the process (pid) to send a reply to: ");
-                scanf("%d", &pid);
-                printf("Enter a valid message (under 40 characters): ");
-                scanf("%c",&tempMsg); // temp statement to clear buffer
-                scanf("%[^\n]",msg);
-                
-                PCB_reply(pid, msg);
-                printf("\n\n");
-                break;
-                
-            case 'N':
-                // NEW SEMAPHORE
-                if (ListCount(semaphores) > 5) {
-                    printf("Failed to add another semaphore.\n\n");
-                    break;
-                }
-                printf("Give an initial value for the semaphore: ");
-                scanf("%d", &initialValue);
-                semaphoreID = ListCount(semaphores);
-                
-                PCB_newSemaphore(semaphoreID, initialValue);
-                printf("\n\n");
-                break;
-                
-            case 'P':
-                // SEMAPHORE P
-                if(ListCount(semaphores) == 0) {
-                    printf("No semaphores present.\n\n");
-                    break;
-                }
-                printf("Enter the semaphore id for P operation: ");
-                scanf("%d", &semaphoreID);
-                
-                PCB_semaphoreP(semaphoreID);
-                printf("\n\n");
-                break;
-                
-            case 'V':
-                // SEMAPHORE V
-                if(ListCount(semaphores) == 0) {
-                    printf("No semaphores present.\n\n");
-                    break;
-                }
-                printf("Enter the semaphore id for V operation: ");
-                scanf("%d", &semaphoreID);
-                
-                PCB_semaphoreV(semaphoreID);
-                printf("\n\n");
-                break;
-                
-            case 'I':
-                // PROCINFO
-                if(ListCount(allJobs) == 0) {
-                    printf("No processes to display.\n\n");
-                    break;
-                }
-                printf("Enter the process (pid) to display on screen: ");
-                scanf("%d", &pid);
-                
-                PCB_procInfo(pid);
-                printf("\n\n");
-                break;
-                
-            case 'T':
-                // TOTALINFO
-                if(ListCount(allJobs) == 0) {
-                    printf("No processes to display.\n\n");
-                    break;
-                }
-                
-                PCB_totalInfo();
-                break;
-                
-            case 'B':
-                printf("Breaking simulation...\n");
-                isRunning = false;
-                break;
-                
-            default:
-                printf("Invalid Command. Please try again\n");
-                break;
-        }
+        cmd.op = getInput();
+        cmd.arg = 0;
+        cmd.msg = NULL;
+        cmd.msgLen = 0;
+        readArgs(&cmd, msg);
+        
+        isRunning = runCommand(&cmd);
     }
+    TraceStop();
+    if(metricsName != NULL)
+        dumpMetrics(metricsName);
+    if(saveName != NULL && SnapshotSave(saveName) != 0)
+        perror(saveName);
     
 
     return 0;
@@ -0,0 +1,278 @@
+/*
+ * Offline replay of an event trace recorded with main -r
+ * Build: cc -O2 -pthread -o replay replay.c
+ * Run:   ./replay trace [-a index] [-c file] [-i]
+ *   (none)      print a summary of the trace
+ *   -a index    print the state of every process after event index
+ *   -c file     export the trace as Chrome trace / Perfetto JSON
+ *   -i          use event indexes instead of clock ticks as timestamps
+ */
+#include "Trace.h"
+
+// States as PCB.h numbers them, indexed by state + 1
+const char* stateNames[4] = { "Deadlocked", "Blocked", "Ready", "Running" };
+
+const char* eventNames[NUM_TRACE_EVENTS] = {
+    "state", "create", "kill", "quantum", "send", "receive", "reply", "semP", "semV"
+};
+
+// A process as rebuilt from the trace
+typedef struct {
+    bool seen;          // Created, or acted on, somewhere in the events so far
+    bool alive;
+    int priority;
+    int state;
+    int cpu;
+    unsigned long long created;
+    unsigned long long since;   // Timestamp it entered its state
+    long dispatches;
+    long events;        // Events naming it
+} REPLAY_PROC;
+
+REPLAY_PROC* procs;
+int procCapacity;
+
+/*
+ * returns the process with pid, growing the table to hold it
+ */
+REPLAY_PROC* replayProc(int pid) {
+    if(pid < 0)
+        pid = 0;
+    if(pid >= procCapacity) {
+        int size = procCapacity == 0 ? 64 : procCapacity;
+        while(size <= pid)
+            size *= 2;
+        REPLAY_PROC* grown = realloc(procs, size * sizeof(REPLAY_PROC));
+        if(grown == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        memset(grown + procCapacity, 0, (size - procCapacity) * sizeof(REPLAY_PROC));
+        procs = grown;
+        procCapacity = size;
+    }
+    return &procs[pid];
+}
+
+int compareSeq(const void* a, const void* b) {
+    uint32_t x = ((const TRACE_RECORD*) a)->seq;
+    uint32_t y = ((const TRACE_RECORD*) b)->seq;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Puts the records in the order they happened; blocks from several
+    threads are interleaved in the file
+ */
+void sortRecords(TRACE_RECORD* records, long count) {
+    for(long i=1; i<count; i++) {
+        if(records[i].seq < records[i-1].seq) {
+            qsort(records, count, sizeof(TRACE_RECORD), compareSeq);
+            return;
+        }
+    }
+}
+
+/*
+ * Applies one event to the rebuilt processes
+ */
+void applyRecord(TRACE_RECORD* r, unsigned long long ts) {
+    if(r->pid <= 0)
+        return;
+    REPLAY_PROC* p = replayProc(r->pid);
+
+    switch(r->event) {
+        case TRACE_CREATE:
+            memset(p, 0, sizeof(REPLAY_PROC));
+            p->alive = true;
+            p->priority = r->arg;
+            p->state = r->state;
+            p->cpu = -1;
+            p->created = r->time;
+            p->since = ts;
+            break;
+        case TRACE_STATE:
+            p->state = r->state;
+            p->cpu = r->state == 2 ? r->cpu : -1;
+            p->since = ts;
+            if(r->state == 2)
+                p->dispatches++;
+            break;
+        case TRACE_KILL:
+            p->alive = false;
+            break;
+    }
+    p->seen = true;
+    p->events++;
+}
+
+/*
+ * Prints the events by kind and the span of the trace
+ */
+void printSummary(TRACE_RECORD* records, long count) {
+    long byEvent[NUM_TRACE_EVENTS] = {0};
+    for(long i=0; i<count; i++) {
+        if(records[i].event >= 0 && records[i].event < NUM_TRACE_EVENTS)
+            byEvent[(int) records[i].event]++;
+        applyRecord(&records[i], i);
+    }
+
+    long created = 0, alive = 0;
+    for(int pid=0; pid<procCapacity; pid++) {
+        created += procs[pid].seen;
+        alive += procs[pid].alive;
+    }
+
+    printf("%ld events over %llu ticks\n", count, count == 0 ? 0ULL : (unsigned long long) records[count-1].time);
+    for(int e=0; e<NUM_TRACE_EVENTS; e++)
+        printf("  %-8s %ld\n", eventNames[e], byEvent[e]);
+    printf("%ld processes seen, %ld alive at the end\n", created, alive);
+}
+
+/*
+ * Prints every process still alive after event index
+ */
+void printStateAt(TRACE_RECORD* records, long count, long index) {
+    if(index >= count)
+        index = count - 1;
+    for(long i=0; i<=index; i++)
+        applyRecord(&records[i], i);
+
+    if(index >= 0)
+        printf("After event %ld (%s, time %llu):\n", index, eventNames[(int) records[index].event],
+               (unsigned long long) records[index].time);
+    printf("%6s %8s %10s %4s %8s %10s %8s\n", "pid", "priority", "state", "cpu", "created", "dispatches", "events");
+    for(int pid=0; pid<procCapacity; pid++) {
+        REPLAY_PROC* p = &procs[pid];
+        if(!p->alive)
+            continue;
+        printf("%6d %8d %10s %4d %8llu %10ld %8ld\n", pid, p->priority, stateNames[p->state + 1],
+               p->cpu, p->created, p->dispatches, p->events);
+    }
+}
+
+/*
+ * Helper to write one complete event: a span of a state on a process
+    track, and of a process on a CPU track while it ran
+ */
+void writeSpan(FILE* f, REPLAY_PROC* p, int pid, unsigned long long end) {
+    if(!p->alive)
+        return;
+    fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %llu, \"dur\": %llu}",
+            stateNames[p->state + 1], pid, p->since, end - p->since);
+    if(p->state == 2 && p->cpu >= 0)
+        fprintf(f, ",\n{\"name\": \"pid %d\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %llu, \"dur\": %llu}",
+                pid, p->cpu, p->since, end - p->since);
+}
+
+/*
+ * Writes the trace in the Chrome trace event format, which Perfetto and
+    chrome://tracing load: CPUs and processes are tracks of state spans,
+    and operations are instant events on them
+ */
+int exportChrome(TRACE_RECORD* records, long count, const char* path, bool byIndex) {
+    FILE* f = fopen(path, "w");
+    if(f == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    // Timestamps are read as microseconds, so one tick shows as 1us
+    fprintf(f, "{\"traceEvents\": [");
+    fprintf(f, "\n{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, \"args\": {\"name\": \"CPUs\"}}");
+    fprintf(f, ",\n{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"Processes\"}}");
+    int maxCPU = -1;
+
+    unsigned long long ts = 0;
+    for(long i=0; i<count; i++) {
+        TRACE_RECORD* r = &records[i];
+        ts = byIndex ? (unsigned long long) i : r->time;
+        if(r->cpu > maxCPU && r->cpu < 255)
+            maxCPU = r->cpu;
+        REPLAY_PROC* p = r->pid > 0 ? replayProc(r->pid) : NULL;
+
+        switch(r->event) {
+            case TRACE_CREATE:
+                fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                           "\"args\": {\"name\": \"pid %d (priority %d)\"}}", r->pid, r->pid, r->arg);
+                break;
+            case TRACE_STATE:
+            case TRACE_KILL:
+                if(p != NULL)
+                    writeSpan(f, p, r->pid, ts);
+                break;
+            case TRACE_QUANTUM:
+                fprintf(f, ",\n{\"name\": \"quantum\", \"ph\": \"i\", \"s\": \"t\", \"pid\": 0, \"tid\": %d, \"ts\": %llu}",
+                        r->cpu, ts);
+                break;
+            default:
+                fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"pid\": 1, \"tid\": %d, \"ts\": %llu, "
+                           "\"args\": {\"%s\": %d}}", eventNames[(int) r->event], r->pid, ts,
+                        r->event == TRACE_SEM_P || r->event == TRACE_SEM_V ? "semaphore" : "pid", r->arg);
+                break;
+        }
+        if(p != NULL) {
+            if(r->event == TRACE_KILL)
+                fprintf(f, ",\n{\"name\": \"exit\", \"ph\": \"i\", \"s\": \"t\", \"pid\": 1, \"tid\": %d, \"ts\": %llu}",
+                        r->pid, ts);
+            applyRecord(r, ts);
+        }
+    }
+
+    // Close the spans of the processes still alive
+    for(int pid=0; pid<procCapacity; pid++)
+        writeSpan(f, &procs[pid], pid, ts);
+    for(int cpu=0; cpu<=maxCPU; cpu++)
+        fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, "
+                   "\"args\": {\"name\": \"CPU %d\"}}", cpu, cpu);
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    char* traceName = NULL;
+    char* chromeName = NULL;
+    long index = -1;
+    bool byIndex = false;
+
+    for(int i=1; i<argc; i++) {
+        if(strcmp(argv[i], "-a") == 0 && i+1 < argc) {
+            index = atol(argv[++i]);
+        } else if(strcmp(argv[i], "-c") == 0 && i+1 < argc) {
+            chromeName = argv[++i];
+        } else if(strcmp(argv[i], "-i") == 0) {
+            byIndex = true;
+        } else if(argv[i][0] != '-' && traceName == NULL) {
+            traceName = argv[i];
+        } else {
+            traceName = NULL;
+            break;
+        }
+    }
+    if(traceName == NULL) {
+        printf("Usage: %s trace [-a index] [-c chrome.json] [-i]\n", argv[0]);
+        return 1;
+    }
+
+    long count = 0;
+    TRACE_RECORD* records = TraceLoad(traceName, &count);
+    if(records == NULL) {
+        fprintf(stderr, "Failed to read trace %s\n", traceName);
+        return 1;
+    }
+    sortRecords(records, count);
+
+    if(chromeName != NULL) {
+        if(exportChrome(records, count, chromeName, byIndex) != 0)
+            return 1;
+    } else if(index >= 0) {
+        printStateAt(records, count, index);
+    } else {
+        printSummary(records, count);
+    }
+
+    free(records);
+    free(procs);
+    return 0;
+}